@@ -7,12 +7,235 @@
 #include <unistd.h>
 #include <ctype.h>
 #include <time.h>
+#include <signal.h>
+#include <stdint.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <sys/ioctl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 
 #define NUM_TILES_X 9
 #define NUM_TILES_Y 9
+#define NUM_MINES 10
+
+//length of the token the server gives each game for resuming it
+#define SESSION_TOKEN_LENGTH 32
+//number of attempts to reconnect and resume a game after the connection drops
+#define RESUME_ATTEMPTS 5
+//length of the token the server gives on login for logging back in without a password
+#define LOGIN_TOKEN_LENGTH 88
+
+//how a login went
+#define LOGIN_OK 0
+#define LOGIN_FAILED 1
+#define LOGIN_BUSY 2
+#define LOGIN_LOST 3
+
+//how sending a reveal or flag went
+#define MOVE_DONE 0             //made, or turned down by the server with a message
+#define MOVE_LIMITED 1
+#define MOVE_HIT_MINE 2
+#define MOVE_LOST 3
+
+//most actions sent in one batch move, and how a batch move ended
+#define MAX_BATCH_ACTIONS 4096
+#define BATCH_CONTINUE 0
+#define BATCH_HIT_MINE 1
+#define BATCH_WON 2
+
+//board frame types, sent while spectating and each move of a game
+#define FRAME_KEYFRAME 1
+#define FRAME_DELTA 2
+#define FRAME_END 3
+
+//largest board frame, a delta with every tile in it
+#define MAX_FRAME_SIZE (4 + 3 * NUM_TILES_X * NUM_TILES_Y)
+
+//tile codes used in board frames - 0 to 8 are revealed tiles
+#define TILE_CODE_HIDDEN 9
+#define TILE_CODE_FLAG 10
+#define TILE_CODE_MINE 11
+
+//corner of the shared board shown at once
+#define SHARED_VIEW_SIZE 16
+//result of a move on the shared board
+#define SHARED_OK 0
+#define SHARED_ALREADY 1
+#define SHARED_NOT_MINE 2
+#define SHARED_HIT_MINE 3
+#define SHARED_OFF_BOARD 4
+#define SHARED_CLEARED 5
+#define SHARED_LIMIT 6
+
+//kinds of leaderboard query, and most entries the server sends back for one
+#define LEADERBOARD_QUERY_PAGE 0
+#define LEADERBOARD_QUERY_MINE 1
+#define LEADERBOARD_PAGE_MAX 100
+//periods a leaderboard query can cover
+#define LEADERBOARD_ALL_TIME 0
+#define LEADERBOARD_DAILY 1
+#define LEADERBOARD_WEEKLY 2
+
+//result sent in a spectator end frame
+#define GAME_LOST 0
+#define GAME_WON 1
+#define GAME_SUSPENDED 2
+
+//with -m the session runs as a stream of a multiplexed connection
+#define MUX_HELLO "MUX1\n"
+#define MUX_HELLO_LENGTH 5
+#define MUX_OPEN 1
+#define MUX_DATA 2
+#define MUX_CLOSE 3
+#define MUX_PING 4
+#define MUX_PONG 5
+#define MUX_STREAM 1            //the one stream the client opens
+//a server heard nothing from for this long is pinged, and given up on after three times as long
+#define MUX_KEEPALIVE_MS 15000
+
+//most rows and columns in a rendered frame, and lines kept free under a frame
+//redrawn in place for the menu and prompts
+#define RENDER_MAX_ROWS 64
+#define RENDER_MAX_COLUMNS 256
+#define RENDER_FREE_LINES 12
+
+//an action in a batch move
+typedef struct {
+	char type;              //'R' to reveal a tile or 'P' to place a flag
+	uint8_t x;
+	uint8_t y;
+} BatchAction;
+
+//combined result of a batch move
+typedef struct {
+	int num_applied;
+	int num_rejected;
+	int outcome;
+} BatchResult;
+
+//a board kept up to date from the frames the server sends
+typedef struct {
+	int tiles[NUM_TILES_X][NUM_TILES_Y];            //-1 if not revealed
+	bool flagged_tiles[NUM_TILES_X][NUM_TILES_Y];
+	int mines[NUM_TILES_X][NUM_TILES_Y];            //mines known to be there
+	int remaining_mines;
+} BoardModel;
+
+//entry in the list of live games that can be spectated
+typedef struct {
+	int id;
+	char player[200];
+} LiveGameInfo;
+
+//a tile that changed on the shared board
+typedef struct __attribute__((packed)) {
+	uint32_t index;         //y * width + x
+	uint8_t code;
+} SharedTileChange;
+
+//size of the shared board, width is 0 if the server isn't hosting one
+typedef struct {
+	int width;
+	int height;
+	int num_mines;
+} SharedBoardInfo;
+
+//a command on the shared board, with the corner of the view
+typedef struct {
+	char type;              //'R' reveal, 'P' flag, 'V' only fetch changes, 'Q' leave
+	int x;
+	int y;
+	int view_x;
+	int view_y;
+} SharedCommand;
+
+//reply to a shared board command, followed by the changes and then the view if has_view is set
+typedef struct {
+	int result;
+	int mines_remaining;
+	int num_players;
+	int tiles_revealed;
+	int mines_flagged;
+	int num_changes;
+	int has_view;
+} SharedMoveReply;
+
+//a query on the leaderboard, a width of 0 matching entries on any board
+typedef struct {
+	int type;               //LEADERBOARD_QUERY_PAGE or LEADERBOARD_QUERY_MINE
+	int offset;             //rank to start a page from, 0 being the best
+	int limit;
+	int width;
+	int height;
+	int num_mines;
+	int window;             //LEADERBOARD_ALL_TIME, LEADERBOARD_DAILY or LEADERBOARD_WEEKLY
+} LeaderboardQuery;
+
+//reply to a leaderboard query, followed by num_rows LeaderboardRows
+typedef struct {
+	int total;              //-1 if rate limited
+	int num_rows;
+} LeaderboardReply;
+
+//an entry sent in reply to a leaderboard query
+typedef struct {
+	int rank;
+	char name[200];
+	uint64_t time_taken;    //nanoseconds
+	int games_won;
+	int games_played;
+	int width;
+	int height;
+	int num_mines;
+} LeaderboardRow;
+
+//header of each frame on a multiplexed connection, followed by length bytes
+typedef struct __attribute__((packed)) {
+	uint32_t stream;
+	uint8_t type;
+	uint16_t length;
+} MuxHeader;
+
+//a board frame being built, and the rows of the last frame drawn in place
+typedef struct {
+	char rows[RENDER_MAX_ROWS][RENDER_MAX_COLUMNS];
+	int row_lengths[RENDER_MAX_ROWS];
+	int num_rows;
+	char drawn[RENDER_MAX_ROWS][RENDER_MAX_COLUMNS];
+	int drawn_lengths[RENDER_MAX_ROWS];
+	int num_drawn;          //0 to clear the screen and draw the next frame whole
+	char status[RENDER_MAX_COLUMNS];
+	char buffer[RENDER_MAX_ROWS * (RENDER_MAX_COLUMNS + 16) + 32];
+	int length;
+} Renderer;
 
 //pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 
+//server address, kept for reconnecting
+char *server_IP_address;
+int server_port;
+
+//resume token of the game in progress
+char session_token[SESSION_TOKEN_LENGTH + 1];
+
+//token for logging back in, empty until the first login
+char login_token[LOGIN_TOKEN_LENGTH + 1];
+
+//set when the connection to the server has dropped
+bool connection_lost = false;
+
+//run the session over a multiplexed connection
+bool multiplex = false;
+
+//frames are built here and written to the terminal in one go
+Renderer renderer;
+
+//the board of the game in progress
+BoardModel board_model;
+
 //initialise functions
 int connectToServer(char *IP_address, int socket_port_int);
 bool handle_login(int sock);
@@ -25,21 +248,79 @@ char run_minesweeper_menu(void);
 void display_playing_field(int revealed_tiles[NUM_TILES_X][NUM_TILES_Y], int remaining_mines, bool flagged_tiles[NUM_TILES_X][NUM_TILES_Y]);
 bool check_coordinates(char coordinates[2000]);
 void display_mines(int mines[NUM_TILES_X][NUM_TILES_Y]);
+int recv_from_server(int sock, void *buffer, size_t length);
+bool resume_game(int sock);
+bool login_with_token(int sock);
+bool connection_closed(int sock);
+bool run_batch(int sock);
+int send_username(int sock, const char *username);
+int send_password(int sock, const char *password);
+int send_move(int sock, char selection, char coordinates[2000], char reply[2000], int mines[NUM_TILES_X][NUM_TILES_Y]);
+bool parse_batch_action(const char *move, BatchAction *action);
+bool send_batch(int sock, const BatchAction *actions, int num_actions, BatchResult *result, int *tiles_changed, int mines[NUM_TILES_X][NUM_TILES_Y]);
+int receive_leaderboard(int sock, bool show);
+bool parse_leaderboard_query(const char *text, LeaderboardQuery *query);
+bool send_leaderboard_query(int sock, const LeaderboardQuery *query, LeaderboardReply *reply, LeaderboardRow rows[LEADERBOARD_PAGE_MAX]);
+void run_leaderboard_query(int sock);
+int run_script(int sock, FILE *script, FILE *out);
+void run_spectator(int sock);
+void run_shared_board(int sock);
+void display_shared_view(uint8_t view[SHARED_VIEW_SIZE][SHARED_VIEW_SIZE], int view_x, int view_y, SharedMoveReply *reply);
+void render_reset(void);
+void render_text(const char *format, ...);
+void render_cell(char tile);
+void render_end_row(void);
+void render_status(const char *format, ...);
+void render_frame(void);
+void apply_tile_code(int index, int code, BoardModel *board);
+int recv_frame(int sock, uint8_t frame[MAX_FRAME_SIZE]);
+bool apply_frame(BoardModel *board, const uint8_t *frame, int frame_size);
+const char *check_move_locally(char selection, char coordinates[2000]);
+int start_mux_relay(int sock);
+uint64_t monotonic_ms(void);
 
 int main(int argc , char *argv[]){
 	
 	char *IP_address, *socket_port;
     int socket_port_int;
 
-    //pull IP address and port number from args
-    if (argc != 3){
-        printf("Must enter IP address and port\n");
+    //pull IP address and port number from args, then a script to run in place
+    //of the prompts and whether to multiplex the connection
+    FILE *script = NULL;
+    bool valid_args = argc >= 3;
+    for (int i = 3; valid_args && i < argc; i++){
+        if (strcmp(argv[i], "-m") == 0){
+            multiplex = true;
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc && script == NULL){
+            i++;
+            script = strcmp(argv[i], "-") == 0 ? stdin : fopen(argv[i], "r");
+            if (script == NULL){
+                perror("could not open script");
+                return 1;
+            }
+        } else{
+            valid_args = false;
+        }
+    }
+    if (!valid_args){
+        printf("Must enter IP address and port, optionally followed by -s script_file (- for stdin) and -m to multiplex the connection\n");
         return 1;
-    } else{
-        IP_address = argv[1];
-        socket_port = argv[2];
     }
+    IP_address = argv[1];
+    socket_port = argv[2];
     socket_port_int = atoi(socket_port);
+    server_IP_address = IP_address;
+    server_port = socket_port_int;
+
+    //a dropped connection is handled where it is detected, not by SIGPIPE
+    signal(SIGPIPE, SIG_IGN);
+
+    //a script's results get stdout to themselves - everything else goes to stderr
+    FILE *results = NULL;
+    if (script != NULL){
+        results = fdopen(dup(STDOUT_FILENO), "w");
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+    }
 
     //set up connection to server socket
 	int sock;
@@ -47,6 +328,11 @@ int main(int argc , char *argv[]){
 	if (sock == -1){
 		return 1;
 	}
+	if (script != NULL){
+		int result = run_script(sock, script, results);
+		close(sock);
+		return result;
+	}
 
 	//ask user to log in and authenticate
 	bool logged_in;
@@ -62,6 +348,12 @@ int main(int argc , char *argv[]){
 		int menu_selection;
 		menu_selection = run_menu();
 		printf("Your selection: %d\n\n", menu_selection);
+
+		//the server may have restarted while the menu was up - log back in first
+		if (connection_closed(sock) && !login_with_token(sock)){
+			puts("Connection to the server lost");
+			return 1;
+		}
 		send(sock, &menu_selection , sizeof(int), 0);
 
 
@@ -99,13 +391,156 @@ int connectToServer(char *IP_address, int socket_port_int){
     }
     puts("connected");
 
+    //the server's answers are small, so they shouldn't wait on delayed acks either way
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if (multiplex){
+        return start_mux_relay(sock);
+    }
     return sock;
 }
 
-bool handle_login(int sock){
-	int read_size;
+//milliseconds on a clock that only goes forwards
+uint64_t monotonic_ms(void){
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+//relay between the session's end of a socketpair and its stream on a
+//multiplexed connection, answering keepalives, until either side closes
+void *mux_relay_loop(void *data){
+	int *fds = (int*)data;
+	int server = fds[0], session = fds[1];
+	free(fds);
+	uint8_t buffer[UINT16_MAX];
+	MuxHeader header;
+	bool ping_sent = false;
+	uint64_t last_heard = monotonic_ms();
+	while (1){
+		struct pollfd polled[2] = {{.fd = server, .events = POLLIN}, {.fd = session, .events = POLLIN}};
+		int ready = poll(polled, 2, MUX_KEEPALIVE_MS / 4);
+		if (ready < 0 && errno != EINTR){
+			break;
+		}
+
+		//ping a quiet server, and give up on it if it still hasn't answered. only
+		//frames from the server count - the session's own traffic says nothing
+		uint64_t quiet_ms = monotonic_ms() - last_heard;
+		if (quiet_ms > 3 * MUX_KEEPALIVE_MS){
+			break;
+		} else if (quiet_ms > MUX_KEEPALIVE_MS && !ping_sent){
+			header = (MuxHeader){.stream = 0, .type = MUX_PING, .length = 0};
+			send(server, &header, sizeof(header), 0);
+			ping_sent = true;
+		}
+		if (ready <= 0){
+			continue;
+		}
+
+		//frames arrive whole, so their data is waited for
+		if (polled[0].revents){
+			if (recv(server, &header, sizeof(header), MSG_WAITALL) != sizeof(header)
+					|| (header.length > 0 && recv(server, buffer, header.length, MSG_WAITALL) != header.length)){
+				break;
+			}
+			last_heard = monotonic_ms();
+			ping_sent = false;
+			if (header.type == MUX_DATA && header.stream == MUX_STREAM){
+				if (send(session, buffer, header.length, 0) != header.length){
+					break;
+				}
+			} else if (header.type == MUX_CLOSE && header.stream == MUX_STREAM){
+				break;
+			} else if (header.type == MUX_PING){
+				header.type = MUX_PONG;
+				send(server, &header, sizeof(header), 0);
+				send(server, buffer, header.length, 0);
+			}
+		}
+		if (polled[1].revents){
+			int read_size = recv(session, buffer, sizeof(buffer), 0);
+			header = (MuxHeader){.stream = MUX_STREAM, .type = read_size > 0 ? MUX_DATA : MUX_CLOSE, .length = read_size > 0 ? read_size : 0};
+			send(server, &header, sizeof(header), 0);
+			if (read_size <= 0){
+				break;
+			}
+			send(server, buffer, read_size, 0);
+		}
+	}
+	//the session sees the connection close like a dropped plain connection
+	close(server);
+	close(session);
+	return NULL;
+}
+
+//ask the server to multiplex a new connection and open a stream on it. the
+//returned socket stands in for the connection, with a thread relaying it.
+int start_mux_relay(int sock){
+	char hello[MUX_HELLO_LENGTH];
+	MuxHeader header = {.stream = MUX_STREAM, .type = MUX_OPEN, .length = 0};
+	int pair[2];
+	pthread_t thread_id;
+	if (send(sock, MUX_HELLO, MUX_HELLO_LENGTH, 0) != MUX_HELLO_LENGTH
+			|| recv(sock, hello, MUX_HELLO_LENGTH, MSG_WAITALL) != MUX_HELLO_LENGTH
+			|| memcmp(hello, MUX_HELLO, MUX_HELLO_LENGTH) != 0){
+		puts("The server does not multiplex connections");
+		close(sock);
+		return -1;
+	}
+	if (send(sock, &header, sizeof(header), 0) != sizeof(header) || socketpair(AF_UNIX, SOCK_STREAM, 0, pair) < 0){
+		perror("could not open a stream");
+		close(sock);
+		return -1;
+	}
+	int *fds = (int*)malloc(2 * sizeof(int));
+	fds[0] = sock;
+	fds[1] = pair[1];
+	if (pthread_create(&thread_id, NULL, mux_relay_loop, fds) != 0){
+		perror("could not start the relay");
+		close(sock);
+		close(pair[0]);
+		close(pair[1]);
+		free(fds);
+		return -1;
+	}
+	pthread_detach(thread_id);
+	return pair[0];
+}
+
+//send the username to log in with. LOGIN_OK if the password can follow.
+int send_username(int sock, const char *username){
 	char buffer[2000];
+	send(sock, username, strlen(username), 0);
+	int read_size = recv(sock, buffer, 2000 - 1, 0);
+	if (read_size <= 0){
+		return LOGIN_LOST;
+	}
+	buffer[read_size] = '\0';
+	return strstr(buffer, "limit") != NULL ? LOGIN_BUSY : LOGIN_OK;
+}
 
+//send the password, keeping the login token the server gives back
+int send_password(int sock, const char *password){
+	char buffer[2000];
+	send(sock, password, strlen(password)+1, 0);
+	int read_size = recv(sock, buffer, 2000 - 1, 0);
+	if (read_size <= 0){
+		return LOGIN_LOST;
+	}
+	buffer[read_size] = '\0';
+	if (strstr(buffer, "true") == NULL){
+		return LOGIN_FAILED;
+	}
+	//keep the login token that follows for logging back in later
+	if (strncmp(buffer, "true ", 5) == 0 && strlen(&buffer[5]) == LOGIN_TOKEN_LENGTH){
+		strcpy(login_token, &buffer[5]);
+	}
+	return LOGIN_OK;
+}
+
+bool handle_login(int sock){
 	printf("===============================================\n");
     printf("Welcome to the online Minesweeper gaming system\n");
     printf("===============================================\n\n");
@@ -116,28 +551,28 @@ bool handle_login(int sock){
     char username[2000];
     printf("Username: ");
     scanf("%s", username);
-
-    //send username input
-    send(sock, username , strlen(username), 0);
-    read_size = recv(sock, buffer, 2000, 0);
+    int result = send_username(sock, username);
 
     //get password input
-    char password[2000];
-    printf("Password: ");
-    scanf("%s", password);
-
-    //send password input
-    send(sock, password , strlen(password)+2, 0);
-    read_size = recv(sock, buffer, 2000, 0);
-
-    if (strstr(buffer, "true") != NULL){
-    	puts("You have been authenticated\n");
-    	return true;
-    } else{
+    if (result == LOGIN_OK){
+    	char password[2000];
+    	printf("Password: ");
+    	scanf("%s", password);
+    	result = send_password(sock, password);
+    	memset(password, 0, sizeof(password));
+    }
+    if (result == LOGIN_LOST){
+    	puts("Connection to the server lost");
+    	return false;
+    } else if (result == LOGIN_BUSY){
+    	puts("The server is busy, please try again later");
+    	return false;
+    } else if (result == LOGIN_FAILED){
     	puts("You have NOT been authenticated\n");
     	return false;
-
     }
+    puts("You have been authenticated\n");
+    return true;
 }
 
 //run game menu
@@ -150,14 +585,17 @@ int run_menu(void){
 	    printf("Please enter a selection\n");
 	    printf("<1> Play Minesweeper\n");
 	    printf("<2> Show Leaderboard\n");
-	    printf("<3> Quit\n\n");
-	    printf("Selection option (1-3):");
+	    printf("<3> Quit\n");
+	    printf("<4> Spectate a game\n");
+	    printf("<5> Play on the shared board\n");
+	    printf("<6> Query the leaderboard\n\n");
+	    printf("Selection option (1-6):");
 
 	    scanf(" %c", &selection);
 
 	    if (isdigit(selection)){
-	    	int_selection = atoi(&selection);
-	    	if (int_selection > 3 || int_selection < 1){
+	    	int_selection = selection - '0';
+	    	if (int_selection > 6 || int_selection < 1){
 				puts("Please enter a valid selection\n");
 				valid_selection = false;
 			} else{
@@ -181,12 +619,13 @@ char run_minesweeper_menu(void){
 	    printf("Please enter a selection\n");
 	    printf("<R> Reveal a tile\n");
 	    printf("<P> Place a flag\n");
+	    printf("<B> Make several moves at once\n");
 	    printf("<Q> Quit game\n\n");
-	    printf("Selection option (R, P, Q):");
+	    printf("Selection option (R, P, B, Q):");
 
 	    scanf(" %c", &selection);
 
-	    if (strstr(&selection, "R")==NULL && strstr(&selection, "P")==NULL && strstr(&selection, "Q")==NULL){
+	    if (selection != 'R' && selection != 'P' && selection != 'B' && selection != 'Q'){
 			puts("Please enter a valid selection\n");
 			valid_selection = false;
 		} else{
@@ -205,151 +644,801 @@ bool run_selected_function(int menu_selection, int sock){
 		run_leaderboard(sock);
 	} else if (menu_selection == 3){
 		return false;
+	} else if (menu_selection == 4){
+		run_spectator(sock);
+	} else if (menu_selection == 5){
+		run_shared_board(sock);
+	} else if (menu_selection == 6){
+		run_leaderboard_query(sock);
 	}
 	return true;
 }
 
-//run leaderboard by receiving from server
-void run_leaderboard(int sock){
+//update a local board from a tile code
+void apply_tile_code(int index, int code, BoardModel *board){
+	int x = index / NUM_TILES_Y;
+	int y = index % NUM_TILES_Y;
+	board->tiles[x][y] = code <= 8 ? code : -1;
+	board->flagged_tiles[x][y] = code == TILE_CODE_FLAG;
+	board->mines[x][y] = code == TILE_CODE_MINE || code == TILE_CODE_FLAG;
+}
+
+//receive a board frame, prefixed with its size, returning the size or 0 if it couldn't be received
+int recv_frame(int sock, uint8_t frame[MAX_FRAME_SIZE]){
+	uint16_t frame_size;
+	if (recv(sock, &frame_size, sizeof(frame_size), MSG_WAITALL) == sizeof(frame_size) && frame_size >= 4
+		&& frame_size <= MAX_FRAME_SIZE && recv(sock, frame, frame_size, MSG_WAITALL) == frame_size){
+		return frame_size;
+	}
+	return 0;
+}
+
+//apply a keyframe, or the tiles a delta frame says have changed, to a local board.
+//a frame too short for the tiles it claims to carry is turned down, and tiles off
+//the board are skipped
+bool apply_frame(BoardModel *board, const uint8_t *frame, int frame_size){
+	int type = frame[0];
+	int aux = frame[2] | (frame[3] << 8);
+	if (type == FRAME_DELTA ? 4 + 3*aux > frame_size : 4 + NUM_TILES_X * NUM_TILES_Y > frame_size){
+		return false;
+	}
+	board->remaining_mines = frame[1];
+	if (type == FRAME_DELTA){
+		for (int i = 0; i < aux; i++){
+			int index = frame[4 + 3*i] | (frame[5 + 3*i] << 8);
+			if (index < NUM_TILES_X * NUM_TILES_Y){
+				apply_tile_code(index, frame[6 + 3*i], board);
+			}
+		}
+	} else{
+		for (int i = 0; i < NUM_TILES_X * NUM_TILES_Y; i++){
+			apply_tile_code(i, frame[4 + i], board);
+		}
+	}
+	return true;
+}
+
+//check a move against the local board, returning why the server would turn it
+//down, or NULL if it has to be sent. only tiles already revealed or flagged are
+//turned down here - the client doesn't know where the mines are.
+const char *check_move_locally(char selection, char coordinates[2000]){
+	int x = atoi(&coordinates[1]);
+	int y = coordinates[0] - 'A';
+	if (selection == 'R' && board_model.tiles[x][y] != -1){
+		return "This tile has already been revealed, try again.";
+	} else if (selection == 'P' && (board_model.tiles[x][y] != -1 || board_model.flagged_tiles[x][y])){
+		return "This is not a mine, try again.";
+	}
+	return NULL;
+}
+
+//watch another player's game until it ends
+void run_spectator(int sock){
+	int num_games;
+	recv(sock, &num_games, sizeof(int), MSG_WAITALL);
+	if (num_games == 0){
+		printf("There are currently no games being played\n\n");
+		return;
+	}
+
+	//list the live games and choose one
+	LiveGameInfo games[num_games];
+	recv(sock, games, num_games * sizeof(LiveGameInfo), MSG_WAITALL);
+	printf("LIVE GAMES\n");
+	printf("-----------------------------------------------------------\n");
+	for (int i = 0; i < num_games; i++){
+		printf("<%d> %s\n", games[i].id, games[i].player);
+	}
+	printf("-----------------------------------------------------------\n\n");
+	int game_id = 0;
+	printf("Game to spectate: ");
+	scanf("%d", &game_id);
+	send(sock, &game_id, sizeof(int), 0);
+
+	int subscribed;
+	recv(sock, &subscribed, sizeof(int), MSG_WAITALL);
+	if (!subscribed){
+		printf("That game is no longer being played\n\n");
+		return;
+	}
+
+	//apply frames to a local copy of the board until the game ends
+	render_reset();
+	BoardModel board;
+	uint8_t frame[MAX_FRAME_SIZE];
+	while (1){
+		int frame_size = recv_frame(sock, frame);
+		if (!frame_size || !apply_frame(&board, frame, frame_size)){
+			puts("Lost the game being spectated");
+			return;
+		}
+		int type = frame[0];
+		int aux = frame[2] | (frame[3] << 8);
+		display_playing_field(board.tiles, board.remaining_mines, board.flagged_tiles);
+
+		if (type == FRAME_END){
+			if (aux == GAME_WON){
+				printf("The player has found all the mines!\n\n");
+			} else if (aux == GAME_SUSPENDED){
+				printf("The player has lost their connection\n\n");
+			} else{
+				display_mines(board.mines);
+			}
+			return;
+		}
+	}
+}
+
+//show the part of the shared board in view
+void display_shared_view(uint8_t view[SHARED_VIEW_SIZE][SHARED_VIEW_SIZE], int view_x, int view_y, SharedMoveReply *reply){
+	render_end_row();
+	render_text("Mines remaining: %d   Players: %d   You revealed %d tiles and flagged %d mines",
+		reply->mines_remaining, reply->num_players, reply->tiles_revealed, reply->mines_flagged);
+	render_end_row();
+	render_end_row();
+	render_text("      ");
+	for (int i = 0; i < SHARED_VIEW_SIZE; i++){
+		render_text(" %d", (view_x + i) % 10);
+	}
+	render_end_row();
+	render_text("------");
+	for (int i = 0; i < SHARED_VIEW_SIZE; i++){
+		render_text("--");
+	}
+	render_end_row();
+	for (int j = 0; j < SHARED_VIEW_SIZE; j++){
+		render_text("%5d|", view_y + j);
+		for (int i = 0; i < SHARED_VIEW_SIZE; i++){
+			int code = view[j][i];
+			if (code == TILE_CODE_FLAG){
+				render_cell('+');
+			} else if (code == TILE_CODE_MINE){
+				render_cell('*');
+			} else if (code == TILE_CODE_HIDDEN){
+				render_cell(' ');
+			} else{
+				render_cell('0' + code);
+			}
+		}
+		render_end_row();
+	}
+	render_end_row();
+	render_frame();
+}
+
+//play on the board shared with every other player on it
+void run_shared_board(int sock){
+	SharedBoardInfo info;
+	if (recv(sock, &info, sizeof(info), MSG_WAITALL) != sizeof(info)){
+		return;
+	}
+	if (info.width == 0){
+		printf("The server is not hosting a shared board\n\n");
+		return;
+	}
+	render_reset();
+	render_status("Joined a shared %dx%d board with %d mines", info.width, info.height, info.num_mines);
+
+	uint8_t view[SHARED_VIEW_SIZE][SHARED_VIEW_SIZE];
+	int view_x = 0, view_y = 0;
+	SharedCommand command = {.type = 'V', .view_x = 0, .view_y = 0};
+	while (1){
+		command.view_x = view_x;
+		command.view_y = view_y;
+		send(sock, &command, sizeof(command), 0);
+		if (command.type == 'Q'){
+			return;
+		}
+
+		SharedMoveReply reply;
+		if (recv(sock, &reply, sizeof(reply), MSG_WAITALL) != sizeof(reply)){
+			puts("Lost the connection to the shared board");
+			return;
+		}
+		//apply the changes made by every player, keeping those in view
+		SharedTileChange changes[256];
+		for (int received = 0; received < reply.num_changes; ){
+			int chunk = reply.num_changes - received < 256 ? reply.num_changes - received : 256;
+			if (recv(sock, changes, chunk * sizeof(SharedTileChange), MSG_WAITALL) <= 0){
+				puts("Lost the connection to the shared board");
+				return;
+			}
+			for (int i = 0; i < chunk; i++){
+				int x = changes[i].index % info.width - view_x;
+				int y = changes[i].index / info.width - view_y;
+				if (x >= 0 && x < SHARED_VIEW_SIZE && y >= 0 && y < SHARED_VIEW_SIZE){
+					view[y][x] = changes[i].code;
+				}
+			}
+			received += chunk;
+		}
+		if (reply.has_view && recv(sock, view, sizeof(view), MSG_WAITALL) <= 0){
+			puts("Lost the connection to the shared board");
+			return;
+		}
+		display_shared_view(view, view_x, view_y, &reply);
+
+		if (reply.result == SHARED_HIT_MINE){
+			printf("Game over! You have hit a mine\n\n");
+			return;
+		} else if (reply.result == SHARED_CLEARED){
+			printf("Every mine on the shared board has been found!\n\n");
+			return;
+		} else if (reply.result == SHARED_NOT_MINE){
+			printf("This is not a mine, try again.\n");
+		} else if (reply.result == SHARED_ALREADY){
+			printf("That tile has already been taken\n");
+		} else if (reply.result == SHARED_OFF_BOARD){
+			printf("Those coordinates are not on the board\n");
+		} else if (reply.result == SHARED_LIMIT){
+			printf("Moves are being made too quickly, please slow down\n");
+		}
+
+		//read commands until one needs the server
+		while (1){
+			printf("<R x y> Reveal a tile, <P x y> Place a flag, <M x y> Move the view, <V> Refresh, <Q> Leave\n");
+			printf("Command: ");
+			char type;
+			int x = 0, y = 0;
+			if (scanf(" %c", &type) != 1){
+				type = 'Q';
+			}
+			type = toupper(type);
+			if ((type == 'R' || type == 'P' || type == 'M') && scanf("%d %d", &x, &y) != 2){
+				scanf("%*[^\n]");
+				puts("Please enter the coordinates as x y\n");
+				continue;
+			}
+			if (type == 'M'){
+				//keep the whole view on the board
+				view_x = x < 0 ? 0 : x > info.width - SHARED_VIEW_SIZE ? info.width - SHARED_VIEW_SIZE : x;
+				view_y = y < 0 ? 0 : y > info.height - SHARED_VIEW_SIZE ? info.height - SHARED_VIEW_SIZE : y;
+				type = 'V';
+			} else if (type != 'R' && type != 'P' && type != 'V' && type != 'Q'){
+				puts("Please enter a valid command\n");
+				continue;
+			}
+			command = (SharedCommand){.type = type, .x = x, .y = y};
+			break;
+		}
+	}
+}
+
+//receive the leaderboard, printing its entries if show is set. returns the
+//number of entries, or -1 if it has been requested too often.
+int receive_leaderboard(int sock, bool show){
 	char leaderboard_entry[2000];
 	int num_entries;
 	char *confirmation = "confirmation";
 
+	if (recv(sock, &num_entries, sizeof(int), 0) <= 0){
+		return -1;
+	}
+	for (int i = 0; i < num_entries; i++){
+		memset(leaderboard_entry, 0, sizeof(leaderboard_entry));
+		recv(sock, leaderboard_entry, sizeof(char)*2000 - 1, 0);
+		send(sock,confirmation, 2000*sizeof(char), 0);
+		if (show){
+			printf("%s\n", leaderboard_entry);
+		}
+	}
+	return num_entries;
+}
+
+//run leaderboard by receiving from server
+void run_leaderboard(int sock){
 	printf("LEADERBOARD\n");
 	printf("-----------------------------------------------------------\n");
 
-	recv(sock, &num_entries, sizeof(int), 0);
-
-	if (num_entries == 0){
+	int num_entries = receive_leaderboard(sock, true);
+	if (num_entries < 0){
+		printf("The leaderboard has been requested too often, please try again shortly\n");
+	} else if (num_entries == 0){
 		printf("There are currenlty no leaderboard entries\n");
+	}
+
+	printf("-----------------------------------------------------------\n\n");
+}
+
+//read a leaderboard query such as "top 10", "page 21 10" or "mine", optionally
+//followed by today or week and a board such as 9x9,10
+bool parse_leaderboard_query(const char *text, LeaderboardQuery *query){
+	char kind[16];
+	int consumed = 0, from;
+	memset(query, 0, sizeof(LeaderboardQuery));
+	if (sscanf(text, "%15s%n", kind, &consumed) != 1){
+		return false;
+	}
+	text += consumed;
+	if (strcmp(kind, "top") == 0){
+		query->type = LEADERBOARD_QUERY_PAGE;
+		if (sscanf(text, "%d%n", &query->limit, &consumed) != 1 || query->limit < 1){
+			return false;
+		}
+	} else if (strcmp(kind, "page") == 0){
+		query->type = LEADERBOARD_QUERY_PAGE;
+		if (sscanf(text, "%d %d%n", &from, &query->limit, &consumed) != 2 || from < 1 || query->limit < 1){
+			return false;
+		}
+		query->offset = from - 1;
+	} else if (strcmp(kind, "mine") == 0){
+		query->type = LEADERBOARD_QUERY_MINE;
+		consumed = 0;
 	} else{
-		for (int i = 0; i < num_entries; i++){
-			recv(sock, leaderboard_entry, sizeof(char)*2000, 0);
-			send(sock,confirmation, 2000*sizeof(char), 0);
-			printf("%s\n", leaderboard_entry);
-			memset(leaderboard_entry, 0, strlen(leaderboard_entry));
+		return false;
+	}
+	text += consumed;
+	char word[32];
+	while (sscanf(text, "%31s%n", word, &consumed) == 1){
+		text += consumed;
+		if (strcmp(word, "today") == 0){
+			query->window = LEADERBOARD_DAILY;
+		} else if (strcmp(word, "week") == 0){
+			query->window = LEADERBOARD_WEEKLY;
+		} else if (sscanf(word, "%dx%d,%d", &query->width, &query->height, &query->num_mines) != 3
+				|| query->width < 1 || query->height < 1){
+			return false;
 		}
 	}
+	return true;
+}
+
+//send a leaderboard query, menu selection 6 having been sent, and receive the
+//rows in reply. returns false if the connection drops.
+bool send_leaderboard_query(int sock, const LeaderboardQuery *query, LeaderboardReply *reply, LeaderboardRow rows[LEADERBOARD_PAGE_MAX]){
+	send(sock, query, sizeof(LeaderboardQuery), 0);
+	if (recv(sock, reply, sizeof(LeaderboardReply), MSG_WAITALL) != sizeof(LeaderboardReply)
+			|| reply->num_rows < 0 || reply->num_rows > LEADERBOARD_PAGE_MAX){
+		connection_lost = true;
+		return false;
+	}
+	int size = reply->num_rows * sizeof(LeaderboardRow);
+	if (size > 0 && recv(sock, rows, size, MSG_WAITALL) != size){
+		connection_lost = true;
+		return false;
+	}
+	return true;
+}
 
+//ask for a page of the leaderboard or your own best entry and show it
+void run_leaderboard_query(int sock){
+	char text[200];
+	LeaderboardQuery query;
+	printf("Query the leaderboard with one of\n");
+	printf("  top N          the best N entries\n");
+	printf("  page FROM N    N entries from rank FROM\n");
+	printf("  mine           your best entry and its rank\n");
+	printf("optionally followed by today or week and a board such as %dx%d,%d:", NUM_TILES_X, NUM_TILES_Y, NUM_MINES);
+	scanf(" %199[^\n]", text);
+	while (!parse_leaderboard_query(text, &query)){
+		printf("Please enter a query such as top 10, page 21 10 or mine:");
+		scanf(" %199[^\n]", text);
+	}
+
+	LeaderboardReply reply;
+	LeaderboardRow rows[LEADERBOARD_PAGE_MAX];
+	if (!send_leaderboard_query(sock, &query, &reply, rows)){
+		return;
+	}
+	printf(query.window == LEADERBOARD_DAILY ? "LEADERBOARD - TODAY\n" : query.window == LEADERBOARD_WEEKLY ? "LEADERBOARD - THIS WEEK\n" : "LEADERBOARD\n");
+	printf("-----------------------------------------------------------\n");
+	if (reply.total < 0){
+		printf("The leaderboard has been requested too often, please try again shortly\n");
+	} else if (reply.num_rows == 0){
+		printf(query.type == LEADERBOARD_QUERY_MINE ? "You have no leaderboard entries\n" : "There are no leaderboard entries here\n");
+	}
+	for (int i = 0; i < reply.num_rows; i++){
+		printf("%d. %s \t %.3f seconds \t %d games won, %d games played \t %dx%d, %d mines\n", rows[i].rank,
+			rows[i].name, rows[i].time_taken / 1e9, rows[i].games_won, rows[i].games_played,
+			rows[i].width, rows[i].height, rows[i].num_mines);
+	}
+	if (reply.total > 0){
+		printf("%d entries in all\n", reply.total);
+	}
 	printf("-----------------------------------------------------------\n\n");
 }
 
+//receive from the server, noting if the connection has dropped
+int recv_from_server(int sock, void *buffer, size_t length){
+	int read_size = recv(sock, buffer, length, 0);
+	if (read_size <= 0){
+		connection_lost = true;
+	}
+	return read_size;
+}
+
+//reconnect to the server and pick up the game in progress.
+//the new connection takes over the old socket descriptor.
+bool resume_game(int sock){
+	puts("Connection to the server lost, trying to resume the game...");
+	for (int attempt = 0; attempt < RESUME_ATTEMPTS; attempt++){
+		sleep(1);
+		int new_sock = connectToServer(server_IP_address, server_port);
+		if (new_sock == -1){
+			continue;
+		}
+
+		//send resume token in place of the username
+		char request[2000], buffer[2000] = {0};
+		snprintf(request, sizeof(request), "RESUME %s", session_token);
+		send(new_sock, request, strlen(request), 0);
+		recv(new_sock, buffer, 2000 - 1, 0);
+		if (strstr(buffer, "limit") != NULL){
+			//the server is busy, try again on the next attempt
+			close(new_sock);
+			continue;
+		}
+		if (strstr(buffer, "resumed") == NULL){
+			puts("The server no longer has this game");
+			close(new_sock);
+			return false;
+		}
+
+		char ready[2000] = "ready";
+		send(new_sock, ready, strlen(ready), 0);
+
+		dup2(new_sock, sock);
+		close(new_sock);
+		connection_lost = false;
+		puts("Game resumed\n");
+		return true;
+	}
+	return false;
+}
+
+//turn a move such as RA1 into a batch action, false if it isn't one
+bool parse_batch_action(const char *move, BatchAction *action){
+	char coordinates[2000];
+	if ((move[0] != 'R' && move[0] != 'P') || strlen(move) > 3){
+		return false;
+	}
+	strcpy(coordinates, &move[1]);
+	if (!check_coordinates(coordinates)){
+		return false;
+	}
+	action->type = move[0];
+	action->x = atoi(&move[2]);
+	action->y = move[1] - 'A';
+	return true;
+}
+
+//send moves as one batch and apply the tiles they changed to the local board.
+//false if the connection dropped or the server was not taking moves. the
+//mines follow when a mine was hit.
+bool send_batch(int sock, const BatchAction *actions, int num_actions, BatchResult *result, int *tiles_changed, int mines[NUM_TILES_X][NUM_TILES_Y]){
+	char selection = 'B', buffer[2000] = {0};
+	send(sock, &selection, sizeof(char), 0);
+	recv_from_server(sock, buffer, 2000 - 1);
+	if (connection_lost || strstr(buffer, "limit") != NULL){
+		return false;
+	}
+	send(sock, &num_actions, sizeof(int), 0);
+	send(sock, actions, num_actions * sizeof(BatchAction), 0);
+
+	//combined result, then the tiles that changed
+	uint8_t frame[MAX_FRAME_SIZE];
+	int frame_size = 0;
+	if (recv(sock, result, sizeof(BatchResult), MSG_WAITALL) <= 0 || !(frame_size = recv_frame(sock, frame))
+		|| !apply_frame(&board_model, frame, frame_size)){
+		connection_lost = true;
+		return false;
+	}
+	*tiles_changed = frame[2] | (frame[3] << 8);
+	if (result->outcome == BATCH_HIT_MINE){
+		recv(sock, mines, sizeof(int)*NUM_TILES_Y*NUM_TILES_X, MSG_WAITALL);
+	}
+	return true;
+}
+
+//read several moves, send them as one batch and show the combined result.
+//returns false if a mine was hit.
+bool run_batch(int sock){
+	static BatchAction actions[MAX_BATCH_ACTIONS];
+	int num_actions = 0;
+	char move[2001];
+
+	printf("Enter moves such as RA1 PB2, then a full stop: ");
+	while (scanf("%2000s", move) == 1 && strcmp(move, ".") != 0){
+		if (num_actions == MAX_BATCH_ACTIONS){
+			printf("Skipping %s, at most %d moves can be made at once\n", move, MAX_BATCH_ACTIONS);
+		} else if (!parse_batch_action(move, &actions[num_actions])){
+			printf("Skipping %s, moves are R or P followed by tile coordinates\n", move);
+		} else{
+			num_actions++;
+		}
+	}
+	printf("\n");
+
+	BatchResult result;
+	int tiles_changed, mines[NUM_TILES_X][NUM_TILES_Y];
+	if (!send_batch(sock, actions, num_actions, &result, &tiles_changed, mines)){
+		if (!connection_lost){
+			puts("You are making moves too quickly, please slow down\n");
+		}
+		return true;
+	}
+	printf("%d of %d moves made, %d of them not valid, %d tiles changed\n\n",
+		result.num_applied, num_actions, result.num_rejected, tiles_changed);
+
+	if (result.outcome == BATCH_HIT_MINE){
+		printf("Game over! You have hit a mine\n\n");
+		display_mines(mines);
+		return false;
+	}
+	return true;
+}
+
+//check, without blocking, whether the server has closed the connection
+bool connection_closed(int sock){
+	char byte;
+	int read_size = recv(sock, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+	return read_size == 0 || (read_size < 0 && errno != EAGAIN && errno != EWOULDBLOCK);
+}
+
+//reconnect to the server and log back in with the login token, for when
+//the game in progress could not be resumed. the new connection takes over
+//the old socket descriptor and starts at the menu.
+bool login_with_token(int sock){
+	if (login_token[0] == '\0'){
+		return false;
+	}
+	int new_sock = connectToServer(server_IP_address, server_port);
+	if (new_sock == -1){
+		return false;
+	}
+
+	//send login token in place of the username
+	char request[2000], buffer[2000] = {0};
+	snprintf(request, sizeof(request), "TOKEN %s", login_token);
+	send(new_sock, request, strlen(request), 0);
+	recv(new_sock, buffer, 2000 - 1, 0);
+	if (strstr(buffer, "true") == NULL){
+		close(new_sock);
+		return false;
+	}
+
+	dup2(new_sock, sock);
+	close(new_sock);
+	connection_lost = false;
+	puts("Logged back in\n");
+	return true;
+}
+
 //run the minesweeper game
 void run_minesweeper(int sock){
 
 	int read_size;
 
+	//receive the token for resuming this game
+	read_size = recv(sock, session_token, sizeof(session_token), 0);
+
+	render_reset();
 	bool playing_minesweeper = true;
 	bool won_game = false;
 	while(playing_minesweeper && !won_game){
 		playing_minesweeper = run_minesweeper_step(sock);
-		char ready[2000] = "ready";
-		send(sock, ready, strlen(ready), 0);
-		recv(sock, &won_game, sizeof(bool), 0);
+		if (!connection_lost){
+			char ready[2000] = "ready";
+			send(sock, ready, strlen(ready), 0);
+			recv_from_server(sock, &won_game, sizeof(bool));
+		}
+		if (connection_lost){
+			if (!resume_game(sock)){
+				puts("Could not resume the game");
+				if (login_with_token(sock)){
+					return;
+				}
+				exit(1);
+			}
+			playing_minesweeper = true;
+			won_game = false;
+		}
 	}
 	if (won_game){
-		time_t time_taken;
-		recv(sock, &time_taken, sizeof(time_t), 0);
-		printf("Congratulations you have found all the mines. You have won in %ld seconds!\n\n", time_taken);
+		uint64_t time_taken;    //nanoseconds
+		recv(sock, &time_taken, sizeof(uint64_t), 0);
+		printf("Congratulations you have found all the mines. You have won in %.3f seconds!\n\n", time_taken / 1e9);
+	}
+}
+
+//work out whether frames can be redrawn in place. they can when the output is
+//a terminal with room for a frame and the menu printed under it, so the frame
+//never scrolls away from the top of the screen.
+bool render_in_place(void){
+	struct winsize window;
+	if (!isatty(STDOUT_FILENO) || ioctl(STDOUT_FILENO, TIOCGWINSZ, &window) < 0){
+		return false;
+	}
+	return window.ws_row >= renderer.num_rows + RENDER_FREE_LINES;
+}
+
+//draw the next frame whole, from the top of a cleared screen
+void render_reset(void){
+	renderer.num_drawn = 0;
+	renderer.status[0] = '\0';
+}
+
+//add text to the row being built
+void render_text(const char *format, ...){
+	int *length = &renderer.row_lengths[renderer.num_rows];
+	va_list args;
+	va_start(args, format);
+	int written = vsnprintf(&renderer.rows[renderer.num_rows][*length], RENDER_MAX_COLUMNS - *length, format, args);
+	va_end(args);
+	*length += written < RENDER_MAX_COLUMNS - *length ? written : RENDER_MAX_COLUMNS - 1 - *length;
+}
+
+//add a tile to the row being built, drawn as a space then its character
+void render_cell(char tile){
+	int *length = &renderer.row_lengths[renderer.num_rows];
+	if (*length + 2 < RENDER_MAX_COLUMNS){
+		renderer.rows[renderer.num_rows][(*length)++] = ' ';
+		renderer.rows[renderer.num_rows][(*length)++] = tile;
+	}
+}
+
+void render_end_row(void){
+	if (renderer.num_rows < RENDER_MAX_ROWS - 1){
+		renderer.num_rows++;
 	}
+	renderer.row_lengths[renderer.num_rows] = 0;
+}
+
+//show a message under the board. printed straight away, and kept as the last
+//row of the next frame drawn in place, which would otherwise clear it.
+void render_status(const char *format, ...){
+	va_list args;
+	va_start(args, format);
+	vsnprintf(renderer.status, sizeof(renderer.status), format, args);
+	va_end(args);
+	printf("%s\n", renderer.status);
+	renderer.status[strcspn(renderer.status, "\n")] = '\0';
+}
+
+static void render_append(const char *data, int length){
+	memcpy(&renderer.buffer[renderer.length], data, length);
+	renderer.length += length;
+}
+
+//write out the frame that has been built, in one write
+void render_frame(void){
+	bool in_place = render_in_place();
+	if (in_place && renderer.status[0] != '\0'){
+		render_text("%s", renderer.status);
+		render_end_row();
+	}
+	renderer.status[0] = '\0';
+
+	renderer.length = 0;
+	if (!in_place){
+		//whole frame, as plain text
+		for (int i = 0; i < renderer.num_rows; i++){
+			render_append(renderer.rows[i], renderer.row_lengths[i]);
+			render_append("\n", 1);
+		}
+		renderer.num_drawn = 0;
+	} else{
+		//the rows that differ from those on the screen, or all of them on a cleared screen
+		bool whole = renderer.num_drawn == 0;
+		if (whole){
+			render_append("\033[H\033[2J", 7);
+		}
+		char escape[32];
+		for (int i = 0; i < renderer.num_rows; i++){
+			if (!whole && i < renderer.num_drawn && renderer.row_lengths[i] == renderer.drawn_lengths[i]
+					&& memcmp(renderer.rows[i], renderer.drawn[i], renderer.row_lengths[i]) == 0){
+				continue;
+			}
+			render_append(escape, snprintf(escape, sizeof(escape), "\033[%d;1H", i + 1));
+			render_append(renderer.rows[i], renderer.row_lengths[i]);
+			render_append("\033[K", 3);
+			memcpy(renderer.drawn[i], renderer.rows[i], renderer.row_lengths[i]);
+			renderer.drawn_lengths[i] = renderer.row_lengths[i];
+		}
+		//clear what was printed under the last frame and carry on below this one
+		render_append(escape, snprintf(escape, sizeof(escape), "\033[%d;1H\033[J", renderer.num_rows + 1));
+		renderer.num_drawn = renderer.num_rows;
+	}
+
+	fflush(stdout);
+	for (int written = 0; written < renderer.length; ){
+		int result = write(STDOUT_FILENO, &renderer.buffer[written], renderer.length - written);
+		if (result < 0 && errno != EINTR){
+			break;
+		}
+		written += result > 0 ? result : 0;
+	}
+	renderer.num_rows = 0;
+	renderer.row_lengths[0] = 0;
 }
 
 //display all mines on game over
 void display_mines(int mines[NUM_TILES_X][NUM_TILES_Y]){
 
-	printf("Game over, you hit a mine!\n");
-	//print top row
-	printf("   ");
+	render_text("Game over, you hit a mine!");
+	render_end_row();
+	//top row
+	render_text("   ");
 	for (int i = 0; i < NUM_TILES_X; i++){
-		printf(" %d", i);
+		render_text(" %d", i);
 	}
-	printf("\n");
-	printf("----------------------\n");
+	render_end_row();
+	render_text("----------------------");
+	render_end_row();
 
-	//print the rest
+	//the rest
 	for (int i = 0; i < NUM_TILES_Y; i++){
-		char letter = i + 0x41;
-		printf("%c |", letter);
+		render_text("%c |", i + 0x41);
 		for (int j = 0; j < NUM_TILES_X; j++){
-			if (mines[j][i] == 1){
-				printf(" *");
-			}else{
-				printf("  ");
-			}
+			render_cell(mines[j][i] == 1 ? '*' : ' ');
 		}
-		printf("\n");
+		render_end_row();
 	}
-
-	printf("\n");
+	render_end_row();
+	render_frame();
 }
 
 //display playing field based on tiles sent and remaining mines
 void display_playing_field(int tiles[NUM_TILES_X][NUM_TILES_Y], int remaining_mines, bool flagged_tiles[NUM_TILES_X][NUM_TILES_Y]){
-	printf("Remaining mines: %d\n\n", remaining_mines);
+	render_text("Remaining mines: %d", remaining_mines);
+	render_end_row();
+	render_end_row();
 
-	//print top row
-	printf("   ");
+	//top row
+	render_text("   ");
 	for (int i = 0; i < NUM_TILES_X; i++){
-		printf(" %d", i);
+		render_text(" %d", i);
 	}
-	printf("\n");
-	printf("----------------------\n");
+	render_end_row();
+	render_text("----------------------");
+	render_end_row();
 
-	//print the rest
+	//the rest
 	for (int i = 0; i < NUM_TILES_Y; i++){
-		char letter = i + 0x41;
-		printf("%c |", letter);
+		render_text("%c |", i + 0x41);
 		for (int j = 0; j < NUM_TILES_X; j++){
 			if (tiles[j][i] != -1){
-				printf(" %d", tiles[j][i]);
+				render_cell('0' + tiles[j][i]);
 			} else if (flagged_tiles[j][i]){
-				printf(" +");
+				render_cell('+');
 			} else{
-				printf("  ");
+				render_cell(' ');
 			}
 		}
-		printf("\n");
+		render_end_row();
 	}
-
-	printf("\n");
+	render_end_row();
+	render_frame();
 }
 
 //run an iteration of minesweeper
 bool run_minesweeper_step(int sock){
 	int read_size;
-	int tiles[NUM_TILES_X][NUM_TILES_Y];
-
-	//revieve tiles necessary
-	read_size = recv(sock, tiles, (NUM_TILES_X * NUM_TILES_Y) * sizeof(int), 0);
-	if (read_size < 0){
-		printf("Did not receive revealed tiles\n");
-	}
-
-	//receive number of remaining tiles
-	int remaining_mines;
-	read_size = recv(sock, &remaining_mines, sizeof(int), 0);
-	if (read_size < 0){
-		printf("Did not receive revealed tiles\n");
-	}
 
-	//receive flagged tiles
-	bool flagged_tiles[NUM_TILES_X][NUM_TILES_Y];
-	read_size = recv(sock, flagged_tiles, (NUM_TILES_X * NUM_TILES_Y) * sizeof(bool), 0);
-	if (read_size < 0){
+	//bring the local board up to date with the tiles that changed
+	uint8_t frame[MAX_FRAME_SIZE];
+	int frame_size = recv_frame(sock, frame);
+	if (!frame_size || !apply_frame(&board_model, frame, frame_size)){
+		connection_lost = true;
 		printf("Did not receive revealed tiles\n");
+		return true;
 	}
 
 	//display the playing field based on these
-	display_playing_field(tiles, remaining_mines, flagged_tiles);
+	display_playing_field(board_model.tiles, board_model.remaining_mines, board_model.flagged_tiles);
 
+	//run the minesweeper menu until there is a move to send. moves the local
+	//board shows would be turned down are answered here, without asking the server.
 	char selection;
-	//run the minesweeper menu
-	selection = run_minesweeper_menu();
-	printf("Menu selection: %c\n\n", selection);
-
-	//if player chosen R or P, get coordinated and check they are valid
 	char coordinates[2000], buffer[2000];
-	if(strstr(&selection, "R")!=NULL || strstr(&selection, "P")!=NULL){
+	while (1){
+		selection = run_minesweeper_menu();
+		printf("Menu selection: %c\n\n", selection);
+		if (selection != 'R' && selection != 'P'){
+			break;
+		}
+
+		//get coordinates and check they are valid
 		bool coords_valid = false;
 		while (!coords_valid){
 			printf("Enter tile coordinates: ");
@@ -359,45 +1448,37 @@ bool run_minesweeper_step(int sock){
 				puts("You have not entered valid coordinates, try again");
 			}
 		}
-		
-		//send minesweeper menu selection
-		printf("\n");
-		if (send(sock, &selection, sizeof(char), 0) < 0){
-			puts("send failed");
+		const char *rejection = check_move_locally(selection, coordinates);
+		if (rejection == NULL){
+			break;
 		}
-		
-		//receive confirmation of send
-		read_size = recv(sock, buffer, 2000, 0);
-		
-		//send coordinates
-		if (send(sock, coordinates, sizeof(char)*2000, 0) < 0){
-			puts("send failed");
-		}
-		memset(coordinates,0,strlen(coordinates));
-
-		//prints message if place a tile is not on a mine
-		if (strstr(&selection, "P")!=NULL){
-			read_size = recv(sock, buffer, 2000, 0);
-			if (strstr(buffer, "not")!=NULL){
-				printf("%s\n\n", buffer);
-				return true;
-			}
-		} else{ //prints a message if user has hit a tile
-			read_size = recv(sock, buffer, 2000, 0);
-			if (strstr(buffer, "over")!=NULL){
-				printf("%s\n\n", buffer);
-				int mines[NUM_TILES_X][NUM_TILES_Y];
-				recv(sock, mines, sizeof(int)*NUM_TILES_Y*NUM_TILES_X, 0);
-				display_mines(mines);
-				return false;
-			} else if(strstr(buffer, "already")!=NULL){
-				printf("%s\n", buffer);
-				return true;
-			}
+		render_status("%s\n", rejection);
+	}
+
+	if(selection == 'R' || selection == 'P'){
+		printf("\n");
+		char reply[2000];
+		int mines[NUM_TILES_X][NUM_TILES_Y];
+		int outcome = send_move(sock, selection, coordinates, reply, mines);
+		if (outcome == MOVE_LIMITED){
+			puts("You are making moves too quickly, please slow down\n");
+		} else if (outcome == MOVE_HIT_MINE){
+			render_status("%s\n", reply);
+			display_mines(mines);
+			return false;
+		} else if (outcome == MOVE_DONE && strstr(reply, "not a mine") != NULL){
+			render_status("%s\n", reply);
+		} else if (outcome == MOVE_DONE && strstr(reply, "already") != NULL){
+			render_status("%s", reply);
 		}
-	
+		return true;
+
+	//sends several moves at once
+	} else if(selection == 'B'){
+		return run_batch(sock);
+
 	//quits game if selected	
-	} else if(strstr(&selection, "Q")!=NULL){
+	} else if(selection == 'Q'){
 		puts("12");
 		send(sock, &selection, sizeof(char), 0);
 		puts("13");
@@ -412,6 +1493,51 @@ bool run_minesweeper_step(int sock){
 	return true;
 }
 
+//send a reveal or flag and receive the server's reply to it. the mines
+//follow the reply when a mine has been hit.
+int send_move(int sock, char selection, char coordinates[2000], char reply[2000], int mines[NUM_TILES_X][NUM_TILES_Y]){
+	//send minesweeper menu selection
+	if (send(sock, &selection, sizeof(char), 0) < 0){
+		puts("send failed");
+	}
+
+	//receive confirmation of send
+	int read_size = recv_from_server(sock, reply, 2000 - 1);
+	if (connection_lost){
+		return MOVE_LOST;
+	}
+	reply[read_size] = '\0';
+	if (strstr(reply, "limit") != NULL){
+		return MOVE_LIMITED;
+	}
+
+	//send coordinates
+	char padded[2000] = {0};
+	strncpy(padded, coordinates, sizeof(padded) - 1);
+	if (send(sock, padded, sizeof(char)*2000, 0) < 0){
+		puts("send failed");
+	}
+
+	read_size = recv_from_server(sock, reply, 2000 - 1);
+	if (connection_lost){
+		return MOVE_LOST;
+	}
+	reply[read_size] = '\0';
+	if (selection == 'R' && strstr(reply, "over") != NULL){
+		//the mines may have come in the same read, after the message's NUL
+		int message_size = strlen(reply) + 1;
+		int mines_size = sizeof(int)*NUM_TILES_Y*NUM_TILES_X;
+		int received = read_size > message_size ? read_size - message_size : 0;
+		received = received < mines_size ? received : mines_size;
+		memcpy(mines, &reply[message_size], received);
+		if (received < mines_size){
+			recv(sock, (char*)mines + received, mines_size - received, MSG_WAITALL);
+		}
+		return MOVE_HIT_MINE;
+	}
+	return MOVE_DONE;
+}
+
 //check if coordinates are valid
 bool check_coordinates(char coordinates[2000]){
 	int length = strlen(coordinates);
@@ -434,3 +1560,251 @@ bool check_coordinates(char coordinates[2000]){
 		return true;
 	}
 }
+
+//print how an action in a script went, as a tab separated line
+void report_step(FILE *out, int step, const char *action, const char *argument, const char *result, struct timespec *begin){
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	long usec = (end.tv_sec - begin->tv_sec) * 1000000L + (end.tv_nsec - begin->tv_nsec) / 1000;
+	fprintf(out, "%d\t%s\t%s\t%s\t%ld\n", step, action, argument, result, usec);
+	fflush(out);
+}
+
+//pick a random tile the local board shows is still hidden, as coordinates such as B3
+bool random_hidden_tile(char coordinates[2000]){
+	int hidden[NUM_TILES_X * NUM_TILES_Y], num_hidden = 0;
+	for (int x = 0; x < NUM_TILES_X; x++){
+		for (int y = 0; y < NUM_TILES_Y; y++){
+			if (board_model.tiles[x][y] == -1 && !board_model.flagged_tiles[x][y]){
+				hidden[num_hidden++] = x * NUM_TILES_Y + y;
+			}
+		}
+	}
+	if (num_hidden == 0){
+		return false;
+	}
+	int tile = hidden[rand() % num_hidden];
+	snprintf(coordinates, 2000, "%c%d", 'A' + tile % NUM_TILES_Y, tile / NUM_TILES_Y);
+	return true;
+}
+
+//finish a move in a script the way run_minesweeper does, then take the next
+//board frame if the game goes on. returns the result to report.
+const char *finish_script_move(int sock, const char *result, bool *in_game){
+	char ready[2000] = "ready";
+	bool won_game = false;
+	send(sock, ready, strlen(ready), 0);
+	if (recv_from_server(sock, &won_game, sizeof(bool)) <= 0){
+		*in_game = false;
+		return "lost";
+	}
+	if (won_game){
+		uint64_t time_taken;
+		recv(sock, &time_taken, sizeof(uint64_t), MSG_WAITALL);
+		*in_game = false;
+		return "won";
+	} else if (!*in_game){
+		return result;
+	}
+	uint8_t frame[MAX_FRAME_SIZE];
+	int frame_size = recv_frame(sock, frame);
+	if (!frame_size || !apply_frame(&board_model, frame, frame_size)){
+		connection_lost = true;
+		*in_game = false;
+		return "lost";
+	}
+	return result;
+}
+
+//run a script of actions in place of the prompts, one per line:
+//  login USERNAME PASSWORD, play, reveal TILE, flag TILE, batch MOVE..., quit,
+//  leaderboard, query QUERY (as typed for menu option 6), exit
+//a TILE of ? picks a random hidden one. blank lines and lines starting with #
+//are skipped. each action is reported as it finishes with its step number,
+//argument, result and the microseconds it took on out, ready for a benchmark to read.
+int run_script(int sock, FILE *script, FILE *out){
+	char line[8192];
+	int step = 0, line_number = 0;
+	bool in_game = false;
+	struct timespec script_begin, begin;
+	clock_gettime(CLOCK_MONOTONIC, &script_begin);
+	srand(time(NULL) ^ getpid());
+
+	fprintf(out, "#step\taction\targument\tresult\tusec\n");
+	while (fgets(line, sizeof(line), script) != NULL){
+		line_number++;
+		char action[32] = "", argument[2000] = "";
+		char *rest = line;
+		int consumed = 0;
+		if (sscanf(line, "%31s%n", action, &consumed) != 1 || action[0] == '#'){
+			continue;
+		}
+		rest += consumed;
+		rest += strspn(rest, " \t");
+		rest[strcspn(rest, "\r\n")] = '\0';
+		snprintf(argument, sizeof(argument), "%s", rest[0] ? rest : "-");
+		step++;
+		clock_gettime(CLOCK_MONOTONIC, &begin);
+
+		bool game_action = strcmp(action, "reveal") == 0 || strcmp(action, "flag") == 0
+			|| strcmp(action, "batch") == 0 || strcmp(action, "quit") == 0;
+		if (game_action != in_game && strcmp(action, "login") != 0){
+			fprintf(stderr, "script line %d: %s %s\n", line_number, action, in_game ? "can't be used during a game" : "needs a game to be started with play");
+			return 1;
+		}
+
+		if (strcmp(action, "login") == 0){
+			char username[1000], password[1000];
+			if (sscanf(rest, "%999s %999s", username, password) != 2){
+				fprintf(stderr, "script line %d: login needs a username and password\n", line_number);
+				return 1;
+			}
+			int result = send_username(sock, username);
+			if (result == LOGIN_OK){
+				result = send_password(sock, password);
+			}
+			snprintf(argument, sizeof(argument), "%s", username);
+			report_step(out, step, action, argument, result == LOGIN_OK ? "ok" : result == LOGIN_BUSY ? "busy" : result == LOGIN_LOST ? "lost" : "failed", &begin);
+			if (result != LOGIN_OK){
+				return 1;
+			}
+
+		} else if (strcmp(action, "play") == 0){
+			int menu_selection = 1;
+			send(sock, &menu_selection, sizeof(int), 0);
+			uint8_t frame[MAX_FRAME_SIZE];
+			int frame_size = 0;
+			if (recv(sock, session_token, sizeof(session_token), MSG_WAITALL) != sizeof(session_token)
+				|| !(frame_size = recv_frame(sock, frame)) || !apply_frame(&board_model, frame, frame_size)){
+				report_step(out, step, action, argument, "lost", &begin);
+				return 1;
+			}
+			in_game = true;
+			report_step(out, step, action, argument, "ok", &begin);
+
+		} else if (strcmp(action, "reveal") == 0 || strcmp(action, "flag") == 0){
+			char selection = action[0] == 'r' ? 'R' : 'P';
+			char coordinates[2000];
+			if (strcmp(argument, "?") == 0){
+				if (!random_hidden_tile(coordinates)){
+					report_step(out, step, action, argument, "no-hidden-tile", &begin);
+					continue;
+				}
+			} else{
+				snprintf(coordinates, sizeof(coordinates), "%s", argument);
+			}
+			const char *result;
+			if (!check_coordinates(coordinates)){
+				result = "local-invalid";
+			} else if ((result = check_move_locally(selection, coordinates)) != NULL){
+				result = strstr(result, "already") ? "local-already-revealed" : "local-not-mine";
+			} else{
+				char reply[2000];
+				int mines[NUM_TILES_X][NUM_TILES_Y];
+				int outcome = send_move(sock, selection, coordinates, reply, mines);
+				if (outcome == MOVE_LOST){
+					report_step(out, step, action, coordinates, "lost", &begin);
+					return 1;
+				} else if (outcome == MOVE_HIT_MINE){
+					in_game = false;
+					result = "mine";
+				} else if (outcome == MOVE_LIMITED){
+					result = "limited";
+				} else if (strstr(reply, "already") != NULL){
+					result = "already-revealed";
+				} else if (strstr(reply, "not a mine") != NULL){
+					result = "not-mine";
+				} else if (strstr(reply, "not on the board") != NULL){
+					result = "off-board";
+				} else{
+					result = "ok";
+				}
+				result = finish_script_move(sock, result, &in_game);
+			}
+			report_step(out, step, action, coordinates, result, &begin);
+
+		} else if (strcmp(action, "batch") == 0){
+			static BatchAction actions[MAX_BATCH_ACTIONS];
+			int num_actions = 0;
+			for (char *move = strtok(rest, " \t"); move != NULL && num_actions < MAX_BATCH_ACTIONS; move = strtok(NULL, " \t")){
+				if (!parse_batch_action(move, &actions[num_actions])){
+					fprintf(stderr, "script line %d: %s is not a move such as RA1\n", line_number, move);
+					return 1;
+				}
+				num_actions++;
+			}
+			BatchResult result;
+			int tiles_changed, mines[NUM_TILES_X][NUM_TILES_Y];
+			char summary[100];
+			if (!send_batch(sock, actions, num_actions, &result, &tiles_changed, mines)){
+				if (connection_lost){
+					report_step(out, step, action, argument, "lost", &begin);
+					return 1;
+				}
+				snprintf(summary, sizeof(summary), "limited");
+			} else{
+				in_game = result.outcome == BATCH_CONTINUE;
+				snprintf(summary, sizeof(summary), "%s:applied=%d,rejected=%d,changed=%d",
+					result.outcome == BATCH_HIT_MINE ? "mine" : result.outcome == BATCH_WON ? "won" : "ok",
+					result.num_applied, result.num_rejected, tiles_changed);
+			}
+			const char *finished = finish_script_move(sock, summary, &in_game);
+			report_step(out, step, action, argument, finished, &begin);
+
+		} else if (strcmp(action, "quit") == 0){
+			char selection = 'Q', buffer[2000];
+			send(sock, &selection, sizeof(char), 0);
+			recv(sock, buffer, 2000, 0);
+			in_game = false;
+			report_step(out, step, action, argument, finish_script_move(sock, "ok", &in_game), &begin);
+
+		} else if (strcmp(action, "leaderboard") == 0){
+			int menu_selection = 2;
+			send(sock, &menu_selection, sizeof(int), 0);
+			int num_entries = receive_leaderboard(sock, false);
+			char summary[100];
+			snprintf(summary, sizeof(summary), num_entries < 0 ? "limited" : "entries=%d", num_entries);
+			report_step(out, step, action, argument, summary, &begin);
+
+		} else if (strcmp(action, "query") == 0){
+			LeaderboardQuery query;
+			LeaderboardReply reply;
+			static LeaderboardRow rows[LEADERBOARD_PAGE_MAX];
+			if (!parse_leaderboard_query(rest, &query)){
+				fprintf(stderr, "script line %d: %s is not a query such as top 10, page 21 10 or mine\n", line_number, argument);
+				return 1;
+			}
+			int menu_selection = 6;
+			send(sock, &menu_selection, sizeof(int), 0);
+			if (!send_leaderboard_query(sock, &query, &reply, rows)){
+				report_step(out, step, action, argument, "lost", &begin);
+				return 1;
+			}
+			char summary[100];
+			if (reply.total < 0){
+				snprintf(summary, sizeof(summary), "limited");
+			} else if (reply.num_rows == 0){
+				snprintf(summary, sizeof(summary), "total=%d,rows=0", reply.total);
+			} else{
+				snprintf(summary, sizeof(summary), "total=%d,rows=%d,rank=%d", reply.total, reply.num_rows, rows[0].rank);
+			}
+			report_step(out, step, action, argument, summary, &begin);
+
+		} else if (strcmp(action, "exit") == 0){
+			int menu_selection = 3;
+			send(sock, &menu_selection, sizeof(int), 0);
+			report_step(out, step, action, argument, "ok", &begin);
+			break;
+
+		} else{
+			fprintf(stderr, "script line %d: unknown action %s\n", line_number, action);
+			return 1;
+		}
+	}
+
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	fprintf(out, "#%d actions in %.6f seconds\n", step,
+		(end.tv_sec - script_begin.tv_sec) + (end.tv_nsec - script_begin.tv_nsec) / 1e9);
+	return 0;
+}
@@ -3,12 +3,30 @@
 #include <string.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
+#include <netinet/tcp.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <time.h>
 #include <pthread.h>
 #include <signal.h>
+#include <stdatomic.h>
+#include <sys/random.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <linux/errqueue.h>
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <ucontext.h>
 
 //declare constant global variables
 #define RANDOM_NUMBER_SEED 42
@@ -16,50 +34,558 @@
 #define NUM_TILES_Y 9
 #define NUM_MINES 10
 
-/* number of threads used to service requests */
+/* number of threads used to service requests. password hashing runs on */
+/* these threads, so this also bounds how many logins are hashed at once. */
 #define NUM_HANDLER_THREADS 10
 
+/* per-user game counters are split into shards so concurrent games don't */
+/* contend on them. each shard is padded out to whole cache lines.        */
+#define NUM_STATS_SHARDS 16
+#define CACHE_LINE_SIZE 64
+
+/* default address and listen backlog of the server socket */
+#define DEFAULT_BIND_ADDRESS "127.0.0.1"
+#define DEFAULT_LISTEN_BACKLOG 128
+/* most listeners opened in SO_REUSEPORT mode */
+#define MAX_LISTENERS 64
+/* how long a listener waits before accepting again after accept fails, */
+/* e.g. for want of file descriptors during a burst of connections      */
+#define ACCEPT_BACKOFF_MS 100
+
+/* default number of clients served at once, and of accepted clients */
+/* allowed to wait for a free handler before new ones are turned away */
+#define DEFAULT_MAX_SESSIONS 256
+#define DEFAULT_MAX_PENDING 64
+/* token bucket rates (per second) and burst sizes for each client */
+#define MOVE_RATE 10.0
+#define MOVE_BURST 20.0
+#define LEADERBOARD_RATE 1.0
+#define LEADERBOARD_BURST 5.0
+
+/* default seconds a client may sit idle at login, at the menu and mid-game */
+/* before it is disconnected (0 never times out)                           */
+#define DEFAULT_LOGIN_TIMEOUT 30
+#define DEFAULT_MENU_TIMEOUT 300
+#define DEFAULT_GAME_TIMEOUT 600
+/* idle timeouts are kept in a hierarchical timing wheel with this tick, */
+/* TIMER_WHEEL_LEVELS levels of 2^TIMER_WHEEL_BITS slots each            */
+#define TIMER_TICK_MS 100
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 4
+
+/* file the leaderboard, user statistics and suspended games are saved to */
+/* on shutdown and loaded from on startup                                 */
+#define DEFAULT_STATE_FILE "server_state.bin"
+#define STATE_MAGIC_0 'M'
+#define STATE_MAGIC_1 'S'
+#define STATE_VERSION 1
+/* most actions a client can send in one batch move */
+#define MAX_BATCH_ACTIONS 4096
+/* how a batch move ended */
+#define BATCH_CONTINUE 0
+#define BATCH_HIT_MINE 1
+#define BATCH_WON 2
+
+/* most waiting clients handed to a new server on a hot restart */
+#define MAX_HANDOVER_PENDING 128
+
+//sends of at least this many bytes use MSG_ZEROCOPY in the send benchmark.
+//below it pinning pages and reaping completions costs more than the copy.
+#define ZEROCOPY_MIN_BYTES (16 * 1024)
+//size of each send in the send benchmark
+#define SEND_BENCHMARK_CHUNK (64 * 1024)
+
+//entries in each handler thread's io_uring, and the size of the registered
+//buffer sends are queued in until the next receive
+#define NET_RING_ENTRIES 32
+#define NET_RING_BUFFER (16 * 1024)
+//corner of the shared board a player sees at once, and most moves queued for a
+//player on it before it is sent its view whole instead
+#define SHARED_VIEW_SIZE 16
+#define SHARED_QUEUE_MAX 256
+//result of a move on the shared board
+#define SHARED_OK 0
+#define SHARED_ALREADY 1        //another move got to the tile first
+#define SHARED_NOT_MINE 2
+#define SHARED_HIT_MINE 3
+#define SHARED_OFF_BOARD 4
+#define SHARED_CLEARED 5        //every mine has been flagged
+#define SHARED_LIMIT 6
+//kinds of leaderboard query - the top entries are a page starting at 0
+#define LEADERBOARD_QUERY_PAGE 0
+#define LEADERBOARD_QUERY_MINE 1        //the user's best entry and its rank
+//most entries sent back for one query, and most boards kept apart
+#define LEADERBOARD_PAGE_MAX 100
+#define MAX_LEADERBOARD_BOARDS 16
+//periods a leaderboard covers - days and weeks are in UTC, weeks starting on a Monday
+#define LEADERBOARD_ALL_TIME 0
+#define LEADERBOARD_DAILY 1
+#define LEADERBOARD_WEEKLY 2
+#define NUM_LEADERBOARD_WINDOWS 3
+//side of the blocks a parallel flood reveal splits the board into, and tiles a
+//flood reveals on its own thread before handing the rest to the pool
+#define REVEAL_BLOCK_SIZE 64
+#define PARALLEL_REVEAL_MIN 4096
+
+//a client opening with MUX_HELLO multiplexes many sessions over the one
+//connection, each a stream of frames with its own id
+#define MUX_HELLO "MUX1\n"
+#define MUX_HELLO_LENGTH 5
+#define MUX_OPEN 1              //start a session on a new stream
+#define MUX_DATA 2
+#define MUX_CLOSE 3             //either side is done with a stream
+#define MUX_PING 4              //keepalive, answered with a MUX_PONG carrying the same data
+#define MUX_PONG 5
+#define MUX_MAX_STREAMS 64
+//bytes queued for a session that isn't reading before its stream is reset, so
+//it can't hold up the others, and bytes queued for the client before the
+//sessions and the client itself stop being read
+#define MUX_STREAM_BUFFER (256 * 1024)
+#define MUX_OUTPUT_BUFFER (1024 * 1024)
+//a connection heard nothing from for this long is pinged, and dropped after three times as long
+#define MUX_KEEPALIVE_MS 15000
+
+//stack of each session fiber, and events a fiber worker takes from epoll at once
+#define FIBER_STACK_SIZE (64 * 1024)
+#define FIBER_EVENTS 64
+//moves each session makes in the io_uring benchmark
+#define NET_BENCHMARK_MOVES 20000
+
+/* number of ready-made boards kept per board pool (must be a power of two) */
+#define BOARD_POOL_SIZE 64
+/* wake the board generator once a pool drops below this many boards */
+#define BOARD_POOL_LOW_WATER 16
+/* number of threads generating and solving no-guess boards */
+#define NUM_NO_GUESS_GENERATOR_THREADS 4
+
+/* maximum number of suspended games kept for clients to resume */
+#define SESSION_CACHE_SIZE 1024
+/* number of hash buckets in the suspended game cache */
+#define SESSION_CACHE_BUCKETS 2048
+/* length of a resume token in bytes, and as sent to the client in hex */
+#define SESSION_TOKEN_BYTES 16
+#define SESSION_TOKEN_LENGTH (SESSION_TOKEN_BYTES * 2)
+/* largest serialized game kept in the session cache */
+#define SESSION_BLOB_MAX 64
+
+/* passwords in Authentication.txt are stored as                        */
+/* $pbkdf2-sha256$<iterations>$<salt hex>$<hash hex>, made with -H      */
+#define PASSWORD_HASH_PREFIX "$pbkdf2-sha256$"
+#define PASSWORD_HASH_ITERATIONS 100000
+#define PASSWORD_SALT_BYTES 16
+#define SHA256_BYTES 32
+/* seconds a login token stays valid, and its length as sent in hex:    */
+/* user (4 bytes), expiry (8 bytes) and an HMAC-SHA256 over both        */
+#define LOGIN_TOKEN_LIFETIME (24 * 60 * 60)
+#define LOGIN_TOKEN_BYTES (4 + 8 + SHA256_BYTES)
+#define LOGIN_TOKEN_LENGTH (LOGIN_TOKEN_BYTES * 2)
+
+/* frames a spectator can fall behind by before it is dropped to a keyframe */
+#define SPECTATOR_QUEUE_MAX 32
+/* most live games listed to a client choosing a game to spectate */
+#define MAX_LISTED_GAMES 50
+
+/* file every finished game is appended to for replaying */
+#define DEFAULT_REPLAY_LOG "replays.bin"
+/* replay record header and move types */
+#define REPLAY_MAGIC_0 'M'
+#define REPLAY_MAGIC_1 'R'
+#define REPLAY_VERSION 1
+#define REPLAY_FLAG_START_TILE 1
+#define REPLAY_FLAG_RESUMED 2
+#define MOVE_REVEAL 0
+#define MOVE_FLAG 1
+#define MOVE_QUIT 2             /* the player gave up, losing the game */
+
+/* board frame types, sent to spectators and to the player each move */
+#define FRAME_KEYFRAME 1
+#define FRAME_DELTA 2
+#define FRAME_END 3
+
+/* tile codes used in board frames - 0 to 8 are revealed tiles */
+#define TILE_CODE_HIDDEN 9
+#define TILE_CODE_FLAG 10
+#define TILE_CODE_MINE 11
+
 /* global mutex for our program. assignment initializes it. */
 pthread_mutex_t req_mutex = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
 
 /* global condition variable for our program. assignment initializes it. */
 pthread_cond_t  got_request   = PTHREAD_COND_INITIALIZER;
-static pthread_mutex_t mutex;
 static pthread_mutex_t lb_mutex;
 
 int num_requests = 0;
 
-//set up structure for a tile on the playing field
-typedef struct{
-    int adjacent_mines;
-    bool revealed;
-    bool is_mine;
-    bool is_flagged;
-} Tile;
-
+//number of tiles on the playing field and the size of the packed tile arrays
+#define NUM_TILES (NUM_TILES_X * NUM_TILES_Y)
+#define TILE_INDEX(x, y) ((x) * NUM_TILES_Y + (y))
+#define TILE_BITSET_BYTES ((NUM_TILES + 7) / 8)
+#define TILE_NIBBLE_BYTES ((NUM_TILES + 1) / 2)
 
 //set up structure for the game state
+//tiles are stored as packed arrays indexed by TILE_INDEX - a nibble per tile
+//for the number of adjacent mines and a bit per tile for mines, revealed
+//tiles and flags
 typedef struct {
     int num_fields_revealed;
     int num_flags;
     int num_mines_remaining;
     bool hit_mine;
-    int flag_positions[NUM_MINES][2];
-    Tile tiles[NUM_TILES_X][NUM_TILES_Y];
+    unsigned int seed;      //seed the mines were placed from, for replays
+    int start_tile;         //tile revealed before play starts, -1 if none
+    uint8_t adjacent_mines[TILE_NIBBLE_BYTES];
+    uint8_t mines[TILE_BITSET_BYTES];
+    uint8_t revealed[TILE_BITSET_BYTES];
+    uint8_t flagged[TILE_BITSET_BYTES];
 } GameState;
 
+//read and write a single tile in one of the packed bitsets
+static inline bool tile_bit(const uint8_t *bits, int index){
+    return (bits[index >> 3] >> (index & 7)) & 1;
+}
+
+static inline void set_tile_bit(uint8_t *bits, int index){
+    bits[index >> 3] |= (uint8_t)(1 << (index & 7));
+}
+
+//read and increment the adjacent mine count of a tile in the nibble array
+static inline int tile_adjacent_mines(const uint8_t *nibbles, int index){
+    return (nibbles[index >> 1] >> ((index & 1) * 4)) & 0xF;
+}
+
+static inline void increment_adjacent_mines(uint8_t *nibbles, int index){
+    nibbles[index >> 1] += (uint8_t)(1 << ((index & 1) * 4));
+}
+
 
-//set up structure for a user
+//set up structure for a user. games won and played are kept in the
+//sharded user statistics below.
 typedef struct{
 	char name[200];
-	int num_games_won;
-	int num_games_played;
 } User;
 
+User *users;
+int num_users = 0;
+
+//a user's game counters within one statistics shard
+typedef struct{
+	atomic_int num_games_won;
+	atomic_int num_games_played;
+} UserStats;
+
+//each thread updates the counters in its own shard, and reads add up every shard
+UserStats *user_stats_shards[NUM_STATS_SHARDS];
+atomic_int next_stats_shard = 0;
+__thread int stats_shard = -1;
+
+//allocate zeroed counters for every user in every shard
+void user_stats_init(int num_users){
+	size_t shard_size = num_users * sizeof(UserStats);
+	shard_size = (shard_size + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+	if (shard_size == 0){
+		shard_size = CACHE_LINE_SIZE;
+	}
+	for (int i = 0; i < NUM_STATS_SHARDS; i++){
+		user_stats_shards[i] = (UserStats*)aligned_alloc(CACHE_LINE_SIZE, shard_size);
+		if (!user_stats_shards[i]){
+			fprintf(stderr, "user_stats_init: out of memory\n");
+			exit(1);
+		}
+		memset(user_stats_shards[i], 0, shard_size);
+	}
+}
+
+//the calling thread's shard, assigned round robin on first use
+UserStats *thread_stats_shard(void){
+	if (stats_shard < 0){
+		stats_shard = atomic_fetch_add_explicit(&next_stats_shard, 1, memory_order_relaxed) % NUM_STATS_SHARDS;
+	}
+	return user_stats_shards[stats_shard];
+}
+
+//bumped whenever the leaderboard or a count it shows changes, so a cached
+//snapshot of it knows when to be rebuilt
+atomic_ulong leaderboard_generation = 1;
+
+void count_game_played(int user){
+	atomic_fetch_add_explicit(&thread_stats_shard()[user].num_games_played, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&leaderboard_generation, 1, memory_order_release);
+}
+
+void count_game_won(int user){
+	atomic_fetch_add_explicit(&thread_stats_shard()[user].num_games_won, 1, memory_order_relaxed);
+}
+
+//total games won and played by a user across all shards
+int user_games_won(const User *user){
+	int num_games_won = 0;
+	for (int i = 0; i < NUM_STATS_SHARDS; i++){
+		num_games_won += atomic_load_explicit(&user_stats_shards[i][user - users].num_games_won, memory_order_relaxed);
+	}
+	return num_games_won;
+}
+
+int user_games_played(const User *user){
+	int num_games_played = 0;
+	for (int i = 0; i < NUM_STATS_SHARDS; i++){
+		num_games_played += atomic_load_explicit(&user_stats_shards[i][user - users].num_games_played, memory_order_relaxed);
+	}
+	return num_games_played;
+}
+
+//outcome of a game of minesweeper
+typedef enum {
+	GAME_LOST,
+	GAME_WON,
+	GAME_SUSPENDED
+} GameResult;
+
+//an encoded spectator frame. one copy is shared by every spectator it is
+//queued for and freed when the last of them has sent it.
+typedef struct {
+	atomic_int refcount;
+	int size;
+	uint8_t data[];
+} SharedFrame;
+
+//a client watching a live game, with its queue of frames still to send
+typedef struct spectator {
+	pthread_cond_t frame_ready;
+	int wake_fd;            //written in place of signalling frame_ready when the spectator is a fiber
+	SharedFrame *queue[SPECTATOR_QUEUE_MAX];
+	int queue_head;
+	int queue_count;
+	bool needs_keyframe;    //fell behind - send a keyframe in place of the next delta
+	bool finished;          //the game has ended
+	struct spectator *next;
+} Spectator;
+
+//a game in progress that can be spectated. spectator queues are
+//protected by the game's mutex.
+typedef struct live_game {
+	int id;
+	char player[200];
+	pthread_mutex_t mutex;
+	atomic_int refcount;    //the registry and each spectator hold a reference
+	GameState game;         //latest state, for keyframes
+	Spectator *spectators;
+	struct live_game *next;
+} LiveGame;
+
+//a move recorded for replaying a game
+typedef struct {
+	uint8_t type;
+	uint8_t x;
+	uint8_t y;
+	uint32_t time_delta;    //milliseconds since the previous move
+} ReplayMove;
+
+//an action in a batch move, as sent by the client
+typedef struct {
+	char type;              //'R' to reveal a tile or 'P' to place a flag
+	uint8_t x;
+	uint8_t y;
+} BatchAction;
+
+//a tile that changed on the shared board
+typedef struct __attribute__((packed)) {
+	uint32_t index;         //y * width + x
+	uint8_t code;
+} SharedTileChange;
+
+//sent when a player joins the shared board. width is 0 if there isn't one.
+typedef struct {
+	int width;
+	int height;
+	int num_mines;
+} SharedBoardInfo;
+
+//a player's command on the shared board, with the corner of its view
+typedef struct {
+	char type;              //'R' reveal, 'P' flag, 'V' only fetch changes, 'Q' leave
+	int x;
+	int y;
+	int view_x;
+	int view_y;
+} SharedCommand;
+
+//reply to a shared board command. num_changes SharedTileChanges follow it,
+//then the view's tile codes if has_view is set.
+typedef struct {
+	int result;
+	int mines_remaining;
+	int num_players;
+	int tiles_revealed;     //by this player
+	int mines_flagged;      //by this player
+	int num_changes;
+	int has_view;
+} SharedMoveReply;
+
+//a query on the leaderboard. a width of 0 matches entries on any board.
+typedef struct {
+	int type;               //LEADERBOARD_QUERY_PAGE or LEADERBOARD_QUERY_MINE
+	int offset;             //rank to start a page from, 0 being the best
+	int limit;
+	int width;
+	int height;
+	int num_mines;
+	int window;             //LEADERBOARD_ALL_TIME, LEADERBOARD_DAILY or LEADERBOARD_WEEKLY
+} LeaderboardQuery;
+
+//reply to a leaderboard query, followed by num_rows LeaderboardRows
+typedef struct {
+	int total;              //entries matching the query's board, -1 if rate limited
+	int num_rows;
+} LeaderboardReply;
+
+//an entry sent in reply to a leaderboard query
+typedef struct {
+	int rank;               //1 is the best
+	char name[200];
+	uint64_t time_taken;    //nanoseconds
+	int games_won;
+	int games_played;
+	int width;
+	int height;
+	int num_mines;
+} LeaderboardRow;
+
+//header of each frame on a multiplexed connection, followed by length bytes
+typedef struct __attribute__((packed)) {
+	uint32_t stream;        //chosen by the client when it opens the stream, 0 for keepalives
+	uint8_t type;           //MUX_OPEN, MUX_DATA, MUX_CLOSE, MUX_PING or MUX_PONG
+	uint16_t length;
+} MuxHeader;
+
+//combined result of a batch move, sent back ahead of the board delta
+typedef struct {
+	int num_applied;        //actions applied before the batch ended
+	int num_rejected;       //applied actions that were not valid moves
+	int outcome;            //BATCH_CONTINUE, BATCH_HIT_MINE or BATCH_WON
+} BatchResult;
+
+//moves made so far in a game, and the board they were made on
+typedef struct {
+	GameState initial_game;
+	bool resumed;           //the game was resumed part way through
+	ReplayMove *moves;
+	int num_moves;
+	int capacity;
+	uint64_t last_move_time;
+} MoveLog;
+
+//set up structure for a game that can be resumed on a new connection
+typedef struct {
+	uint8_t token[SESSION_TOKEN_BYTES];
+	int user;
+	uint64_t time_elapsed;  //nanoseconds played before this connection
+	GameState game;
+	LiveGame *live_game;
+	MoveLog move_log;
+} GameSession;
+
+//a finished game's replay record waiting to be written to the replay log
+struct replay_record {
+	uint8_t *data;
+	int size;
+	struct replay_record *next;
+};
+
+//entry in the list of live games sent to a client choosing a game to spectate
+typedef struct {
+	int id;
+	char player[200];
+} LiveGameInfo;
+
+//a suspended game in the session cache, kept as a serialized blob
+typedef struct suspended_session {
+	uint8_t token[SESSION_TOKEN_BYTES];
+	uint8_t blob[SESSION_BLOB_MAX];
+	int blob_size;
+	struct suspended_session *lru_prev;   //more recently suspended
+	struct suspended_session *lru_next;   //less recently suspended
+	struct suspended_session *hash_next;  //next session in the same bucket
+} SuspendedSession;
+
+//server statistics, printed on SIGUSR1
+typedef struct {
+	atomic_long sessions_suspended;
+	atomic_long sessions_resumed;
+	atomic_long sessions_evicted;
+	atomic_long idle_sessions;
+	atomic_long idle_session_bytes;
+	atomic_long frames_encoded;
+	atomic_long frames_sent;
+	atomic_long spectators_dropped_to_keyframe;
+	atomic_long moves_timed;
+	atomic_long move_server_ns;     //time spent handling moves
+	atomic_long move_network_ns;    //time spent waiting on the client and network
+	atomic_long max_move_server_ns;
+	atomic_long sessions_queued;            //admitted to wait for a free handler
+	atomic_long sessions_rejected;          //turned away with the pending queue full
+	atomic_long moves_rate_limited;
+	atomic_long leaderboards_rate_limited;
+	atomic_long sessions_timed_out;
+	atomic_long batches;
+	atomic_long batch_actions;      //actions applied in batches
+	atomic_long leaderboard_snapshots;      //times the leaderboard was serialized
+	atomic_long fiber_stacks;               //session fiber stacks allocated
+	atomic_long shared_moves;               //moves made on the shared board
+	atomic_long mux_connections;            //connections multiplexing sessions
+	atomic_long mux_streams;                //sessions started on them
+} ServerStats;
+
+ServerStats stats;
+
+//seconds a client may sit idle at login, at the menu and mid-game
+int login_timeout = DEFAULT_LOGIN_TIMEOUT;
+int menu_timeout = DEFAULT_MENU_TIMEOUT;
+int game_timeout = DEFAULT_GAME_TIMEOUT;
+
+//key login tokens are signed with, made fresh each time the server starts
+//unless it is handed over by the server this one is taking over from
+uint8_t login_token_secret[SHA256_BYTES];
+
+//listening sockets and the threads accepting on them
+int server_sockets[MAX_LISTENERS];
+int num_listeners = 1;
+pthread_t listener_threads[MAX_LISTENERS];
+//written to once to stop every accept loop
+int stop_accepting_pipe[2];
+//batch each handler's socket operations through its own io_uring
+bool use_io_uring = false;
+//run sessions as fibers on this many worker threads - 0 runs each on its own thread
+int num_fiber_workers = 0;
+//size of the shared board - a width of 0 means there isn't one
+int shared_board_width = 0;
+int shared_board_height = 0;
+int shared_board_mines = 0;
+//threads spreading large flood reveals on the shared board - 0 floods on the session's thread
+int num_reveal_threads = 0;
+//syscalls made by the net_ functions on this thread, for the benchmark
+__thread long net_syscalls = 0;
+
+//links of a leaderboard entry in one of the order statistic trees indexing it
+typedef struct {
+	struct leaderboard *left;
+	struct leaderboard *right;
+	struct leaderboard *parent;
+	int size;               //entries in the subtree under and including this one
+} LeaderboardLinks;
+
 //set up linked list structure for a leaderboard entry
 struct leaderboard{
 	User *user;
-	time_t time_taken;
+	uint64_t time_taken;    //nanoseconds
+	int games_won;          //by the user when the entry was made, to break ties
+	time_t won_at;          //0 if not known, for entries from before it was kept
+	int width;              //board the game was won on
+	int height;
+	int num_mines;
+	unsigned int priority;  //heap order of the entry in the trees
+	//in each window of the leaderboard of every board, then of its own board's
+	LeaderboardLinks links[2 * NUM_LEADERBOARD_WINDOWS];
 	struct leaderboard *next;
 };
 
@@ -67,9 +593,58 @@ int num_leaderboard_entries = 0;
 
 typedef struct leaderboard entry;
 
+/* a leaderboard in rank order, as a treap whose nodes count their subtree */
+/* so an entry's rank, or the entry at a rank, is found in O(log n)        */
+typedef struct {
+    int slot;                   /* which links of an entry this index uses  */
+    int window;                 /* LEADERBOARD_ALL_TIME, _DAILY or _WEEKLY  */
+    long period;                /* day or week it holds the entries of      */
+    entry *root;
+    entry **best;               /* each user's best entry, by user index -  */
+                                /* stale if won in an earlier period        */
+} LeaderboardIndex;
+
+/* the leaderboards of one board, or of every board for a width of 0. a day  */
+/* or week's index is emptied when the next starts, which drops the old      */
+/* entries in O(1) - they stay in the all-time index and the list.           */
+typedef struct {
+    int width;
+    int height;
+    int num_mines;
+    LeaderboardIndex windows[NUM_LEADERBOARD_WINDOWS];
+} LeaderboardBoard;
+
+LeaderboardBoard leaderboard_boards[MAX_LEADERBOARD_BOARDS + 1];    /* guarded by lb_mutex */
+int num_leaderboard_boards = 0;
+
+/* the leaderboard as sent to clients, one line per entry, kept in a memory  */
+/* backed file so lines go out with sendfile instead of being formatted and  */
+/* copied for every request. readers hold a reference, so a rebuild never    */
+/* closes the file under a send in progress.                                 */
+typedef struct {
+    atomic_int refcount;
+    unsigned long generation;   /* leaderboard_generation it was built from */
+    int fd;
+    int num_lines;
+    off_t *offsets;             /* start of each line, then the file size   */
+} LeaderboardSnapshot;
+
+LeaderboardSnapshot *leaderboard_snapshot = NULL;   /* guarded by lb_mutex */
+
+/* kinds of request handled by the request-handling threads */
+#define REQUEST_NOTICE 0        /* log that a connection was accepted  */
+#define REQUEST_AUTHENTICATE 1  /* check a username and password       */
+
 /* format of a single request. */
 struct request {
     int number;             /* number of the request                  */
+    int type;               /* REQUEST_NOTICE or REQUEST_AUTHENTICATE */
+    const char* username;   /* credentials to check, for REQUEST_AUTHENTICATE */
+    const char* password;
+    int result;             /* index of the authenticated user or -1  */
+    bool done;              /* set once an authenticate request is handled */
+    pthread_cond_t done_cond; /* signalled when done is set           */
+    int wake_fd;            /* written in place of done_cond for a fiber */
     struct request* next;   /* pointer to next request, NULL if none. */
 };
 struct request* req = NULL;     /* head of linked list of requests. */
@@ -78,50 +653,230 @@ struct request* last_req = NULL; /* pointer to last request.         */
 entry *head = NULL; //leaderboard head entry
 entry *tail = NULL; //leaderboard tail entry
 
-//create function to insert leaderboard entry into linked list at correct position
-void insert_entry(entry *new) {
-	entry *p;
-    //if the linked list is empty, insert the new entry as head and tail.
-    if (tail == NULL ){ /* empty list */
-        head = new;
-        tail = new;
-    } else{
-      //else find appropriate point in list to insert
-     	p = head;
-     	entry *p_previous = NULL;
-     	bool reached_spot = false;
-     	do{
-        //if the new entry has less time then current entry insert before
-     		if(new->time_taken <= p->time_taken){
-          if (new->time_taken == p->time_taken){
-            if (new->user->num_games_won > p->user->num_games_won){
-              continue;
-            }
-          }
-          //if the current is the head - insert as new head
-     			if (p_previous == NULL){
-     				new->next = head;
-     				head = new;
-     				reached_spot = true;
-     			} else{ //else add into the middle
-     				p_previous->next = new;
-     				new->next = p;
-     				reached_spot = true;
-     			}
-     		}
-        //go to next entry in list
-     		p_previous = p;
-     		if (p->next == NULL){
-     			break;
-     		} else{
-     			p = p->next;
-     		}
-     	} while(p!=NULL && !reached_spot);
-     	if (!reached_spot){
-     		tail->next = new;
-     		tail = new;
-     	}
-    }
+//an entry beats another with a lower time, or on a tie fewer games won. the
+//games won are those when each entry was made so the order never changes.
+static bool entry_beats(entry *new, entry *p){
+	return new->time_taken < p->time_taken || (new->time_taken == p->time_taken
+		&& new->games_won <= p->games_won);
+}
+
+static inline int subtree_size(entry *p, int slot){
+	return p ? p->links[slot].size : 0;
+}
+
+//rotate an entry above its parent in an index
+static void rotate_up(LeaderboardIndex *index, entry *p){
+	int slot = index->slot;
+	LeaderboardLinks *links = &p->links[slot];
+	entry *parent = links->parent;
+	LeaderboardLinks *parent_links = &parent->links[slot];
+	entry *grandparent = parent_links->parent;
+	if (parent_links->left == p){
+		parent_links->left = links->right;
+		if (links->right){
+			links->right->links[slot].parent = parent;
+		}
+		links->right = parent;
+	} else{
+		parent_links->right = links->left;
+		if (links->left){
+			links->left->links[slot].parent = parent;
+		}
+		links->left = parent;
+	}
+	parent_links->parent = p;
+	links->parent = grandparent;
+	if (grandparent == NULL){
+		index->root = p;
+	} else if (grandparent->links[slot].left == parent){
+		grandparent->links[slot].left = p;
+	} else{
+		grandparent->links[slot].right = p;
+	}
+	parent_links->size = subtree_size(parent_links->left, slot) + subtree_size(parent_links->right, slot) + 1;
+	links->size = subtree_size(links->left, slot) + subtree_size(links->right, slot) + 1;
+}
+
+//rank of an entry in an index, 1 being the best
+int leaderboard_rank(const LeaderboardIndex *index, entry *p){
+	int slot = index->slot;
+	int rank = subtree_size(p->links[slot].left, slot) + 1;
+	for (entry *parent = p->links[slot].parent; parent != NULL; p = parent, parent = parent->links[slot].parent){
+		if (parent->links[slot].right == p){
+			rank += subtree_size(parent->links[slot].left, slot) + 1;
+		}
+	}
+	return rank;
+}
+
+//the entry at a rank in an index counting from 0, or NULL past the end
+entry *leaderboard_select(const LeaderboardIndex *index, int rank){
+	int slot = index->slot;
+	entry *p = index->root;
+	while (p != NULL){
+		int left = subtree_size(p->links[slot].left, slot);
+		if (rank < left){
+			p = p->links[slot].left;
+		} else if (rank == left){
+			return p;
+		} else{
+			rank -= left + 1;
+			p = p->links[slot].right;
+		}
+	}
+	return NULL;
+}
+
+//the entry ranked after another in an index
+entry *leaderboard_successor(const LeaderboardIndex *index, entry *p){
+	int slot = index->slot;
+	if (p->links[slot].right != NULL){
+		p = p->links[slot].right;
+		while (p->links[slot].left != NULL){
+			p = p->links[slot].left;
+		}
+		return p;
+	}
+	entry *parent = p->links[slot].parent;
+	while (parent != NULL && parent->links[slot].right == p){
+		p = parent;
+		parent = parent->links[slot].parent;
+	}
+	return parent;
+}
+
+//the day or week a time falls in counting from the epoch, 0 for all time
+long leaderboard_period(int window, time_t time){
+	if (window == LEADERBOARD_DAILY){
+		return time / 86400;
+	} else if (window == LEADERBOARD_WEEKLY){
+		return (time / 86400 + 3) / 7;    //the epoch was a Thursday
+	}
+	return 0;
+}
+
+//a user's best entry in an index, or NULL if they have none in its period
+entry *leaderboard_best(const LeaderboardIndex *index, int user){
+	entry *best = index->best[user];
+	if (best == NULL || leaderboard_period(index->window, best->won_at) != index->period){
+		return NULL;
+	}
+	return best;
+}
+
+//add an entry to an index behind every entry it doesn't beat, or behind all
+//of them if append is set. returns the entry it now follows, NULL if it leads.
+entry *leaderboard_index_insert(LeaderboardIndex *index, entry *new, bool append){
+	int slot = index->slot;
+	LeaderboardLinks *links = &new->links[slot];
+	*links = (LeaderboardLinks){.size = 1};
+	entry *parent = NULL, *previous = NULL;
+	bool left = false;
+	for (entry *p = index->root; p != NULL; ){
+		p->links[slot].size++;
+		parent = p;
+		left = !append && entry_beats(new, p);
+		if (left){
+			p = p->links[slot].left;
+		} else{
+			previous = p;
+			p = p->links[slot].right;
+		}
+	}
+	links->parent = parent;
+	if (parent == NULL){
+		index->root = new;
+	} else if (left){
+		parent->links[slot].left = new;
+	} else{
+		parent->links[slot].right = new;
+	}
+	while (links->parent != NULL && links->parent->priority < new->priority){
+		rotate_up(index, new);
+	}
+
+	entry *best = leaderboard_best(index, new->user - users);
+	if (best == NULL || leaderboard_rank(index, new) < leaderboard_rank(index, best)){
+		index->best[new->user - users] = new;
+	}
+	return previous;
+}
+
+//one window of a board's leaderboards, moved on to the period now is in.
+//entries of the period before are dropped by forgetting the tree.
+LeaderboardIndex *leaderboard_window(LeaderboardBoard *board, int window, time_t now){
+	LeaderboardIndex *index = &board->windows[window];
+	long period = leaderboard_period(window, now);
+	if (index->period != period){
+		index->root = NULL;
+		index->period = period;
+	}
+	return index;
+}
+
+//the leaderboards of a board, 0 wide for every board. if there aren't any yet
+//they are made if create is set, otherwise or if there are too many boards
+//NULL is returned.
+LeaderboardBoard *leaderboard_board(int width, int height, int num_mines, bool create){
+	for (int i = 0; i < num_leaderboard_boards; i++){
+		LeaderboardBoard *board = &leaderboard_boards[i];
+		if (board->width == width && (width == 0 || (board->height == height && board->num_mines == num_mines))){
+			return board;
+		}
+	}
+	if (!create || num_leaderboard_boards == MAX_LEADERBOARD_BOARDS + 1 || (width != 0 && num_leaderboard_boards == 0)){
+		return NULL;
+	}
+	LeaderboardBoard *board = &leaderboard_boards[num_leaderboard_boards];
+	*board = (LeaderboardBoard){.width = width, .height = height, .num_mines = num_mines};
+	for (int window = 0; window < NUM_LEADERBOARD_WINDOWS; window++){
+		entry **best = (entry**)calloc(num_users > 0 ? num_users : 1, sizeof(entry*));
+		if (!best){
+			fprintf(stderr, "leaderboard_board: out of memory\n");
+			exit(1);
+		}
+		board->windows[window] = (LeaderboardIndex){.slot = window + (num_leaderboard_boards == 0 ? 0 : NUM_LEADERBOARD_WINDOWS),
+			.window = window, .period = -1, .best = best};
+	}
+	num_leaderboard_boards++;
+	return board;
+}
+
+//add a leaderboard entry to the list and the all-time leaderboards, and to
+//the daily and weekly ones if it was won today or this week. entries loaded in
+//order are appended. call with lb_mutex held.
+void insert_entry(entry *new, bool append) {
+	time_t now = time(NULL);
+	new->games_won = user_games_won(new->user);
+	new->priority = (unsigned int)random();
+	new->next = NULL;
+	entry *previous = NULL;
+	LeaderboardBoard *boards[2] = {leaderboard_board(0, 0, 0, true), leaderboard_board(new->width, new->height, new->num_mines, true)};
+	for (int i = 0; i < 2 && boards[i] != NULL; i++){
+		for (int window = 0; window < NUM_LEADERBOARD_WINDOWS; window++){
+			LeaderboardIndex *index = leaderboard_window(boards[i], window, now);
+			if (leaderboard_period(window, new->won_at) != index->period){
+				continue;
+			}
+			entry *p = leaderboard_index_insert(index, new, append);
+			if (i == 0 && window == LEADERBOARD_ALL_TIME){
+				previous = p;
+			}
+		}
+	}
+
+	//splice it into the list behind the entry it follows in the index of every entry
+	if (previous == NULL){
+		new->next = head;
+		head = new;
+	} else{
+		new->next = previous->next;
+		previous->next = new;
+	}
+	if (new->next == NULL){
+		tail = new;
+	}
+	atomic_fetch_add_explicit(&leaderboard_generation, 1, memory_order_release);
 }
 
 //function to print leaderboard
@@ -130,47 +885,104 @@ void print_leaderboard(entry *p){
       printf("^\n");
   	} else {
         while(p->next) {
-            printf("%s \t %ld seconds \t %d games won, %d games played\n", p->user->name, p->time_taken, p->user->num_games_won, p->user->num_games_played);
+            printf("%s \t %.3f seconds \t %d games won, %d games played\n", p->user->name, p->time_taken / 1e9, user_games_won(p->user), user_games_played(p->user));
             p = p->next ;
         }
-        printf("%s \t %ld seconds \t %d games won, %d games played\n", p->user->name, p->time_taken, p->user->num_games_won, p->user->num_games_played);
+        printf("%s \t %.3f seconds \t %d games won, %d games played\n", p->user->name, p->time_taken / 1e9, user_games_won(p->user), user_games_played(p->user));
    	}
 }
 
-User *users;
-
 //initialise functions
 int get_num_users(void);
-int setUpServer(int socket_port_int);
+int setUpServer(char *bind_address, int socket_port_int, int backlog, bool reuse_port);
+void pin_to_allowed_cpu(pthread_t thread, int n);
+bool accept_backoff(void);
 int connectToClient(int server_socket);
-int handle_login(int client_socket);
-int authenticate_user(char username[2000], char password[2000]);
+void *accept_loop(void *data);
+int handle_login(int client_socket, GameSession *resumed_session, bool *resumed);
+int authenticate_user(const char *username, const char *password);
+int authenticate_in_pool(const char *username, const char *password);
+bool verify_password(const char *password, const char *stored);
+bool hash_password(const char *password, char *stored, size_t stored_size);
+void make_login_token(int user, char token[LOGIN_TOKEN_LENGTH + 1]);
+int check_login_token(const char *token);
+void login_token_init(const uint8_t *secret);
 void run_selected_function(int menu_selection, int client_socket, int logged_in_user);
-bool run_minesweeper(int client_socket);
+GameResult run_minesweeper(int client_socket, GameSession *session);
+void play_game(int client_socket, GameSession *session);
+int serialize_session(const GameSession *session, uint8_t blob[SESSION_BLOB_MAX]);
+bool deserialize_session(const uint8_t *blob, int blob_size, GameSession *session);
+void suspend_session(const GameSession *session);
+bool resume_session(const uint8_t token[SESSION_TOKEN_BYTES], GameSession *session);
+void print_server_stats(int num);
+uint64_t monotonic_ns(void);
+void record_move_timing(uint64_t server_ns, uint64_t network_ns);
+LiveGame *start_live_game(const char *player, const GameState *game);
+void publish_move(LiveGame *live_game, const GameState *previous_game, const GameState *current_game);
+void end_live_game(LiveGame *live_game, GameResult result, const GameState *game);
+void run_spectator(int client_socket);
+void move_log_start(MoveLog *move_log, const GameState *game, bool resumed);
+void move_log_add(MoveLog *move_log, int type, int x, int y);
+void record_replay(GameSession *session, GameResult result);
+void *replay_writer_loop(void *data);
+int run_replay(const char *replay_log);
+bool parse_coordinates(char coordinates[2000], int *x, int *y);
+GameState reveal_tile_at(GameState current_game, int x, int y, char **confirmation);
+GameState place_flag_at(GameState current_game, int x, int y, char **confirmation);
 void run_leaderboard(int client_socket);
+void run_leaderboard_query(int client_socket, int logged_in_user);
+void run_shared_board(int client_socket);
+void run_send_benchmark(int megabytes);
+void start_mux_connection(int client_socket);
 bool tile_contains_mine(int x, int y, GameState current_game);
 GameState set_adjacent_mines(int x, int y, GameState current_game);
-GameState place_mines(GameState current_game);
-GameState setup_minesweeper(void);
+GameState place_mines(GameState current_game, unsigned int *seed);
+GameState setup_minesweeper(unsigned int *seed);
+GameState setup_no_guess_minesweeper(unsigned int *seed);
+void print_mines(GameState current_game);
+bool solve_board(const GameState *current_game, int start_x, int start_y);
+void run_solver_benchmark(int num_boards);
 GameState place_flag(GameState current_game, char coordinates[2000], int client_socket);
+GameState apply_batch(GameState current_game, const BatchAction *actions, int num_actions, MoveLog *move_log, BatchResult *result);
+bool run_batch(int client_socket, GameSession *session, GameState *current_game, uint64_t *network_ns);
 bool test_if_won(GameState current_game);
-GameState reveal_tile(GameState current_game, char coordinates[2000], int client_socket,  int mines[NUM_TILES_X][NUM_TILES_Y]);
+GameState reveal_tile(GameState current_game, char coordinates[2000], int client_socket);
+void encode_mines(const GameState *current_game, int mines[NUM_TILES_X][NUM_TILES_Y]);
 GameState test_tile(GameState current_game, int x, int y);
 void *connection_handler(void *);
-void sig_handler(int num);
-void terminate_client(int client_socket);
+ssize_t net_send(int client_socket, const void *buffer, size_t length, int flags);
+ssize_t net_sendv(int client_socket, const struct iovec *iov, int iovcnt);
+ssize_t net_recv(int client_socket, void *buffer, size_t length, int flags);
+bool net_flush(int client_socket);
+void net_ring_exit(void);
+void run_net_benchmark(int num_sessions);
+void run_reveal_benchmark(int size);
+void reveal_pool_start(int num_threads);
+ssize_t net_sendfile(int client_socket, int fd, off_t *offset, size_t length);
+void serve_sessions(int client_socket);
+int session_wake_fd(void);
+void session_wait(pthread_cond_t *cond, int wake_fd, pthread_mutex_t *mutex);
+void session_wake(pthread_cond_t *cond, int wake_fd);
+void fiber_workers_init(int num_workers);
+void start_session_fiber(int client_socket);
+bool recv_mux_hello(int client_socket);
+bool serve_client(int client_socket);
+void admission_init(int max_sessions, int max_pending);
+void timer_wheel_init(void);
+void *timer_wheel_loop(void *data);
+void arm_idle_timeout(int client_socket, int seconds);
+void cancel_idle_timeout(void);
+void set_nodelay(int sock);
+void admit_client(int client_socket);
+void flush_replays(void);
+void drain_server(const char *state_file, int takeover_socket);
+void *hot_restart_loop(void *data);
+bool hot_restart_takeover(const char *restart_path, int *pending_sockets, int *num_pending, uint8_t secret[SHA256_BYTES]);
+void load_server_state(const char *state_file);
 
-void add_request(int request_num, pthread_mutex_t* p_mutex, pthread_cond_t*  p_cond_var){
+void submit_request(struct request* a_req, pthread_mutex_t* p_mutex, pthread_cond_t*  p_cond_var){
     int rc;                         /* return code of pthreads functions.  */
-    struct request* a_req;      /* pointer to newly added request.     */
 
-    /* create structure with new request */
-    a_req = (struct request*)malloc(sizeof(struct request));
-    if (!a_req) { /* malloc failed?? */
-        fprintf(stderr, "add_request: out of memory\n");
-        exit(1);
-    }
-    a_req->number = request_num;
     a_req->next = NULL;
 
     /* lock the mutex, to assure exclusive access to the list */
@@ -197,6 +1009,43 @@ void add_request(int request_num, pthread_mutex_t* p_mutex, pthread_cond_t*  p_c
     rc = pthread_cond_signal(p_cond_var);
 }
 
+void add_request(int request_num, pthread_mutex_t* p_mutex, pthread_cond_t*  p_cond_var){
+    struct request* a_req;      /* pointer to newly added request.     */
+
+    /* create structure with new request */
+    a_req = (struct request*)malloc(sizeof(struct request));
+    if (!a_req) { /* malloc failed?? */
+        fprintf(stderr, "add_request: out of memory\n");
+        exit(1);
+    }
+    a_req->number = request_num;
+    a_req->type = REQUEST_NOTICE;
+    submit_request(a_req, p_mutex, p_cond_var);
+}
+
+/* check a login on the request-handling threads, so the slow password */
+/* hash never runs on a connection thread, and wait for the result.     */
+int authenticate_in_pool(const char* username, const char* password){
+    struct request a_req = {.number = 0, .type = REQUEST_AUTHENTICATE,
+                            .username = username, .password = password,
+                            .result = -1, .done = false, .wake_fd = session_wake_fd()};
+    pthread_cond_init(&a_req.done_cond, NULL);
+
+    submit_request(&a_req, &req_mutex, &got_request);
+
+    pthread_mutex_lock(&req_mutex);
+    while (!a_req.done) {
+        session_wait(&a_req.done_cond, a_req.wake_fd, &req_mutex);
+    }
+    pthread_mutex_unlock(&req_mutex);
+
+    pthread_cond_destroy(&a_req.done_cond);
+    if (a_req.wake_fd >= 0) {
+        close(a_req.wake_fd);
+    }
+    return a_req.result;
+}
+
 struct request* get_request(pthread_mutex_t* p_mutex)
 {
     int rc;                         /* return code of pthreads functions.  */
@@ -227,7 +1076,10 @@ struct request* get_request(pthread_mutex_t* p_mutex)
 
 void handle_request(struct request* a_req, int thread_id)
 {
-    if (a_req) {
+    if (a_req && a_req->type == REQUEST_AUTHENTICATE) {
+        a_req->result = authenticate_user(a_req->username, a_req->password);
+    }
+    else if (a_req) {
         printf("Thread '%d' handled request '%d'\n", thread_id, a_req->number);
         fflush(stdout);
     }
@@ -253,9 +1105,17 @@ void* handle_requests_loop(void* data)
                 /* other reqeusts waiting in the queue paralelly.          */
                 rc = pthread_mutex_unlock(&req_mutex);
                 handle_request(a_req, thread_id);
-                free(a_req);
                 /* and lock the mutex again. */
                 rc = pthread_mutex_lock(&req_mutex);
+                /* authenticate requests belong to the thread waiting on */
+                /* them, so wake it instead of freeing the request.      */
+                if (a_req->type == REQUEST_AUTHENTICATE) {
+                    a_req->done = true;
+                    session_wake(&a_req->done_cond, a_req->wake_fd);
+                }
+                else {
+                    free(a_req);
+                }
             }
         }
         else {
@@ -271,414 +1131,3566 @@ void* handle_requests_loop(void* data)
     }
 }
 
-int main(int argc , char *argv[]){
-  int        i;                                /* loop counter          */
-  int        thr_id[NUM_HANDLER_THREADS];      /* thread IDs            */
-  pthread_t  p_threads[NUM_HANDLER_THREADS];   /* thread's structures   */
+/* a slot in a board pool. the sequence number tells producers and */
+/* consumers whether the slot is free or holds a ready board.        */
+typedef struct {
+    atomic_size_t sequence;
+    GameState board;
+} BoardPoolSlot;
 
-  /* create the request-handling threads */
-  for (i=0; i<NUM_HANDLER_THREADS; i++) {
-      thr_id[i] = i;
-      pthread_create(&p_threads[i], NULL, handle_requests_loop, (void*)&thr_id[i]);
-  }
+/* bounded lock-free pool of pre-generated boards for one board configuration */
+typedef struct {
+    const char *name;                   /* configuration name, for logging  */
+    GameState (*generate)(unsigned int *seed); /* builds a new board of this kind */
+    int num_generators;                 /* background threads filling the pool */
+    bool enabled;                       /* whether games are served from it */
+    BoardPoolSlot slots[BOARD_POOL_SIZE];
+    atomic_size_t enqueue_pos;
+    atomic_size_t dequeue_pos;
+    atomic_int num_boards;              /* approximate number of ready boards */
+} BoardPool;
 
-	//pthreads_mutex_lock(&mutex);
-	srand(RANDOM_NUMBER_SEED);
-	//pthreads_mutex_unlock(&mutex);
+/* one pool per configured board size and density */
+BoardPool board_pools[] = {
+    { .name = "standard", .generate = setup_minesweeper, .num_generators = 1, .enabled = true },
+    { .name = "no-guess", .generate = setup_no_guess_minesweeper, .num_generators = NUM_NO_GUESS_GENERATOR_THREADS },
+};
+#define NUM_BOARD_POOLS ((int)(sizeof(board_pools) / sizeof(board_pools[0])))
+#define STANDARD_BOARD_POOL (&board_pools[0])
+#define NO_GUESS_BOARD_POOL (&board_pools[1])
 
-	signal(SIGINT,sig_handler);
+/* pool new games are served from - switched to the no-guess pool by -g */
+BoardPool *game_board_pool = STANDARD_BOARD_POOL;
 
-	pthread_mutex_init(&lb_mutex, NULL);
+/* the generator sleeps on this until a pool runs low */
+pthread_mutex_t board_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t  board_pool_low   = PTHREAD_COND_INITIALIZER;
 
-	//pull port to run server on from args
-	int socket_port_int;
-	char *socket_port;
-	if (argc == 1){
-    socket_port_int = 12345;
-  } else{
-    socket_port = argv[1];
-    socket_port_int = atoi(socket_port);
-  }
+void board_pool_init(BoardPool *pool){
+    for (size_t i = 0; i < BOARD_POOL_SIZE; i++){
+        atomic_init(&pool->slots[i].sequence, i);
+    }
+    atomic_init(&pool->enqueue_pos, 0);
+    atomic_init(&pool->dequeue_pos, 0);
+    atomic_init(&pool->num_boards, 0);
+}
 
-  //set up the server socket
-	int server_socket;
-	server_socket = setUpServer(socket_port_int);
-	if (server_socket == -1){
-		return -1;
-	}
+/* add a board to the pool. returns false if the pool is full. */
+bool board_pool_put(BoardPool *pool, const GameState *board){
+    size_t pos = atomic_load_explicit(&pool->enqueue_pos, memory_order_relaxed);
+    for (;;) {
+        BoardPoolSlot *slot = &pool->slots[pos & (BOARD_POOL_SIZE - 1)];
+        size_t seq = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            /* slot is free - claim it */
+            if (atomic_compare_exchange_weak_explicit(&pool->enqueue_pos, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                slot->board = *board;
+                atomic_store_explicit(&slot->sequence, pos + 1, memory_order_release);
+                atomic_fetch_add_explicit(&pool->num_boards, 1, memory_order_relaxed);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = atomic_load_explicit(&pool->enqueue_pos, memory_order_relaxed);
+        }
+    }
+}
 
-  //set up user structures
-	int num_users = get_num_users();
-	User users_array[num_users];
-	users = users_array;
-	printf("Number of users: %d\n", num_users);
-	//initialise users from authentication.txt file
-	for (int i = 0; i < num_users; i++){
-			FILE *fp = fopen("Authentication.txt", "r");
-			char c, username[200];
-			int lineNum = -1;
-			int index = 0;
-			bool on_username = true;
-			while (c != EOF && lineNum <= i){
-				if (lineNum == i && on_username){
-					username[index] = c;
-					index++;
-				}
-				if (c == '\n'){
-					lineNum++;
-					on_username = true;
-				}
-				if ((c == ' ' || c == '\t') && on_username){
-					on_username = false;
-				}
-				c = fgetc(fp);
-			}
-			fclose(fp);
-			strcpy(users[i].name, username);
-			users[i].num_games_played = 0;
-			users[i].num_games_won = 0;
-			memset(username,0,strlen(username));
-	}
-
-    // /* create the request-handling threads */
-    // for (i=0; i<NUM_HANDLER_THREADS; i++) {
-    //     thr_id[i] = i;
-    //     pthread_create(&p_threads[i], NULL, connection_handler, (void*)&thr_id[i]);
-    // }
-
-	while (1){
-		//connect to client socket
-    int client_socket;
-		client_socket = connectToClient(server_socket);
-		if (client_socket == -1){
-			return -1;
-		}
-	}
+/* take a board from the pool. returns false if the pool is empty. */
+bool board_pool_take(BoardPool *pool, GameState *board){
+    size_t pos = atomic_load_explicit(&pool->dequeue_pos, memory_order_relaxed);
+    for (;;) {
+        BoardPoolSlot *slot = &pool->slots[pos & (BOARD_POOL_SIZE - 1)];
+        size_t seq = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (diff == 0) {
+            /* slot holds a board - claim it */
+            if (atomic_compare_exchange_weak_explicit(&pool->dequeue_pos, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                *board = slot->board;
+                atomic_store_explicit(&slot->sequence, pos + BOARD_POOL_SIZE, memory_order_release);
+                break;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = atomic_load_explicit(&pool->dequeue_pos, memory_order_relaxed);
+        }
+    }
 
-	return 1;
+    /* wake the generator if the pool is running low */
+    if (atomic_fetch_sub_explicit(&pool->num_boards, 1, memory_order_relaxed) - 1 < BOARD_POOL_LOW_WATER) {
+        pthread_cond_signal(&board_pool_low);
+    }
+    return true;
 }
 
-int setUpServer(int socket_port_int){
-	int socket_desc;
-    struct sockaddr_in server;
-
-    //Create socket
-    socket_desc = socket(AF_INET , SOCK_STREAM , 0);
-    if (socket_desc == -1)
-    {
-        printf("Could not create socket");
-        return -1;
+/* get a board for a new game - from the pool if one is ready, */
+/* otherwise generate it on the spot.                           */
+GameState new_game_board(BoardPool *pool){
+    GameState board;
+    if (!board_pool_take(pool, &board)) {
+        unsigned int seed = rand();
+        board = pool->generate(&seed);
     }
-    printf("Socket created");
+    return board;
+}
 
-    //Prepare the sockaddr_in structure - assign IP address and port
-    server.sin_family = AF_INET;
-    server.sin_addr.s_addr = inet_addr( "127.0.0.1" );
-    server.sin_port = htons( socket_port_int );
+/* background thread that keeps a board pool topped up */
+void* board_generator_loop(void* data)
+{
+    BoardPool *pool = (BoardPool*)data;
+    unsigned int seed = rand();    /* each generator has its own random stream */
 
-    //Bind socket to server
-    if( bind(socket_desc,(struct sockaddr *)&server , sizeof(server)) < 0)
-    {
-        //print the error message
-        perror("bind failed. Error");
-        return -1;
+    while (1) {
+        bool pool_full = true;
+        if (atomic_load_explicit(&pool->num_boards, memory_order_relaxed) < BOARD_POOL_SIZE) {
+            GameState board = pool->generate(&seed);
+            if (board_pool_put(pool, &board)) {
+                pool_full = false;
+            }
+        }
+
+        if (pool_full) {
+            /* nothing to do - sleep until a pool runs low. the timeout */
+            /* covers a signal sent before we started waiting.          */
+            struct timespec wake_time;
+            clock_gettime(CLOCK_REALTIME, &wake_time);
+            wake_time.tv_sec += 1;
+            pthread_mutex_lock(&board_pool_mutex);
+            pthread_cond_timedwait(&board_pool_low, &board_pool_mutex, &wake_time);
+            pthread_mutex_unlock(&board_pool_mutex);
+        }
     }
-    printf("Socket binded");
+    return NULL;
+}
 
-    //display server IP address and port to screen
-    printf("Server is running on IP address: %s\n", inet_ntoa(server.sin_addr));
-    printf("Server is running on port: %d\n", (int) ntohs(server.sin_port));
+/* suspended games, found by token through the hash table and evicted */
+/* least recently suspended first once the cache is full.              */
+SuspendedSession *session_buckets[SESSION_CACHE_BUCKETS];
+SuspendedSession *session_lru_head = NULL;   /* most recently suspended  */
+SuspendedSession *session_lru_tail = NULL;   /* least recently suspended */
+int num_suspended_sessions = 0;
+pthread_mutex_t session_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-    return socket_desc;
+/* tokens are random, so any of their bytes make a good hash */
+unsigned int session_bucket(const uint8_t token[SESSION_TOKEN_BYTES]){
+    unsigned int hash;
+    memcpy(&hash, token, sizeof(hash));
+    return hash % SESSION_CACHE_BUCKETS;
 }
 
-int connectToClient(int server_socket){
-	int client_socket, c;
-    struct sockaddr_in client;
+/* unlink a session from the hash table and lru list. */
+/* the session mutex must be held.                    */
+void session_cache_remove(SuspendedSession *session){
+    SuspendedSession **p = &session_buckets[session_bucket(session->token)];
+    while (*p != session) {
+        p = &(*p)->hash_next;
+    }
+    *p = session->hash_next;
 
-	   listen(server_socket , 3);
-    //puts("Please run the client in another terminal...");
+    if (session->lru_prev) {
+        session->lru_prev->lru_next = session->lru_next;
+    } else {
+        session_lru_head = session->lru_next;
+    }
+    if (session->lru_next) {
+        session->lru_next->lru_prev = session->lru_prev;
+    } else {
+        session_lru_tail = session->lru_prev;
+    }
 
-    //Accept an incoming connection
-    c = sizeof(struct sockaddr_in);
+    num_suspended_sessions--;
+    atomic_fetch_sub(&stats.idle_sessions, 1);
+    atomic_fetch_sub(&stats.idle_session_bytes, sizeof(SuspendedSession));
+}
 
-    puts("Please run the client in another terminal...");
+/* write a game in progress to a compact blob. adjacent mine counts and */
+/* the number of mines remaining are rebuilt from the bitsets on load.  */
+/* returns the size of the blob.                                        */
+int serialize_session(const GameSession *session, uint8_t blob[SESSION_BLOB_MAX]){
+    int size = 0;
+    uint64_t time_elapsed = session->time_elapsed;
 
-    //Accept an incoming connection
-    c = sizeof(struct sockaddr_in);
-    pthread_t thread_id;
+    uint16_t start_tile = (uint16_t)session->game.start_tile;
 
-    while( (client_socket = accept(server_socket, (struct sockaddr *)&client, (socklen_t*)&c)) ){
-    	puts("Connected accepted");
-		  add_request(10, &req_mutex, &got_request);
-    	if (pthread_create(&thread_id, NULL, connection_handler, (void*)&client_socket) < 0){
-    		perror("could not create socket");
-    		return -1;
-    	}
-    	puts("Hanfler assigned");
+    blob[size++] = 1;    /* format version */
+    blob[size++] = session->user & 0xFF;
+    blob[size++] = (session->user >> 8) & 0xFF;
+    for (int i = 0; i < 8; i++) {
+        blob[size++] = (time_elapsed >> (8 * i)) & 0xFF;
+    }
+    for (int i = 0; i < 4; i++) {
+        blob[size++] = (session->game.seed >> (8 * i)) & 0xFF;
     }
+    blob[size++] = start_tile & 0xFF;
+    blob[size++] = (start_tile >> 8) & 0xFF;
+    memcpy(&blob[size], session->game.mines, TILE_BITSET_BYTES);
+    size += TILE_BITSET_BYTES;
+    memcpy(&blob[size], session->game.revealed, TILE_BITSET_BYTES);
+    size += TILE_BITSET_BYTES;
+    memcpy(&blob[size], session->game.flagged, TILE_BITSET_BYTES);
+    size += TILE_BITSET_BYTES;
+    return size;
+}
 
-    //accept connection from an incoming client
-    if (client_socket < 0)
-    {
-        perror("accept failed");
-        return -1;
+/* rebuild a game in progress from a blob written by serialize_session */
+bool deserialize_session(const uint8_t *blob, int blob_size, GameSession *session){
+    if (blob_size != 17 + 3 * TILE_BITSET_BYTES || blob[0] != 1) {
+        return false;
+    }
+    GameState game = {.num_fields_revealed = 0, .num_flags = 0, .num_mines_remaining = NUM_MINES, .hit_mine = false};
+    game.seed = blob[11] | (blob[12] << 8) | (blob[13] << 16) | ((unsigned int)blob[14] << 24);
+    game.start_tile = (int16_t)(blob[15] | (blob[16] << 8));
+    int offset = 17;
+    memcpy(game.mines, &blob[offset], TILE_BITSET_BYTES);
+    offset += TILE_BITSET_BYTES;
+    memcpy(game.revealed, &blob[offset], TILE_BITSET_BYTES);
+    offset += TILE_BITSET_BYTES;
+    memcpy(game.flagged, &blob[offset], TILE_BITSET_BYTES);
+
+    for (int x = 0; x < NUM_TILES_X; x++) {
+        for (int y = 0; y < NUM_TILES_Y; y++) {
+            if (tile_contains_mine(x, y, game)) {
+                game = set_adjacent_mines(x, y, game);
+            }
+            if (tile_bit(game.flagged, TILE_INDEX(x, y))) {
+                game.num_mines_remaining--;
+            }
+        }
     }
 
-    return client_socket;
+    session->user = blob[1] | (blob[2] << 8);
+    session->time_elapsed = 0;
+    for (int i = 0; i < 8; i++) {
+        session->time_elapsed |= (uint64_t)blob[3 + i] << (8 * i);
+    }
+    session->game = game;
+    return true;
 }
 
-void *connection_handler(void *socket_desc){
-  // int rc;                         /* return code of pthreads functions.  */
-  // struct request* a_req;      /* pointer to a request.               */
-  int client_socket = *(int*)socket_desc;
-  int read_size;
-  int menu_selection;
+/* keep a game whose connection dropped so the client can resume it */
+void suspend_session(const GameSession *session){
+    SuspendedSession *suspended = (SuspendedSession*)malloc(sizeof(SuspendedSession));
+    if (!suspended) {
+        fprintf(stderr, "suspend_session: out of memory\n");
+        return;
+    }
+    memcpy(suspended->token, session->token, SESSION_TOKEN_BYTES);
+    suspended->blob_size = serialize_session(session, suspended->blob);
 
-	//log in user
-	int logged_in_user;
-	logged_in_user = handle_login(client_socket);
-	User current_user = users[logged_in_user];
-	printf("Logged in user: %s\n", current_user.name);
+    pthread_mutex_lock(&session_mutex);
 
-	bool withinGame = true;
-	while(withinGame){
+    /* make room by evicting the least recently suspended game */
+    if (num_suspended_sessions == SESSION_CACHE_SIZE) {
+        SuspendedSession *oldest = session_lru_tail;
+        session_cache_remove(oldest);
+        free(oldest);
+        atomic_fetch_add(&stats.sessions_evicted, 1);
+    }
 
-  // if (num_requests > 0) {
-    read_size = recv(client_socket, &menu_selection, sizeof(int), 0);
-    if (read_size <= 0){
-      break;
+    unsigned int bucket = session_bucket(suspended->token);
+    suspended->hash_next = session_buckets[bucket];
+    session_buckets[bucket] = suspended;
+    suspended->lru_prev = NULL;
+    suspended->lru_next = session_lru_head;
+    if (session_lru_head) {
+        session_lru_head->lru_prev = suspended;
+    } else {
+        session_lru_tail = suspended;
     }
-    // a_req = get_request(&req_mutex);
-    // if (a_req) { /* got a request - handle it and free it */
-    //     /* unlock mutex - so other threads would be able to handle */
-    //     /* other reqeusts waiting in the queue paralelly.          */
-    //     rc = pthread_mutex_unlock(&req_mutex);
-    //     // handle_request(a_req, thread_id);
-    //     free(a_req);
-    //     /* and lock the mutex again. */
-    //     rc = pthread_mutex_lock(&req_mutex);
-    // }
-		printf("Menu selection: %d\n\n", menu_selection);
-		if (menu_selection == 3){
-			withinGame = false;
-		}
-  // }
-    // else {
-    //
-    //     rc = pthread_cond_wait(&got_request, &req_mutex);
-        run_selected_function(menu_selection, client_socket, logged_in_user);
-    		menu_selection = 0;
-    // }
+    session_lru_head = suspended;
+    num_suspended_sessions++;
 
-	}
-	return 0;
-};
+    pthread_mutex_unlock(&session_mutex);
 
-int get_num_users(void){
-	FILE *fp = fopen("Authentication.txt", "r");
-	char c;
-	int numLines = 0;
+    atomic_fetch_add(&stats.sessions_suspended, 1);
+    atomic_fetch_add(&stats.idle_sessions, 1);
+    atomic_fetch_add(&stats.idle_session_bytes, sizeof(SuspendedSession));
+}
 
-	while(c != EOF){
-		if (c == '\n'){
-			numLines++;
-		}
-		c = fgetc(fp);
-	}
+/* take a suspended game out of the cache. returns false if the token */
+/* is unknown or the game has been evicted.                            */
+bool resume_session(const uint8_t token[SESSION_TOKEN_BYTES], GameSession *session){
+    pthread_mutex_lock(&session_mutex);
+    SuspendedSession *suspended = session_buckets[session_bucket(token)];
+    while (suspended && memcmp(suspended->token, token, SESSION_TOKEN_BYTES) != 0) {
+        suspended = suspended->hash_next;
+    }
+    if (suspended) {
+        session_cache_remove(suspended);
+    }
+    pthread_mutex_unlock(&session_mutex);
 
-	fclose(fp);
-	return numLines - 1;
+    if (!suspended) {
+        return false;
+    }
+    bool resumed = deserialize_session(suspended->blob, suspended->blob_size, session);
+    memcpy(session->token, suspended->token, SESSION_TOKEN_BYTES);
+    free(suspended);
+    if (resumed) {
+        atomic_fetch_add(&stats.sessions_resumed, 1);
+    }
+    return resumed;
 }
 
-int handle_login(int client_socket){
-	int read_size;
-	char buffer_username[2000], buffer_password[2000];
-	char *confirmation = "received";
+/* live games that can be spectated */
+LiveGame *live_games = NULL;
+int next_live_game_id = 1;
+pthread_mutex_t live_games_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-	//receive username and send confirmation
-	read_size = recv(client_socket, buffer_username, 2000, 0);
-	printf("Username: %s\n", buffer_username);
-	send(client_socket, confirmation, strlen(confirmation), 0);
+/* allocate a frame with room for the header and payload */
+SharedFrame *frame_create(int type, int remaining_mines, int aux, int payload_size){
+    SharedFrame *frame = (SharedFrame*)malloc(sizeof(SharedFrame) + 4 + payload_size);
+    if (!frame) {
+        fprintf(stderr, "frame_create: out of memory\n");
+        exit(1);
+    }
+    atomic_init(&frame->refcount, 1);
+    frame->size = 4 + payload_size;
+    frame->data[0] = type;
+    frame->data[1] = remaining_mines;
+    frame->data[2] = aux & 0xFF;
+    frame->data[3] = (aux >> 8) & 0xFF;
+    atomic_fetch_add_explicit(&stats.frames_encoded, 1, memory_order_relaxed);
+    return frame;
+}
 
-	//receive password
-	read_size = recv(client_socket, buffer_password, 2000, 0);
-	printf("Password: %s\n", buffer_password);
+void frame_release(SharedFrame *frame){
+    if (atomic_fetch_sub_explicit(&frame->refcount, 1, memory_order_acq_rel) == 1) {
+        free(frame);
+    }
+}
 
-	//authenticate user
-	int authenticated;
-	authenticated = authenticate_user(buffer_username, buffer_password);
+/* code for a tile as a spectator sees it */
+int tile_code(const GameState *game, int index, bool show_mines){
+    if (tile_bit(game->flagged, index)) {
+        return TILE_CODE_FLAG;
+    } else if (tile_bit(game->revealed, index)) {
+        return tile_adjacent_mines(game->adjacent_mines, index);
+    } else if (show_mines && tile_bit(game->mines, index)) {
+        return TILE_CODE_MINE;
+    }
+    return TILE_CODE_HIDDEN;
+}
 
-	//tell client if user is authenticated
-	if (authenticated > -1){
-		confirmation = "true";
-	}
-	send(client_socket, confirmation, strlen(confirmation), 0);
+/* encode the whole board. the end frame shows the mines as well. */
+SharedFrame *encode_keyframe(const GameState *game, int type, int aux){
+    SharedFrame *frame = frame_create(type, game->num_mines_remaining, aux, NUM_TILES);
+    for (int i = 0; i < NUM_TILES; i++) {
+        frame->data[4 + i] = tile_code(game, i, type == FRAME_END);
+    }
+    return frame;
+}
 
-	return authenticated;
+/* encode the tiles that changed in a move as (index, code) triples */
+SharedFrame *encode_delta(const GameState *previous_game, const GameState *current_game){
+    int changed[NUM_TILES], num_changed = 0;
+    for (int byte = 0; byte < TILE_BITSET_BYTES; byte++) {
+        uint8_t difference = (previous_game->revealed[byte] ^ current_game->revealed[byte])
+                           | (previous_game->flagged[byte] ^ current_game->flagged[byte]);
+        for (int bit = 0; difference; bit++, difference >>= 1) {
+            if (difference & 1) {
+                changed[num_changed++] = byte * 8 + bit;
+            }
+        }
+    }
+
+    SharedFrame *frame = frame_create(FRAME_DELTA, current_game->num_mines_remaining, num_changed, 3 * num_changed);
+    for (int i = 0; i < num_changed; i++) {
+        frame->data[4 + 3*i] = changed[i] & 0xFF;
+        frame->data[5 + 3*i] = (changed[i] >> 8) & 0xFF;
+        frame->data[6 + 3*i] = tile_code(current_game, changed[i], false);
+    }
+    return frame;
 }
 
-int authenticate_user(char username[2000], char password[2000]){
-	FILE *fp;
-	char filename[100], c;
-	char file_username[2000];
-	char file_password[2000];
-	bool correct = false;
-	int lineNum = -1;
+/* drop every frame queued for a spectator. */
+/* the live game's mutex must be held.      */
+void spectator_drop_queue(Spectator *spectator){
+    while (spectator->queue_count > 0) {
+        frame_release(spectator->queue[spectator->queue_head]);
+        spectator->queue_head = (spectator->queue_head + 1) % SPECTATOR_QUEUE_MAX;
+        spectator->queue_count--;
+    }
+}
 
-	// Open one file for reading
-	fp = fopen("Authentication.txt", "r");
-	//Reading file and comparing username and password
-	while (correct == false && c != EOF){
-		 if (c == '\n'){
-  			lineNum++;
-  		}
-		fscanf(fp, "%s %s", file_username, file_password);
-		if(strcmp(file_username,username) == 0 && strcmp(file_password,password) == 0){
-  			puts("login successful");
-  			correct = true;
-  			break;
-  		}
-		c = fgetc(fp);
-	}
+/* queue a frame for a spectator. if the spectator has fallen too far */
+/* behind its queue is dropped and it gets a keyframe next time.       */
+/* the live game's mutex must be held.                                 */
+void spectator_push(Spectator *spectator, SharedFrame *frame){
+    if (spectator->queue_count == SPECTATOR_QUEUE_MAX) {
+        spectator_drop_queue(spectator);
+        spectator->needs_keyframe = true;
+        atomic_fetch_add(&stats.spectators_dropped_to_keyframe, 1);
+        return;
+    }
+    atomic_fetch_add_explicit(&frame->refcount, 1, memory_order_relaxed);
+    spectator->queue[(spectator->queue_head + spectator->queue_count) % SPECTATOR_QUEUE_MAX] = frame;
+    spectator->queue_count++;
+    session_wake(&spectator->frame_ready, spectator->wake_fd);
+}
 
-	if(!correct){
-		puts("incorrect login");
-		return -1;
-	}
-	return lineNum;
+void live_game_release(LiveGame *live_game){
+    if (atomic_fetch_sub_explicit(&live_game->refcount, 1, memory_order_acq_rel) == 1) {
+        pthread_mutex_destroy(&live_game->mutex);
+        free(live_game);
+    }
 }
 
-void run_selected_function(int menu_selection, int client_socket, int logged_in_user){
+/* make a game visible to spectators */
+LiveGame *start_live_game(const char *player, const GameState *game){
+    LiveGame *live_game = (LiveGame*)malloc(sizeof(LiveGame));
+    if (!live_game) {
+        return NULL;
+    }
+    strncpy(live_game->player, player, sizeof(live_game->player) - 1);
+    live_game->player[sizeof(live_game->player) - 1] = '\0';
+    pthread_mutex_init(&live_game->mutex, NULL);
+    atomic_init(&live_game->refcount, 1);
+    live_game->game = *game;
+    live_game->spectators = NULL;
 
-  //run function based on selected menu option
-	if (menu_selection == 1){
-    //start timer for game
-		time_t begin, end, time_spent;
-		begin = time(NULL);
-    //run game
-		bool won_game = run_minesweeper(client_socket);
-		end = time(NULL);
-    //calculate time
-		time_spent = (end - begin);
-		users[logged_in_user].num_games_played++;
-    //if user won - insert entry to leaderboard
-		if (won_game){
-			users[logged_in_user].num_games_won++;
-			entry *p = (entry *)malloc(sizeof(entry));
-			p->user = &users[logged_in_user];
-			p->time_taken = time_spent;
-			p->next = NULL;
-			pthread_mutex_lock(&lb_mutex);
-			insert_entry(p);
-			num_leaderboard_entries++;
-			pthread_mutex_unlock(&lb_mutex);
-			print_leaderboard(head);
-      send(client_socket, &time_spent, sizeof(time_t), 0);
-		}
-	} else if (menu_selection == 2){
-		run_leaderboard(client_socket);
-	} else if (menu_selection == 3){
-		close(client_socket);
-	}
+    pthread_mutex_lock(&live_games_mutex);
+    live_game->id = next_live_game_id++;
+    live_game->next = live_games;
+    live_games = live_game;
+    pthread_mutex_unlock(&live_games_mutex);
+    return live_game;
 }
 
-//run minesweeper function
-bool run_minesweeper(int client_socket){
-  //setup game
-	GameState current_game = setup_minesweeper();
+/* send a move to everyone watching. the delta is encoded once and */
+/* shared by all spectators; a keyframe is only encoded if one of  */
+/* them has fallen behind.                                         */
+void publish_move(LiveGame *live_game, const GameState *previous_game, const GameState *current_game){
+    if (!live_game) {
+        return;
+    }
+    pthread_mutex_lock(&live_game->mutex);
+    live_game->game = *current_game;
+    if (live_game->spectators && memcmp(previous_game, current_game, sizeof(GameState)) != 0) {
+        SharedFrame *delta = encode_delta(previous_game, current_game);
+        SharedFrame *keyframe = NULL;
+        for (Spectator *spectator = live_game->spectators; spectator; spectator = spectator->next) {
+            if (spectator->needs_keyframe) {
+                if (!keyframe) {
+                    keyframe = encode_keyframe(current_game, FRAME_KEYFRAME, 0);
+                }
+                spectator->needs_keyframe = false;
+                spectator_push(spectator, keyframe);
+            } else {
+                spectator_push(spectator, delta);
+            }
+        }
+        frame_release(delta);
+        if (keyframe) {
+            frame_release(keyframe);
+        }
+    }
+    pthread_mutex_unlock(&live_game->mutex);
+}
 
-	bool quit_game = false;
-	bool hit_mine = false;
-	bool won_game = false;
+/* tell spectators the game is over and stop listing it */
+void end_live_game(LiveGame *live_game, GameResult result, const GameState *game){
+    if (!live_game) {
+        return;
+    }
+    pthread_mutex_lock(&live_games_mutex);
+    LiveGame **p = &live_games;
+    while (*p != live_game) {
+        p = &(*p)->next;
+    }
+    *p = live_game->next;
+    pthread_mutex_unlock(&live_games_mutex);
 
-	int adjacent_mines[NUM_TILES_X][NUM_TILES_Y];
-	for (int i = 0; i < NUM_TILES_X; i++){
-		for (int j = 0; j < NUM_TILES_Y; j++){
-			adjacent_mines[i][j] = current_game.tiles[i][j].adjacent_mines;
-		}
-	}
+    pthread_mutex_lock(&live_game->mutex);
+    if (live_game->spectators) {
+        SharedFrame *end_frame = encode_keyframe(game, FRAME_END, result);
+        for (Spectator *spectator = live_game->spectators; spectator; spectator = spectator->next) {
+            /* the end frame carries the whole board, so a spectator */
+            /* that is behind can skip straight to it                */
+            if (spectator->queue_count == SPECTATOR_QUEUE_MAX) {
+                spectator_drop_queue(spectator);
+            }
+            spectator_push(spectator, end_frame);
+            spectator->finished = true;
+        }
+        frame_release(end_frame);
+    }
+    pthread_mutex_unlock(&live_game->mutex);
+    live_game_release(live_game);
+}
 
-  int mines[NUM_TILES_X][NUM_TILES_Y];
-  for (int i = 0; i < NUM_TILES_X; i++){
-    for (int j = 0; j < NUM_TILES_Y; j++){
-      if(current_game.tiles[i][j].is_mine){
-        mines[i][j] = 1;
-      } else{
-        mines[i][j] = 0;
-      }
+/* send a frame to a spectator, prefixed with its size */
+bool send_frame(int client_socket, const SharedFrame *frame){
+    uint16_t size = frame->size;
+    /* one syscall for the size and the shared frame, without copying them together */
+    struct iovec iov[2] = {
+        {.iov_base = &size, .iov_len = sizeof(size)},
+        {.iov_base = (void*)frame->data, .iov_len = frame->size},
+    };
+    if (net_sendv(client_socket, iov, 2) < 0) {
+        return false;
     }
-  }
+    atomic_fetch_add_explicit(&stats.frames_sent, 1, memory_order_relaxed);
+    return true;
+}
 
-  //play game until user quits, hits a mine or wins
-	while(!quit_game && !hit_mine && !won_game){
-    //determine tiles to send based on revealed tiles
-		int tiles_to_send[NUM_TILES_X][NUM_TILES_Y];
-		for (int i = 0; i < NUM_TILES_X; i++){
-			for (int j = 0; j < NUM_TILES_Y; j++){
-				if (current_game.tiles[i][j].revealed){
-					tiles_to_send[i][j] = adjacent_mines[i][j];
-				} else{
-					tiles_to_send[i][j] = -1;
-				}
-			}
-		}
+/* let the client pick a live game and stream it until it ends */
+void run_spectator(int client_socket){
+    printf("Running spectator\n");
 
-    //send tiles necessary
-		if (send(client_socket, tiles_to_send, (NUM_TILES_Y * NUM_TILES_X) * sizeof(int), 0) < 0){
-			puts("send of revealed tiles failed");
-		}
+    /* send the list of live games */
+    LiveGameInfo listed_games[MAX_LISTED_GAMES];
+    int num_listed_games = 0;
+    pthread_mutex_lock(&live_games_mutex);
+    for (LiveGame *p = live_games; p && num_listed_games < MAX_LISTED_GAMES; p = p->next) {
+        listed_games[num_listed_games].id = p->id;
+        memcpy(listed_games[num_listed_games].player, p->player, sizeof(p->player));
+        num_listed_games++;
+    }
+    pthread_mutex_unlock(&live_games_mutex);
+    net_send(client_socket, &num_listed_games, sizeof(int), 0);
+    if (num_listed_games == 0) {
+        return;
+    }
+    net_send(client_socket, listed_games, num_listed_games * sizeof(LiveGameInfo), 0);
 
-    //send number of remaining mines
-		int remaining_mines = current_game.num_mines_remaining;
-		if (send(client_socket, &remaining_mines, sizeof(int), 0) < 0){
-			puts("send of remaining_mines failed");
-		}
+    /* subscribe to the chosen game */
+    int game_id;
+    if (net_recv(client_socket, &game_id, sizeof(int), MSG_WAITALL) <= 0) {
+        return;
+    }
+    Spectator spectator = {.wake_fd = session_wake_fd(), .queue_head = 0, .queue_count = 0, .needs_keyframe = false, .finished = false};
+    pthread_cond_init(&spectator.frame_ready, NULL);
+    LiveGame *live_game = NULL;
+    pthread_mutex_lock(&live_games_mutex);
+    for (LiveGame *p = live_games; p; p = p->next) {
+        if (p->id == game_id) {
+            live_game = p;
+            atomic_fetch_add(&live_game->refcount, 1);
+            pthread_mutex_lock(&live_game->mutex);
+            SharedFrame *keyframe = encode_keyframe(&live_game->game, FRAME_KEYFRAME, 0);
+            spectator_push(&spectator, keyframe);
+            frame_release(keyframe);
+            spectator.next = live_game->spectators;
+            live_game->spectators = &spectator;
+            pthread_mutex_unlock(&live_game->mutex);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&live_games_mutex);
 
-    //send flagged tiles
-		bool flagged_tiles[NUM_TILES_X][NUM_TILES_Y];
-		for (int i = 0; i < NUM_TILES_X; i++){
-			for (int j = 0; j < NUM_TILES_Y; j++){
-				flagged_tiles[i][j] = current_game.tiles[i][j].is_flagged;
-			}
-		}
-		if (send(client_socket, flagged_tiles, (NUM_TILES_Y * NUM_TILES_X) * sizeof(bool), 0) < 0){
-			puts("send of flagged tiles failed");
-		}
+    int subscribed = live_game != NULL;
+    net_send(client_socket, &subscribed, sizeof(int), 0);
+    net_flush(client_socket);
+    /* a spectator only listens, so it is never idle while the game runs */
+    cancel_idle_timeout();
+    if (!live_game) {
+        pthread_cond_destroy(&spectator.frame_ready);
+        if (spectator.wake_fd >= 0) {
+            close(spectator.wake_fd);
+        }
+        return;
+    }
 
-    //receive menu selection
-		char selection;
-		recv(client_socket, &selection, sizeof(char), 0);
-		printf("%c\n", selection);
+    /* send frames as they arrive until the game ends */
+    pthread_mutex_lock(&live_game->mutex);
+    while (1) {
+        while (spectator.queue_count == 0 && !spectator.finished) {
+            session_wait(&spectator.frame_ready, spectator.wake_fd, &live_game->mutex);
+        }
+        if (spectator.queue_count == 0) {
+            break;
+        }
+        SharedFrame *frame = spectator.queue[spectator.queue_head];
+        spectator.queue_head = (spectator.queue_head + 1) % SPECTATOR_QUEUE_MAX;
+        spectator.queue_count--;
 
-		char *confirmation = "received";
-		if (strstr(&selection, "Q")!=NULL){
-			quit_game = true;
-			//send(client_socket, confirmation, strlen(confirmation), 0);
-		}
-		if (send(client_socket, confirmation, strlen(confirmation), 0) < 0){
-			puts("failed confirmation");
-		}
+        /* send without holding the lock so a slow spectator doesn't hold up the game */
+        pthread_mutex_unlock(&live_game->mutex);
+        bool sent = send_frame(client_socket, frame) && net_flush(client_socket);
+        bool was_end_frame = frame->data[0] == FRAME_END;
+        frame_release(frame);
+        pthread_mutex_lock(&live_game->mutex);
+        if (!sent || was_end_frame) {
+            break;
+        }
+    }
 
-		char coordinates[2000];
+    /* unsubscribe, dropping any frames still queued */
+    Spectator **p = &live_game->spectators;
+    while (*p != &spectator) {
+        p = &(*p)->next;
+    }
+    *p = spectator.next;
+    spectator_drop_queue(&spectator);
+    pthread_mutex_unlock(&live_game->mutex);
+    pthread_cond_destroy(&spectator.frame_ready);
+    if (spectator.wake_fd >= 0) {
+        close(spectator.wake_fd);
+    }
+    live_game_release(live_game);
+}
 
-    //run function based on selection
-		if(strstr(&selection, "R")!=NULL){
-			recv(client_socket, coordinates, sizeof(char)*2000, 0);
+/* finished games waiting for the replay writer */
+struct replay_record *replay_queue = NULL;
+struct replay_record *last_replay = NULL;
+pthread_mutex_t replay_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t  got_replay   = PTHREAD_COND_INITIALIZER;
+/* set while the writer has records out of the queue that aren't written yet */
+bool replay_writing = false;
+pthread_cond_t  replays_flushed = PTHREAD_COND_INITIALIZER;
+
+/* start recording the moves of a new or resumed game */
+void move_log_start(MoveLog *move_log, const GameState *game, bool resumed){
+    move_log->initial_game = *game;
+    move_log->resumed = resumed;
+    move_log->moves = NULL;
+    move_log->num_moves = 0;
+    move_log->capacity = 0;
+    move_log->last_move_time = monotonic_ns();
+}
+
+/* record a move and the time since the previous one */
+void move_log_add(MoveLog *move_log, int type, int x, int y){
+    if (move_log->num_moves == move_log->capacity) {
+        int capacity = move_log->capacity ? move_log->capacity * 2 : 32;
+        ReplayMove *moves = (ReplayMove*)realloc(move_log->moves, capacity * sizeof(ReplayMove));
+        if (!moves) {
+            return;
+        }
+        move_log->moves = moves;
+        move_log->capacity = capacity;
+    }
+
+    uint64_t now = monotonic_ns();
+    uint64_t time_delta = (now - move_log->last_move_time) / 1000000;
+    move_log->last_move_time = now;
+
+    ReplayMove *move = &move_log->moves[move_log->num_moves++];
+    move->type = type;
+    move->x = x;
+    move->y = y;
+    move->time_delta = time_delta > UINT32_MAX ? UINT32_MAX : (uint32_t)time_delta;
+}
+
+/* append an unsigned LEB128 varint. returns the new size. */
+int write_varint(uint8_t *buffer, int size, uint32_t value){
+    while (value >= 0x80) {
+        buffer[size++] = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    buffer[size++] = value;
+    return size;
+}
+
+/* read a varint, returning false if it runs past the end of the buffer */
+bool read_varint(const uint8_t *buffer, int size, int *offset, uint32_t *value){
+    *value = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        if (*offset >= size) {
+            return false;
+        }
+        uint8_t byte = buffer[(*offset)++];
+        *value |= (uint32_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* encode a finished game and hand it to the replay writer.     */
+/* record layout: magic, version, size, seed, board config,     */
+/* flags, optional start tile / resumed board, moves, result.   */
+void record_replay(GameSession *session, GameResult result){
+    MoveLog *move_log = &session->move_log;
+    const GameState *game = &move_log->initial_game;
+    int max_size = 32 + 2 * TILE_BITSET_BYTES + move_log->num_moves * 16;
+    uint8_t *body = (uint8_t*)malloc(max_size);
+    if (!body) {
+        free(move_log->moves);
+        move_log->moves = NULL;
+        return;
+    }
+
+    int flags = 0;
+    if (game->start_tile >= 0) {
+        flags |= REPLAY_FLAG_START_TILE;
+    }
+    if (move_log->resumed) {
+        flags |= REPLAY_FLAG_RESUMED;
+    }
+
+    int size = 0;
+    size = write_varint(body, size, game->seed);
+    body[size++] = NUM_TILES_X;
+    body[size++] = NUM_TILES_Y;
+    size = write_varint(body, size, NUM_MINES);
+    size = write_varint(body, size, session->user);
+    body[size++] = flags;
+    if (flags & REPLAY_FLAG_START_TILE) {
+        size = write_varint(body, size, game->start_tile);
+    }
+    if (flags & REPLAY_FLAG_RESUMED) {
+        memcpy(&body[size], game->revealed, TILE_BITSET_BYTES);
+        size += TILE_BITSET_BYTES;
+        memcpy(&body[size], game->flagged, TILE_BITSET_BYTES);
+        size += TILE_BITSET_BYTES;
+    }
+    size = write_varint(body, size, move_log->num_moves);
+    for (int i = 0; i < move_log->num_moves; i++) {
+        ReplayMove *move = &move_log->moves[i];
+        body[size++] = move->type;
+        size = write_varint(body, size, move->x);
+        size = write_varint(body, size, move->y);
+        size = write_varint(body, size, move->time_delta);
+    }
+    body[size++] = result;
+
+    free(move_log->moves);
+    move_log->moves = NULL;
+    move_log->num_moves = 0;
+    move_log->capacity = 0;
+
+    /* prefix the body with the record header */
+    struct replay_record *record = (struct replay_record*)malloc(sizeof(struct replay_record));
+    uint8_t *data = (uint8_t*)malloc(size + 8);
+    if (!record || !data) {
+        free(record);
+        free(data);
+        free(body);
+        return;
+    }
+    int header_size = 0;
+    data[header_size++] = REPLAY_MAGIC_0;
+    data[header_size++] = REPLAY_MAGIC_1;
+    data[header_size++] = REPLAY_VERSION;
+    header_size = write_varint(data, header_size, size);
+    memcpy(&data[header_size], body, size);
+    free(body);
+    record->data = data;
+    record->size = header_size + size;
+    record->next = NULL;
+
+    pthread_mutex_lock(&replay_mutex);
+    if (last_replay) {
+        last_replay->next = record;
+    } else {
+        replay_queue = record;
+    }
+    last_replay = record;
+    pthread_mutex_unlock(&replay_mutex);
+    pthread_cond_signal(&got_replay);
+}
+
+/* background thread appending finished games to the replay log */
+void *replay_writer_loop(void *data){
+    const char *replay_log = (const char*)data;
+    FILE *fp = fopen(replay_log, "ab");
+    if (!fp) {
+        perror("could not open replay log");
+    }
+
+    pthread_mutex_lock(&replay_mutex);
+    while (1) {
+        while (replay_queue == NULL) {
+            pthread_cond_wait(&got_replay, &replay_mutex);
+        }
+        /* take every waiting record and write them without the lock held */
+        struct replay_record *records = replay_queue;
+        replay_queue = NULL;
+        last_replay = NULL;
+        replay_writing = true;
+        pthread_mutex_unlock(&replay_mutex);
+
+        while (records) {
+            struct replay_record *next = records->next;
+            if (fp) {
+                fwrite(records->data, 1, records->size, fp);
+            }
+            free(records->data);
+            free(records);
+            records = next;
+        }
+        if (fp) {
+            fflush(fp);
+        }
+
+        pthread_mutex_lock(&replay_mutex);
+        replay_writing = false;
+        pthread_cond_broadcast(&replays_flushed);
+    }
+    return NULL;
+}
+
+/* wait until every finished game has been written to the replay log */
+void flush_replays(void){
+    pthread_mutex_lock(&replay_mutex);
+    while (replay_queue != NULL || replay_writing) {
+        pthread_cond_wait(&replays_flushed, &replay_mutex);
+    }
+    pthread_mutex_unlock(&replay_mutex);
+}
+
+/* rebuild one game from a replay record body. returns false if the  */
+/* record is malformed, otherwise the replayed and recorded results. */
+bool replay_game(const uint8_t *body, int size, int *num_moves, int *recorded_result, int *replayed_result){
+    uint32_t seed, width, height, mines, user, start_tile, moves;
+    int offset = 0;
+    if (!read_varint(body, size, &offset, &seed) || offset + 2 > size) {
+        return false;
+    }
+    width = body[offset++];
+    height = body[offset++];
+    if (!read_varint(body, size, &offset, &mines) || !read_varint(body, size, &offset, &user) || offset >= size) {
+        return false;
+    }
+    if (width != NUM_TILES_X || height != NUM_TILES_Y || mines != NUM_MINES) {
+        printf("skipping game on a %ux%u board with %u mines\n", width, height, mines);
+        return false;
+    }
+    int flags = body[offset++];
+
+    /* rebuild the board from its seed */
+    unsigned int board_seed = seed;
+    GameState current_game = setup_minesweeper(&board_seed);
+    if (flags & REPLAY_FLAG_START_TILE) {
+        if (!read_varint(body, size, &offset, &start_tile) || start_tile >= NUM_TILES) {
+            return false;
+        }
+        current_game.start_tile = start_tile;
+        current_game = test_tile(current_game, start_tile / NUM_TILES_Y, start_tile % NUM_TILES_Y);
+    }
+    if (flags & REPLAY_FLAG_RESUMED) {
+        if (offset + 2 * TILE_BITSET_BYTES > size) {
+            return false;
+        }
+        memcpy(current_game.revealed, &body[offset], TILE_BITSET_BYTES);
+        offset += TILE_BITSET_BYTES;
+        memcpy(current_game.flagged, &body[offset], TILE_BITSET_BYTES);
+        offset += TILE_BITSET_BYTES;
+        for (int i = 0; i < NUM_TILES; i++) {
+            if (tile_bit(current_game.flagged, i)) {
+                current_game.num_mines_remaining--;
+            }
+        }
+    }
+
+    /* apply the moves with the same engine functions as a live game */
+    if (!read_varint(body, size, &offset, &moves)) {
+        return false;
+    }
+    bool won_game = false, quit_game = false;
+    for (uint32_t i = 0; i < moves; i++) {
+        uint32_t x, y, time_delta;
+        if (offset >= size) {
+            return false;
+        }
+        int type = body[offset++];
+        if (!read_varint(body, size, &offset, &x) || !read_varint(body, size, &offset, &y)
+                || !read_varint(body, size, &offset, &time_delta)) {
+            return false;
+        }
+        char *confirmation;
+        if (type == MOVE_REVEAL) {
+            current_game = reveal_tile_at(current_game, x, y, &confirmation);
+        } else if (type == MOVE_FLAG) {
+            current_game = place_flag_at(current_game, x, y, &confirmation);
+            won_game = test_if_won(current_game);
+        } else if (type == MOVE_QUIT) {
+            quit_game = true;
+        } else {
+            return false;
+        }
+    }
+    if (offset >= size) {
+        return false;
+    }
+
+    *num_moves = moves;
+    *recorded_result = body[offset];
+    /* a game neither won, lost on a mine nor quit was suspended. a loss */
+    /* the replay doesn't reach is a mismatch, not the recorded result   */
+    if (won_game) {
+        *replayed_result = GAME_WON;
+    } else if (current_game.hit_mine || quit_game) {
+        *replayed_result = GAME_LOST;
+    } else {
+        *replayed_result = GAME_SUSPENDED;
+    }
+    return true;
+}
+
+/* replay every game in a replay log, checking each reaches its recorded result */
+int run_replay(const char *replay_log){
+    FILE *fp = fopen(replay_log, "rb");
+    if (!fp) {
+        perror("could not open replay log");
+        return -1;
+    }
+
+    int num_games = 0, num_mismatched = 0;
+    long total_moves = 0;
+    struct timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    while (1) {
+        /* read the record header */
+        uint8_t header[8];
+        int header_size = 0;
+        if (fread(header, 1, 3, fp) != 3) {
+            break;
+        }
+        if (header[0] != REPLAY_MAGIC_0 || header[1] != REPLAY_MAGIC_1 || header[2] != REPLAY_VERSION) {
+            printf("replay log is corrupt after %d games\n", num_games);
+            break;
+        }
+        uint32_t size = 0;
+        bool complete = false;
+        while (header_size < 5 && fread(&header[header_size], 1, 1, fp) == 1) {
+            if (!(header[header_size++] & 0x80)) {
+                complete = true;
+                break;
+            }
+        }
+        int offset = 0;
+        if (!complete || !read_varint(header, header_size, &offset, &size)) {
+            break;
+        }
+        uint8_t *body = (uint8_t*)malloc(size);
+        if (!body || fread(body, 1, size, fp) != size) {
+            free(body);
+            break;
+        }
+
+        int num_moves, recorded_result, replayed_result;
+        if (replay_game(body, size, &num_moves, &recorded_result, &replayed_result)) {
+            num_games++;
+            total_moves += num_moves;
+            if (recorded_result != replayed_result) {
+                num_mismatched++;
+                printf("game %d: %d moves, recorded result %d but replayed result %d\n",
+                    num_games, num_moves, recorded_result, replayed_result);
+            }
+        }
+        free(body);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    fclose(fp);
+
+    double seconds = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+    printf("Replayed %d games (%ld moves) in %.3f seconds, %d did not match their recorded result\n",
+        num_games, total_moves, seconds, num_mismatched);
+    return num_mismatched == 0 ? 0 : 1;
+}
+
+/* nanoseconds on the monotonic clock, for timing games and moves */
+uint64_t monotonic_ns(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/* add one move's server and network time to the statistics */
+void record_move_timing(uint64_t server_ns, uint64_t network_ns){
+    atomic_fetch_add_explicit(&stats.moves_timed, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stats.move_server_ns, server_ns, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stats.move_network_ns, network_ns, memory_order_relaxed);
+    long max_server_ns = atomic_load_explicit(&stats.max_move_server_ns, memory_order_relaxed);
+    while ((long)server_ns > max_server_ns && !atomic_compare_exchange_weak_explicit(&stats.max_move_server_ns,
+            &max_server_ns, server_ns, memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+/* print server statistics - called by the main thread on SIGUSR1 */
+void print_server_stats(int num){
+    long idle_sessions = atomic_load(&stats.idle_sessions);
+    long idle_session_bytes = atomic_load(&stats.idle_session_bytes);
+    printf("\n==== server statistics ====\n");
+    printf("sessions suspended: %ld, resumed: %ld, evicted: %ld\n",
+        atomic_load(&stats.sessions_suspended), atomic_load(&stats.sessions_resumed), atomic_load(&stats.sessions_evicted));
+    printf("idle sessions: %ld using %ld bytes (%ld bytes per session)\n",
+        idle_sessions, idle_session_bytes, idle_sessions ? idle_session_bytes / idle_sessions : 0L);
+    printf("board frames encoded: %ld, sent: %ld, spectators dropped to keyframe: %ld\n",
+        atomic_load(&stats.frames_encoded), atomic_load(&stats.frames_sent), atomic_load(&stats.spectators_dropped_to_keyframe));
+    long moves_timed = atomic_load(&stats.moves_timed);
+    if (moves_timed > 0) {
+        printf("moves: %ld, mean server time %.1f us (max %.1f us), mean network and client time %.1f us\n",
+            moves_timed, atomic_load(&stats.move_server_ns) / 1e3 / moves_timed, atomic_load(&stats.max_move_server_ns) / 1e3,
+            atomic_load(&stats.move_network_ns) / 1e3 / moves_timed);
+    }
+    printf("sessions queued: %ld, rejected: %ld, rate limited moves: %ld, leaderboards: %ld\n",
+        atomic_load(&stats.sessions_queued), atomic_load(&stats.sessions_rejected),
+        atomic_load(&stats.moves_rate_limited), atomic_load(&stats.leaderboards_rate_limited));
+    printf("sessions timed out: %ld, leaderboard snapshots built: %ld, fiber stacks: %ld, shared board moves: %ld\n",
+        atomic_load(&stats.sessions_timed_out), atomic_load(&stats.leaderboard_snapshots), atomic_load(&stats.fiber_stacks),
+        atomic_load(&stats.shared_moves));
+    printf("multiplexed connections: %ld, streams: %ld\n",
+        atomic_load(&stats.mux_connections), atomic_load(&stats.mux_streams));
+    long batches = atomic_load(&stats.batches);
+    if (batches > 0) {
+        printf("batch moves: %ld, actions applied: %ld (%.1f per batch)\n",
+            batches, atomic_load(&stats.batch_actions), (double)atomic_load(&stats.batch_actions) / batches);
+    }
+    fflush(stdout);
+}
+
+int main(int argc , char *argv[]){
+  int        i;                                /* loop counter          */
+  int        thr_id[NUM_HANDLER_THREADS];      /* thread IDs            */
+  pthread_t  p_threads[NUM_HANDLER_THREADS];   /* thread's structures   */
+
+	//pthreads_mutex_lock(&mutex);
+	srand(RANDOM_NUMBER_SEED);
+	//pthreads_mutex_unlock(&mutex);
+
+	//pull options and port to run server on from args
+	int option;
+	char *bind_address = DEFAULT_BIND_ADDRESS;
+	int backlog = DEFAULT_LISTEN_BACKLOG;
+	int max_sessions = DEFAULT_MAX_SESSIONS;
+	int max_pending = DEFAULT_MAX_PENDING;
+	char *replay_log = DEFAULT_REPLAY_LOG;
+	char *state_file = DEFAULT_STATE_FILE;
+	char *restart_path = NULL;
+	while ((option = getopt(argc, argv, "gum:j:X:F:I:S:Z:b:l:rR:P:H:c:q:t:s:U:")) != -1){
+		if (option == 'R'){
+			//file to record finished games to
+			replay_log = optarg;
+		} else if (option == 'P'){
+			//replay every game in a replay log and exit
+			return run_replay(optarg);
+		} else if (option == 'b'){
+			//address to bind the server socket to
+			bind_address = optarg;
+		} else if (option == 'l'){
+			//listen backlog of each server socket
+			backlog = atoi(optarg);
+		} else if (option == 'r'){
+			//open one SO_REUSEPORT listener per core
+			num_listeners = sysconf(_SC_NPROCESSORS_ONLN);
+			if (num_listeners < 1){
+				num_listeners = 1;
+			} else if (num_listeners > MAX_LISTENERS){
+				num_listeners = MAX_LISTENERS;
+			}
+		} else if (option == 'g'){
+			//serve boards that can be solved without guessing
+			NO_GUESS_BOARD_POOL->enabled = true;
+			game_board_pool = NO_GUESS_BOARD_POOL;
+		} else if (option == 's'){
+			//file the server state is saved to on shutdown and loaded from on startup
+			state_file = optarg;
+		} else if (option == 'U'){
+			//unix socket a new server connects to to take over from this one
+			restart_path = optarg;
+		} else if (option == 'c'){
+			//most clients served at once
+			max_sessions = atoi(optarg);
+		} else if (option == 'q'){
+			//most clients waiting for a free handler
+			max_pending = atoi(optarg);
+		} else if (option == 't'){
+			//idle timeouts in seconds, as login,menu,game
+			if (sscanf(optarg, "%d,%d,%d", &login_timeout, &menu_timeout, &game_timeout) != 3){
+				fprintf(stderr, "idle timeouts must be given as login,menu,game seconds\n");
+				return -1;
+			}
+		} else if (option == 'H'){
+			//print the Authentication.txt entry for a password and exit
+			char stored[200];
+			if (!hash_password(optarg, stored, sizeof(stored))){
+				fprintf(stderr, "could not hash password\n");
+				return -1;
+			}
+			printf("%s\n", stored);
+			return 0;
+		} else if (option == 'F'){
+			//run sessions as fibers on this many worker threads
+			num_fiber_workers = atoi(optarg);
+		} else if (option == 'm'){
+			//size of the shared board as WIDTHxHEIGHT, optionally followed by ,mines
+			int fields = sscanf(optarg, "%dx%d,%d", &shared_board_width, &shared_board_height, &shared_board_mines);
+			if (fields < 2){
+				shared_board_width = 0;
+			} else if (fields == 2){
+				shared_board_mines = (long)shared_board_width * shared_board_height * NUM_MINES / NUM_TILES;
+			}
+			if (shared_board_width < SHARED_VIEW_SIZE || shared_board_height < SHARED_VIEW_SIZE
+					|| (long)shared_board_width * shared_board_height > (1 << 28)
+					|| shared_board_mines < 1 || shared_board_mines >= shared_board_width * shared_board_height){
+				fprintf(stderr, "the shared board must be given as WIDTHxHEIGHT[,mines], at least %dx%d and at most 2^28 tiles\n", SHARED_VIEW_SIZE, SHARED_VIEW_SIZE);
+				return -1;
+			}
+		} else if (option == 'j'){
+			//spread large flood reveals on the shared board over this many threads
+			num_reveal_threads = atoi(optarg);
+		} else if (option == 'X'){
+			//benchmark serial and parallel flood reveals on a SIZExSIZE board and exit
+			run_reveal_benchmark(atoi(optarg));
+			return 0;
+		} else if (option == 'u'){
+			//batch socket operations through io_uring
+			use_io_uring = true;
+		} else if (option == 'I'){
+			//benchmark the blocking and io_uring socket paths with this many sessions and exit
+			run_net_benchmark(atoi(optarg));
+			return 0;
+		} else if (option == 'Z'){
+			//benchmark sending a leaderboard snapshot of this many megabytes and exit
+			run_send_benchmark(atoi(optarg));
+			return 0;
+		} else if (option == 'S'){
+			//benchmark the no-guess board generator and exit
+			run_solver_benchmark(atoi(optarg));
+			return 0;
+		} else{
+			fprintf(stderr, "usage: %s [-g] [-m WIDTHxHEIGHT[,mines]] [-j reveal_threads] [-X size] [-u] [-F workers] [-S num_boards] [-Z megabytes] [-I sessions] [-b bind_address] [-l backlog] [-r] [-c max_sessions] [-q max_pending] [-t login,menu,game] [-s state_file] [-U restart_socket] [-R replay_log] [-P replay_log] [-H password] [port]\n", argv[0]);
+			return -1;
+		}
+	}
+
+  /* SIGINT, SIGTERM and SIGUSR1 are taken by the main thread once the      */
+  /* server is up, so block them before any other thread is started.       */
+  /* options that run a benchmark or tool and exit are handled before this, */
+  /* so ^C stops them.                                                      */
+  sigset_t stop_signals;
+  sigemptyset(&stop_signals);
+  sigaddset(&stop_signals, SIGINT);
+  sigaddset(&stop_signals, SIGTERM);
+  sigaddset(&stop_signals, SIGUSR1);
+  pthread_sigmask(SIG_BLOCK, &stop_signals, NULL);
+
+  /* create the request-handling threads */
+  for (i=0; i<NUM_HANDLER_THREADS; i++) {
+      thr_id[i] = i;
+      pthread_create(&p_threads[i], NULL, handle_requests_loop, (void*)&thr_id[i]);
+  }
+
+  /* start filling the enabled board pools in the background */
+  for (i=0; i<NUM_BOARD_POOLS; i++) {
+      board_pool_init(&board_pools[i]);
+      if (!board_pools[i].enabled) {
+          continue;
+      }
+      for (int j=0; j<board_pools[i].num_generators; j++) {
+          pthread_t board_generator;
+          pthread_create(&board_generator, NULL, board_generator_loop, (void*)&board_pools[i]);
+      }
+  }
+
+  admission_init(max_sessions, max_pending);
+  if (num_fiber_workers > 0){
+    fiber_workers_init(num_fiber_workers);
+  }
+  if (num_reveal_threads > 0){
+    reveal_pool_start(num_reveal_threads);
+  }
+
+  /* disconnect idle clients in the background */
+  timer_wheel_init();
+  pthread_t timer_thread;
+  pthread_create(&timer_thread, NULL, timer_wheel_loop, NULL);
+
+  /* record finished games in the background */
+  pthread_t replay_writer;
+  pthread_create(&replay_writer, NULL, replay_writer_loop, (void*)replay_log);
+
+	//a client dropping mid-send should not take the server down
+	signal(SIGPIPE,SIG_IGN);
+
+	pthread_mutex_init(&lb_mutex, NULL);
+
+	int socket_port_int;
+	char *socket_port;
+	if (optind >= argc){
+    socket_port_int = 12345;
+  } else{
+    socket_port = argv[optind];
+    socket_port_int = atoi(socket_port);
+  }
+
+  //on a hot restart take the server sockets, waiting clients and login token
+  //key over from the running server once it has drained
+	int pending_sockets[MAX_HANDOVER_PENDING];
+	int num_pending = 0;
+	uint8_t secret[SHA256_BYTES];
+	bool took_over = restart_path && hot_restart_takeover(restart_path, pending_sockets, &num_pending, secret);
+
+  /* sign login tokens with a key of this run's own, or the one handed over */
+	login_token_init(took_over ? secret : NULL);
+
+  //set up the server sockets - in SO_REUSEPORT mode the kernel spreads
+  //incoming connections across one listener per core
+	for (i = 0; !took_over && i < num_listeners; i++){
+		server_sockets[i] = setUpServer(bind_address, socket_port_int, backlog, num_listeners > 1);
+		if (server_sockets[i] == -1){
+			return -1;
+		}
+	}
+
+  //set up user structures
+	num_users = get_num_users();
+	User users_array[num_users];
+	users = users_array;
+	printf("Number of users: %d\n", num_users);
+	user_stats_init(num_users);
+	//initialise users from authentication.txt file
+	for (int i = 0; i < num_users; i++){
+			FILE *fp = fopen("Authentication.txt", "r");
+			char c, username[200];
+			int lineNum = -1;
+			int index = 0;
+			bool on_username = true;
+			while (c != EOF && lineNum <= i){
+				if (lineNum == i && on_username){
+					username[index] = c;
+					index++;
+				}
+				if (c == '\n'){
+					lineNum++;
+					on_username = true;
+				}
+				if ((c == ' ' || c == '\t') && on_username){
+					on_username = false;
+				}
+				c = fgetc(fp);
+			}
+			fclose(fp);
+			strcpy(users[i].name, username);
+			memset(username,0,strlen(username));
+	}
+
+    // /* create the request-handling threads */
+    // for (i=0; i<NUM_HANDLER_THREADS; i++) {
+    //     thr_id[i] = i;
+    //     pthread_create(&p_threads[i], NULL, connection_handler, (void*)&thr_id[i]);
+    // }
+
+  //pick up the leaderboard, statistics and suspended games of the last server
+	load_server_state(state_file);
+
+  //let the next server take over from this one
+	const char *restart_args[2] = {state_file, restart_path};
+	if (restart_path){
+		pthread_t restart_thread;
+		pthread_create(&restart_thread, NULL, hot_restart_loop, (void*)restart_args);
+	}
+
+  //run an accept loop per listener, each pinned to its own core
+	if (pipe(stop_accepting_pipe) < 0){
+		perror("could not create pipe");
+		return -1;
+	}
+	for (i = 0; i < num_listeners; i++){
+		if (pthread_create(&listener_threads[i], NULL, accept_loop, (void*)&server_sockets[i]) != 0){
+			perror("could not create listener thread");
+			return -1;
+		}
+		if (num_listeners > 1){
+			pin_to_allowed_cpu(listener_threads[i], i);
+		}
+	}
+	for (i = 0; i < num_pending; i++){
+		admit_client(pending_sockets[i]);
+	}
+
+  //print statistics on SIGUSR1 - from here rather than a handler, which could
+  //interrupt a printf holding the stdout lock - and drain and stop on SIGINT or SIGTERM
+	int stop_signal;
+	sigwait(&stop_signals, &stop_signal);
+	while (stop_signal == SIGUSR1){
+		print_server_stats(stop_signal);
+		sigwait(&stop_signals, &stop_signal);
+	}
+	printf("\nReceived %s\n", stop_signal == SIGINT ? "SIGINT" : "SIGTERM");
+	drain_server(state_file, -1);
+
+	return 1;
+}
+
+//accept clients on a server socket until it fails
+
+int setUpServer(char *bind_address, int socket_port_int, int backlog, bool reuse_port){
+	int socket_desc;
+    struct sockaddr_in server;
+
+    //Create socket
+    socket_desc = socket(AF_INET , SOCK_STREAM , 0);
+    if (socket_desc == -1)
+    {
+        printf("Could not create socket");
+        return -1;
+    }
+    printf("Socket created");
+
+    //let every listener bind the same address and port
+    int enable = 1;
+    if (reuse_port && setsockopt(socket_desc, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) < 0)
+    {
+        perror("SO_REUSEPORT failed. Error");
+        return -1;
+    }
+
+    //Prepare the sockaddr_in structure - assign IP address and port
+    server.sin_family = AF_INET;
+    server.sin_addr.s_addr = inet_addr( bind_address );
+    server.sin_port = htons( socket_port_int );
+
+    //Bind socket to server
+    if( bind(socket_desc,(struct sockaddr *)&server , sizeof(server)) < 0)
+    {
+        //print the error message
+        perror("bind failed. Error");
+        return -1;
+    }
+    printf("Socket binded");
+
+    if (listen(socket_desc, backlog) < 0)
+    {
+        perror("listen failed. Error");
+        return -1;
+    }
+
+    //accept loops poll the socket, and must not block if another takes the client first
+    fcntl(socket_desc, F_SETFL, fcntl(socket_desc, F_GETFL) | O_NONBLOCK);
+
+    //display server IP address and port to screen
+    printf("Server is running on IP address: %s\n", inet_ntoa(server.sin_addr));
+    printf("Server is running on port: %d\n", (int) ntohs(server.sin_port));
+
+    return socket_desc;
+}
+
+//admission control - at most max_sessions clients are served at once.
+//clients beyond that wait in a bounded queue for a handler to finish, and
+//once the queue is full new clients are told "limit" and dropped at once.
+typedef struct {
+	pthread_mutex_t mutex;
+	int max_sessions;
+	int active_sessions;
+	int max_pending;
+	int *pending;           //ring of accepted sockets waiting for a handler
+	int pending_head;
+	int num_pending;
+	pthread_cond_t sessions_done;   //signalled when the last session ends
+} Admission;
+
+Admission admission = {.mutex = PTHREAD_MUTEX_INITIALIZER, .sessions_done = PTHREAD_COND_INITIALIZER, .max_sessions = DEFAULT_MAX_SESSIONS, .max_pending = DEFAULT_MAX_PENDING};
+
+#define ADMIT_NOW 0
+#define ADMIT_QUEUED 1
+#define ADMIT_REJECTED 2
+
+void admission_init(int max_sessions, int max_pending){
+	admission.max_sessions = max_sessions > 0 ? max_sessions : 1;
+	admission.max_pending = max_pending > 0 ? max_pending : 0;
+	admission.pending = (int*)malloc((admission.max_pending + 1) * sizeof(int));
+	if (!admission.pending){
+		fprintf(stderr, "admission_init: out of memory\n");
+		exit(1);
+	}
+}
+
+//decide whether a newly accepted client gets a handler now, waits for one, or is turned away
+int admit_connection(int client_socket){
+	int admitted = ADMIT_REJECTED;
+	pthread_mutex_lock(&admission.mutex);
+	if (admission.active_sessions < admission.max_sessions){
+		admission.active_sessions++;
+		admitted = ADMIT_NOW;
+	} else if (admission.num_pending < admission.max_pending){
+		admission.pending[(admission.pending_head + admission.num_pending) % admission.max_pending] = client_socket;
+		admission.num_pending++;
+		admitted = ADMIT_QUEUED;
+	}
+	pthread_mutex_unlock(&admission.mutex);
+	return admitted;
+}
+
+//called as a handler finishes with a client. returns the next waiting client
+//for the handler to serve, or -1 after giving up the handler's session slot.
+int next_pending_session(void){
+	int client_socket = -1;
+	pthread_mutex_lock(&admission.mutex);
+	if (admission.num_pending > 0){
+		client_socket = admission.pending[admission.pending_head];
+		admission.pending_head = (admission.pending_head + 1) % admission.max_pending;
+		admission.num_pending--;
+	} else{
+		admission.active_sessions--;
+		if (admission.active_sessions == 0){
+			pthread_cond_broadcast(&admission.sessions_done);
+		}
+	}
+	pthread_mutex_unlock(&admission.mutex);
+	return client_socket;
+}
+
+//take every client still waiting for a handler out of the queue
+int take_pending_sessions(int *sockets, int max_sockets){
+	int num_sockets = 0;
+	pthread_mutex_lock(&admission.mutex);
+	while (admission.num_pending > 0){
+		int client_socket = admission.pending[admission.pending_head];
+		admission.pending_head = (admission.pending_head + 1) % admission.max_pending;
+		admission.num_pending--;
+		if (num_sockets < max_sockets){
+			sockets[num_sockets++] = client_socket;
+		} else{
+			close(client_socket);
+		}
+	}
+	pthread_mutex_unlock(&admission.mutex);
+	return num_sockets;
+}
+
+//wait until every handler has finished with its client
+void wait_for_sessions(void){
+	pthread_mutex_lock(&admission.mutex);
+	while (admission.active_sessions > 0){
+		pthread_cond_wait(&admission.sessions_done, &admission.mutex);
+	}
+	pthread_mutex_unlock(&admission.mutex);
+}
+
+//turn a client away without tying up a thread on it
+void reject_connection(int client_socket){
+	char *reply = "limit";
+	send(client_socket, reply, strlen(reply), MSG_DONTWAIT);
+	close(client_socket);
+	atomic_fetch_add(&stats.sessions_rejected, 1);
+}
+
+//per-client token buckets limiting how fast moves and leaderboard fetches are served
+typedef struct {
+	double tokens;
+	uint64_t last_refill;   //monotonic ns
+} TokenBucket;
+
+typedef struct {
+	TokenBucket moves;
+	TokenBucket leaderboard;
+} ClientLimits;
+
+//limits of the client this handler thread is serving
+__thread ClientLimits *client_limits;
+
+void reset_client_limits(void){
+	uint64_t now = monotonic_ns();
+	client_limits->moves = (TokenBucket){.tokens = MOVE_BURST, .last_refill = now};
+	client_limits->leaderboard = (TokenBucket){.tokens = LEADERBOARD_BURST, .last_refill = now};
+}
+
+//refill a bucket for the time since it was last used, then take a token if there is one
+bool take_token(TokenBucket *bucket, double rate, double burst){
+	uint64_t now = monotonic_ns();
+	bucket->tokens += (now - bucket->last_refill) / 1e9 * rate;
+	if (bucket->tokens > burst){
+		bucket->tokens = burst;
+	}
+	bucket->last_refill = now;
+	if (bucket->tokens < 1.0){
+		return false;
+	}
+	bucket->tokens -= 1.0;
+	return true;
+}
+
+//idle timeouts. every client being served has a timer in a hierarchical
+//timing wheel, re-armed each time the server starts waiting on the client.
+//when a timer fires the client's socket is shut down, so whichever recv the
+//handler is blocked in returns and the handler cleans up as for a dropped client.
+typedef struct idle_timer {
+	uint64_t expires;           //tick the timer fires on
+	int client_socket;
+	bool armed;
+	struct idle_timer *prev;    //neighbours in the timer's slot
+	struct idle_timer *next;
+} IdleTimer;
+
+//each slot is a circular list headed by a dummy timer, so arming and
+//cancelling a timer are O(1) however many are in the wheel. level 0 holds
+//timers due within TIMER_WHEEL_SLOTS ticks, and each level above covers
+//TIMER_WHEEL_SLOTS times as long. timers are cascaded down a level when
+//the level below wraps around.
+typedef struct {
+	pthread_mutex_t mutex;
+	uint64_t now;               //current tick
+	bool draining;              //the server is shutting down - time out at once
+	IdleTimer slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+} TimerWheel;
+
+TimerWheel timer_wheel = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+//timer of the client this handler thread is serving
+__thread IdleTimer *client_timer;
+
+void timer_wheel_init(void){
+	for (int level = 0; level < TIMER_WHEEL_LEVELS; level++){
+		for (int slot = 0; slot < TIMER_WHEEL_SLOTS; slot++){
+			IdleTimer *head = &timer_wheel.slots[level][slot];
+			head->prev = head;
+			head->next = head;
+		}
+	}
+	timer_wheel.now = monotonic_ns() / (TIMER_TICK_MS * 1000000ULL);
+}
+
+//link a timer into the slot for its expiry. called with the wheel locked.
+static void timer_wheel_add(IdleTimer *timer){
+	uint64_t delta = timer->expires - timer_wheel.now;
+	int level = 0;
+	while (level < TIMER_WHEEL_LEVELS - 1 && delta >= (1ULL << (TIMER_WHEEL_BITS * (level + 1)))){
+		level++;
+	}
+	IdleTimer *head = &timer_wheel.slots[level][(timer->expires >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1)];
+	timer->prev = head->prev;
+	timer->next = head;
+	head->prev->next = timer;
+	head->prev = timer;
+}
+
+static void timer_wheel_unlink(IdleTimer *timer){
+	timer->prev->next = timer->next;
+	timer->next->prev = timer->prev;
+}
+
+//move every timer in a slot down to the slots for its remaining time
+static void timer_wheel_cascade(int level, int slot){
+	IdleTimer *head = &timer_wheel.slots[level][slot];
+	IdleTimer *timer = head->next;
+	head->prev = head;
+	head->next = head;
+	while (timer != head){
+		IdleTimer *next = timer->next;
+		timer_wheel_add(timer);
+		timer = next;
+	}
+}
+
+//disconnect the client a timer belongs to
+static void timer_fire(IdleTimer *timer){
+	timer_wheel_unlink(timer);
+	timer->armed = false;
+	shutdown(timer->client_socket, SHUT_RDWR);
+}
+
+//advance the wheel one tick and fire the timers that are due
+static void timer_wheel_tick(void){
+	timer_wheel.now++;
+	for (int level = 1; level < TIMER_WHEEL_LEVELS; level++){
+		if ((timer_wheel.now & ((1ULL << (TIMER_WHEEL_BITS * level)) - 1)) != 0){
+			break;
+		}
+		timer_wheel_cascade(level, (timer_wheel.now >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1));
+	}
+
+	IdleTimer *head = &timer_wheel.slots[0][timer_wheel.now & (TIMER_WHEEL_SLOTS - 1)];
+	while (head->next != head){
+		timer_fire(head->next);
+		atomic_fetch_add(&stats.sessions_timed_out, 1);
+		puts("client idle for too long, disconnecting");
+	}
+}
+
+void *timer_wheel_loop(void *data){
+	(void)data;
+	struct timespec next_tick;
+	clock_gettime(CLOCK_MONOTONIC, &next_tick);
+	while (1){
+		next_tick.tv_nsec += TIMER_TICK_MS * 1000000L;
+		if (next_tick.tv_nsec >= 1000000000L){
+			next_tick.tv_sec++;
+			next_tick.tv_nsec -= 1000000000L;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next_tick, NULL);
+
+		//catch up on any ticks missed while the thread was held up
+		uint64_t tick = monotonic_ns() / (TIMER_TICK_MS * 1000000ULL);
+		pthread_mutex_lock(&timer_wheel.mutex);
+		while (timer_wheel.now < tick){
+			timer_wheel_tick();
+		}
+		pthread_mutex_unlock(&timer_wheel.mutex);
+	}
+	return NULL;
+}
+
+//(re)start the idle timeout of the client this thread is serving
+void arm_idle_timeout(int client_socket, int seconds){
+	if (seconds <= 0){
+		cancel_idle_timeout();
+		return;
+	}
+	uint64_t ticks = (seconds * 1000ULL + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+	uint64_t max_ticks = (1ULL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1;
+	pthread_mutex_lock(&timer_wheel.mutex);
+	if (timer_wheel.draining){
+		shutdown(client_socket, SHUT_RDWR);
+		pthread_mutex_unlock(&timer_wheel.mutex);
+		return;
+	}
+	if (client_timer->armed){
+		timer_wheel_unlink(client_timer);
+	}
+	client_timer->client_socket = client_socket;
+	client_timer->expires = timer_wheel.now + (ticks < max_ticks ? ticks : max_ticks);
+	client_timer->armed = true;
+	timer_wheel_add(client_timer);
+	pthread_mutex_unlock(&timer_wheel.mutex);
+}
+
+void cancel_idle_timeout(void){
+	pthread_mutex_lock(&timer_wheel.mutex);
+	if (client_timer->armed){
+		timer_wheel_unlink(client_timer);
+		client_timer->armed = false;
+	}
+	pthread_mutex_unlock(&timer_wheel.mutex);
+}
+
+//disconnect every client being served, and any that start waiting from now on.
+//games in progress are suspended, so their clients can resume them later.
+void expire_all_idle_timeouts(void){
+	pthread_mutex_lock(&timer_wheel.mutex);
+	timer_wheel.draining = true;
+	for (int level = 0; level < TIMER_WHEEL_LEVELS; level++){
+		for (int slot = 0; slot < TIMER_WHEEL_SLOTS; slot++){
+			IdleTimer *head = &timer_wheel.slots[level][slot];
+			while (head->next != head){
+				timer_fire(head->next);
+			}
+		}
+	}
+	pthread_mutex_unlock(&timer_wheel.mutex);
+}
+
+void stop_accepting(void){
+	char stop = 1;
+	if (write(stop_accepting_pipe[1], &stop, 1) != 1){
+		perror("could not stop accepting");
+	}
+	for (int i = 0; i < num_listeners; i++){
+		pthread_join(listener_threads[i], NULL);
+	}
+}
+
+//save the leaderboard, every user's games won and played and the suspended
+//games to the state file. users are saved by name so the file still loads
+//if Authentication.txt gains users.
+static void write_name(FILE *fp, const char *name){
+	uint8_t length = strlen(name);
+	fwrite(&length, 1, 1, fp);
+	fwrite(name, 1, length, fp);
+}
+
+static int read_name(FILE *fp){
+	uint8_t length;
+	char name[256];
+	if (fread(&length, 1, 1, fp) != 1 || fread(name, 1, length, fp) != length){
+		return -2;
+	}
+	name[length] = '\0';
+	for (int i = 0; i < num_users; i++){
+		if (strcmp(users[i].name, name) == 0){
+			return i;
+		}
+	}
+	return -1;
+}
+
+bool save_server_state(const char *state_file){
+	char temp_file[300];
+	snprintf(temp_file, sizeof(temp_file), "%s.tmp", state_file);
+	FILE *fp = fopen(temp_file, "wb");
+	if (!fp){
+		perror("could not save server state");
+		return false;
+	}
+	uint8_t header[3] = {STATE_MAGIC_0, STATE_MAGIC_1, STATE_VERSION};
+	fwrite(header, 1, sizeof(header), fp);
+
+	uint32_t count = num_users;
+	fwrite(&count, sizeof(count), 1, fp);
+	for (int i = 0; i < num_users; i++){
+		uint32_t counters[2] = {user_games_won(&users[i]), user_games_played(&users[i])};
+		write_name(fp, users[i].name);
+		fwrite(counters, sizeof(counters), 1, fp);
+	}
+
+	pthread_mutex_lock(&lb_mutex);
+	count = num_leaderboard_entries;
+	fwrite(&count, sizeof(count), 1, fp);
+	for (entry *p = head; p; p = p->next){
+		uint16_t board[3] = {p->width, p->height, p->num_mines};
+		int64_t won_at = p->won_at;
+		write_name(fp, p->user->name);
+		fwrite(&p->time_taken, sizeof(p->time_taken), 1, fp);
+		fwrite(board, sizeof(board), 1, fp);
+		fwrite(&won_at, sizeof(won_at), 1, fp);
+	}
+	pthread_mutex_unlock(&lb_mutex);
+
+	//oldest first, so loading them in order rebuilds the same lru list
+	pthread_mutex_lock(&session_mutex);
+	count = num_suspended_sessions;
+	fwrite(&count, sizeof(count), 1, fp);
+	for (SuspendedSession *p = session_lru_tail; p; p = p->lru_prev){
+		uint8_t blob_size = p->blob_size;
+		GameSession session;
+		//the blob holds the user's index, which only means anything to this server
+		write_name(fp, deserialize_session(p->blob, p->blob_size, &session) && session.user < num_users
+			? users[session.user].name : "");
+		fwrite(p->token, 1, SESSION_TOKEN_BYTES, fp);
+		fwrite(&blob_size, 1, 1, fp);
+		fwrite(p->blob, 1, blob_size, fp);
+	}
+	pthread_mutex_unlock(&session_mutex);
+
+	bool saved = fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+	fclose(fp);
+	if (!saved || rename(temp_file, state_file) != 0){
+		perror("could not save server state");
+		return false;
+	}
+	return true;
+}
+
+//load the state saved by the last server to shut down, then remove the file
+//so the same suspended games can't be loaded twice
+void load_server_state(const char *state_file){
+	FILE *fp = fopen(state_file, "rb");
+	if (!fp){
+		return;
+	}
+	uint8_t header[3];
+	uint32_t count;
+	bool valid = fread(header, 1, sizeof(header), fp) == sizeof(header) && header[0] == STATE_MAGIC_0
+		&& header[1] == STATE_MAGIC_1 && header[2] == STATE_VERSION;
+
+	//games won and played
+	valid = valid && fread(&count, sizeof(count), 1, fp) == 1;
+	for (uint32_t i = 0; valid && i < count; i++){
+		uint32_t counters[2];
+		int user = read_name(fp);
+		valid = user > -2 && fread(counters, sizeof(counters), 1, fp) == 1;
+		if (valid && user >= 0){
+			atomic_fetch_add(&thread_stats_shard()[user].num_games_won, counters[0]);
+			atomic_fetch_add(&thread_stats_shard()[user].num_games_played, counters[1]);
+		}
+	}
+
+	//leaderboard, already in order so entries are appended
+	valid = valid && fread(&count, sizeof(count), 1, fp) == 1;
+	for (uint32_t i = 0; valid && i < count; i++){
+		uint64_t time_taken;
+		uint16_t board[3];
+		int64_t won_at;
+		int user = read_name(fp);
+		valid = user > -2 && fread(&time_taken, sizeof(time_taken), 1, fp) == 1
+			&& fread(board, sizeof(board), 1, fp) == 1 && fread(&won_at, sizeof(won_at), 1, fp) == 1;
+		if (valid && user >= 0){
+			entry *p = (entry *)malloc(sizeof(entry));
+			p->user = &users[user];
+			p->time_taken = time_taken;
+			p->won_at = won_at;
+			p->width = board[0];
+			p->height = board[1];
+			p->num_mines = board[2];
+			insert_entry(p, true);
+			num_leaderboard_entries++;
+		}
+	}
+
+	//suspended games, given back to their users by name. a game of a user
+	//no longer in Authentication.txt is dropped.
+	int num_sessions = 0;
+	valid = valid && fread(&count, sizeof(count), 1, fp) == 1;
+	for (uint32_t i = 0; valid && i < count; i++){
+		uint8_t blob[SESSION_BLOB_MAX], blob_size;
+		GameSession session;
+		int user = read_name(fp);
+		valid = user > -2 && fread(session.token, 1, SESSION_TOKEN_BYTES, fp) == SESSION_TOKEN_BYTES
+			&& fread(&blob_size, 1, 1, fp) == 1 && blob_size <= SESSION_BLOB_MAX
+			&& fread(blob, 1, blob_size, fp) == blob_size;
+		if (valid && user >= 0 && deserialize_session(blob, blob_size, &session)){
+			session.user = user;
+			suspend_session(&session);
+			num_sessions++;
+		}
+	}
+	fclose(fp);
+
+	if (!valid){
+		printf("server state in %s is damaged, loaded what could be read\n", state_file);
+	}
+	printf("Loaded %d leaderboard entries and %d suspended games from %s\n", num_leaderboard_entries, num_sessions, state_file);
+	unlink(state_file);
+}
+
+//a new server taking over from this one is sent the listening sockets,
+//the clients waiting for a handler and the key login tokens are signed with
+typedef struct {
+	int num_listeners;
+	int num_pending;
+	uint8_t login_token_secret[SHA256_BYTES];
+} Handover;
+
+//stop the server without losing state. accepting stops first, clients
+//still queued for a handler are kept for the next server, and every client
+//being served is disconnected - games in progress are suspended so they can
+//be resumed. once every handler has finished the replay log and the state
+//file are written. if a new server is taking over it is sent the sockets
+//once the state file is ready, so it never loads stale state.
+atomic_bool draining_server = false;
+
+void drain_server(const char *state_file, int takeover_socket){
+	if (atomic_exchange(&draining_server, true)){
+		//a second request to stop while draining stops at once
+		exit(1);
+	}
+	puts("Shutting down, draining sessions...");
+	stop_accepting();
+
+	int pending_sockets[MAX_HANDOVER_PENDING];
+	int num_pending = take_pending_sessions(pending_sockets, takeover_socket >= 0 ? MAX_HANDOVER_PENDING : 0);
+
+	expire_all_idle_timeouts();
+	wait_for_sessions();
+	flush_replays();
+	save_server_state(state_file);
+	print_server_stats(0);
+
+	if (takeover_socket >= 0){
+		Handover handover = {.num_listeners = num_listeners, .num_pending = num_pending};
+		memcpy(handover.login_token_secret, login_token_secret, SHA256_BYTES);
+		int fds[MAX_LISTENERS + MAX_HANDOVER_PENDING];
+		memcpy(fds, server_sockets, num_listeners * sizeof(int));
+		memcpy(&fds[num_listeners], pending_sockets, num_pending * sizeof(int));
+
+		struct iovec iov = {.iov_base = &handover, .iov_len = sizeof(handover)};
+		union {
+			char buffer[CMSG_SPACE(sizeof(fds))];
+			struct cmsghdr align;
+		} control;
+		struct msghdr message = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control.buffer,
+		                         .msg_controllen = CMSG_SPACE((num_listeners + num_pending) * sizeof(int))};
+		struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN((num_listeners + num_pending) * sizeof(int));
+		memcpy(CMSG_DATA(cmsg), fds, (num_listeners + num_pending) * sizeof(int));
+		if (sendmsg(takeover_socket, &message, 0) < 0){
+			perror("could not hand over to the new server");
+			exit(1);
+		}
+		printf("Handed %d listeners and %d waiting clients to the new server\n", num_listeners, num_pending);
+	}
+	puts("Server stopped");
+	exit(0);
+}
+
+//wait for a new server to connect to the hot restart socket and hand over to it
+void *hot_restart_loop(void *data){
+	const char *state_file = ((const char**)data)[0];
+	const char *restart_path = ((const char**)data)[1];
+	struct sockaddr_un address = {.sun_family = AF_UNIX};
+	strncpy(address.sun_path, restart_path, sizeof(address.sun_path) - 1);
+
+	int restart_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+	unlink(restart_path);
+	if (restart_socket < 0 || bind(restart_socket, (struct sockaddr*)&address, sizeof(address)) < 0
+		|| listen(restart_socket, 1) < 0){
+		perror("could not open hot restart socket");
+		return NULL;
+	}
+	int takeover_socket = accept(restart_socket, NULL, NULL);
+	if (takeover_socket < 0){
+		perror("hot restart accept failed");
+		return NULL;
+	}
+	puts("New server is taking over");
+	drain_server(state_file, takeover_socket);
+	return NULL;
+}
+
+//take over from a server already running on the hot restart socket. blocks
+//until the old server has drained, then fills in its listening sockets,
+//waiting clients and login token key. returns false if no server is running.
+bool hot_restart_takeover(const char *restart_path, int *pending_sockets, int *num_pending, uint8_t secret[SHA256_BYTES]){
+	struct sockaddr_un address = {.sun_family = AF_UNIX};
+	strncpy(address.sun_path, restart_path, sizeof(address.sun_path) - 1);
+	int takeover_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (takeover_socket < 0 || connect(takeover_socket, (struct sockaddr*)&address, sizeof(address)) < 0){
+		if (takeover_socket >= 0){
+			close(takeover_socket);
+		}
+		return false;
+	}
+	puts("Taking over from the running server...");
+
+	Handover handover;
+	int fds[MAX_LISTENERS + MAX_HANDOVER_PENDING];
+	struct iovec iov = {.iov_base = &handover, .iov_len = sizeof(handover)};
+	union {
+		char buffer[CMSG_SPACE(sizeof(fds))];
+		struct cmsghdr align;
+	} control;
+	struct msghdr message = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control.buffer, .msg_controllen = sizeof(control.buffer)};
+	ssize_t size = recvmsg(takeover_socket, &message, MSG_WAITALL);
+	close(takeover_socket);
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+	if (size != sizeof(handover) || !cmsg || cmsg->cmsg_type != SCM_RIGHTS
+		|| handover.num_listeners < 1 || handover.num_listeners > MAX_LISTENERS
+		|| handover.num_pending < 0 || handover.num_pending > MAX_HANDOVER_PENDING
+		|| cmsg->cmsg_len != CMSG_LEN((handover.num_listeners + handover.num_pending) * sizeof(int))){
+		fprintf(stderr, "hot restart handover failed\n");
+		exit(1);
+	}
+	memcpy(fds, CMSG_DATA(cmsg), (handover.num_listeners + handover.num_pending) * sizeof(int));
+
+	num_listeners = handover.num_listeners;
+	memcpy(server_sockets, fds, num_listeners * sizeof(int));
+	*num_pending = handover.num_pending;
+	memcpy(pending_sockets, &fds[num_listeners], *num_pending * sizeof(int));
+	memcpy(secret, handover.login_token_secret, SHA256_BYTES);
+	printf("Took over %d listeners and %d waiting clients\n", num_listeners, *num_pending);
+	return true;
+}
+
+//send small writes straight away. most steps are answered with a few small
+//sends, which would otherwise wait on the client's delayed ack. only tcp
+//sockets have the option, so it fails harmlessly on a multiplexed stream's.
+void set_nodelay(int sock){
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+//start a handler for a newly connected client, queue it, or turn it away
+void admit_client(int client_socket){
+    pthread_t thread_id;
+    set_nodelay(client_socket);
+    //only start a handler if the client is admitted straight away
+    int admitted = admit_connection(client_socket);
+    if (admitted == ADMIT_REJECTED){
+      reject_connection(client_socket);
+      return;
+    } else if (admitted == ADMIT_QUEUED){
+      atomic_fetch_add(&stats.sessions_queued, 1);
+      return;
+    }
+	  add_request(10, &req_mutex, &got_request);
+    if (num_fiber_workers > 0){
+      start_session_fiber(client_socket);
+      return;
+    }
+    //each handler gets its own copy of the socket, as the next accept reuses client_socket
+    int *handler_socket = (int*)malloc(sizeof(int));
+    *handler_socket = client_socket;
+  	if (pthread_create(&thread_id, NULL, connection_handler, (void*)handler_socket) != 0){
+  		perror("could not create socket");
+  		exit(-1);
+  	}
+  	puts("Hanfler assigned");
+}
+
+//pin a thread to the nth of the cores the server may run on, which need not be
+//numbered from 0 or without gaps, wrapping around if there are fewer
+void pin_to_allowed_cpu(pthread_t thread, int n){
+	cpu_set_t allowed, cpus;
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0 || CPU_COUNT(&allowed) == 0){
+		return;
+	}
+	n %= CPU_COUNT(&allowed);
+	for (int cpu = 0; cpu < CPU_SETSIZE; cpu++){
+		if (CPU_ISSET(cpu, &allowed) && n-- == 0){
+			CPU_ZERO(&cpus);
+			CPU_SET(cpu, &cpus);
+			pthread_setaffinity_np(thread, sizeof(cpus), &cpus);
+			return;
+		}
+	}
+}
+
+//wait before accepting again, returning true if the server has stopped accepting meanwhile
+bool accept_backoff(void){
+	struct pollfd stop = {.fd = stop_accepting_pipe[0], .events = POLLIN};
+	return poll(&stop, 1, ACCEPT_BACKOFF_MS) > 0;
+}
+
+//accept clients until the server stops accepting. listening sockets are
+//non-blocking, so a client taken by another listener or process is skipped.
+//other failures, such as running out of file descriptors in a burst of
+//connections, are waited out rather than taking the server down.
+int connectToClient(int server_socket){
+	int client_socket, c;
+    struct sockaddr_in client;
+
+    puts("Please run the client in another terminal...");
+
+    //Accept an incoming connection
+    c = sizeof(struct sockaddr_in);
+
+    while (1){
+      struct pollfd fds[2] = {{.fd = server_socket, .events = POLLIN}, {.fd = stop_accepting_pipe[0], .events = POLLIN}};
+      if (poll(fds, 2, -1) < 0){
+        if (errno != EINTR){
+          perror("poll failed");
+          if (accept_backoff()){
+            return 0;
+          }
+        }
+        continue;
+      }
+      if (fds[1].revents){
+        return 0;
+      }
+      client_socket = accept(server_socket, (struct sockaddr *)&client, (socklen_t*)&c);
+      if (client_socket < 0){
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR || errno == ECONNABORTED){
+          continue;
+        }
+        perror("accept failed");
+        if (accept_backoff()){
+          return 0;
+        }
+        continue;
+      }
+    	puts("Connected accepted");
+      admit_client(client_socket);
+    }
+}
+
+void *accept_loop(void *data){
+	int server_socket = *(int*)data;
+	//connect to client sockets until the server stops accepting
+	connectToClient(server_socket);
+	return NULL;
+}
+
+
+/* a multiplexed connection is split into streams by a relay thread of its   */
+/* own. each stream's session runs on one end of a socketpair, admitted and  */
+/* served exactly like a newly accepted client, and the relay moves frames   */
+/* between the connection and the other ends. a session that stops reading  */
+/* only fills its own buffer, so the other streams carry on past it.         */
+typedef struct {
+    uint32_t id;                /* 0 if the slot is free                    */
+    int fd;                     /* relay's end of the session's socketpair  */
+    uint8_t *pending;           /* from the client, not yet taken by the session */
+    size_t pending_length;
+} MuxStream;
+
+typedef struct {
+    int client_socket;
+    MuxStream streams[MUX_MAX_STREAMS];
+    uint8_t input[sizeof(MuxHeader) + UINT16_MAX];  /* frame being received */
+    size_t input_length;
+    uint8_t *output;            /* frames waiting to go to the client       */
+    size_t output_length;
+    size_t output_capacity;
+    uint64_t last_heard;        /* monotonic ns */
+    bool ping_sent;
+    bool out_of_memory;         /* a frame couldn't be queued, so the connection is dropped */
+} MuxConnection;
+
+//queue a frame for the client. if there isn't the memory, the connection is
+//marked to be dropped, since the frame can't be left out of the stream
+static void mux_queue(MuxConnection *mux, uint32_t stream, uint8_t type, const void *data, uint16_t length){
+	size_t size = sizeof(MuxHeader) + length;
+	if (mux->output_length + size > mux->output_capacity){
+		size_t capacity = mux->output_capacity ? mux->output_capacity * 2 : 64 * 1024;
+		while (capacity < mux->output_length + size){
+			capacity *= 2;
+		}
+		uint8_t *output = (uint8_t*)realloc(mux->output, capacity);
+		if (!output){
+			fprintf(stderr, "mux_queue: out of memory\n");
+			mux->out_of_memory = true;
+			return;
+		}
+		mux->output = output;
+		mux->output_capacity = capacity;
+	}
+	MuxHeader header = {.stream = stream, .type = type, .length = length};
+	memcpy(&mux->output[mux->output_length], &header, sizeof(MuxHeader));
+	if (length > 0){
+		memcpy(&mux->output[mux->output_length + sizeof(MuxHeader)], data, length);
+	}
+	mux->output_length += size;
+}
+
+static MuxStream *mux_find_stream(MuxConnection *mux, uint32_t id){
+	for (int i = 0; i < MUX_MAX_STREAMS; i++){
+		if (mux->streams[i].id == id){
+			return &mux->streams[i];
+		}
+	}
+	return NULL;
+}
+
+//end a stream, closing the session's connection. the client is told unless it
+//closed the stream itself.
+static void mux_close_stream(MuxConnection *mux, MuxStream *stream, bool tell_client){
+	if (tell_client){
+		mux_queue(mux, stream->id, MUX_CLOSE, NULL, 0);
+	}
+	close(stream->fd);
+	free(stream->pending);
+	*stream = (MuxStream){.id = 0, .fd = -1};
+}
+
+//start a session on a new stream, or close it straight back if it can't be
+static void mux_open_stream(MuxConnection *mux, uint32_t id){
+	MuxStream *stream = id != 0 && mux_find_stream(mux, id) == NULL ? mux_find_stream(mux, 0) : NULL;
+	int pair[2];
+	if (stream == NULL || atomic_load(&draining_server) || socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) < 0){
+		mux_queue(mux, id, MUX_CLOSE, NULL, 0);
+		return;
+	}
+	fcntl(pair[0], F_SETFL, fcntl(pair[0], F_GETFL) | O_NONBLOCK);
+	*stream = (MuxStream){.id = id, .fd = pair[0]};
+	atomic_fetch_add(&stats.mux_streams, 1);
+	admit_client(pair[1]);
+}
+
+//pass data from the client to a stream's session, holding on to what it
+//can't take yet. a session too far behind has its stream reset.
+static void mux_deliver(MuxConnection *mux, MuxStream *stream, const uint8_t *data, size_t length){
+	if (stream->pending_length == 0){
+		ssize_t sent = send(stream->fd, data, length, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK){
+			mux_close_stream(mux, stream, true);
+			return;
+		}
+		if (sent > 0){
+			data += sent;
+			length -= sent;
+		}
+	}
+	if (length == 0){
+		return;
+	}
+	if (stream->pending_length + length > MUX_STREAM_BUFFER){
+		mux_close_stream(mux, stream, true);
+		return;
+	}
+	uint8_t *pending = (uint8_t*)realloc(stream->pending, stream->pending_length + length);
+	if (!pending){
+		mux_close_stream(mux, stream, true);
+		return;
+	}
+	memcpy(&pending[stream->pending_length], data, length);
+	stream->pending = pending;
+	stream->pending_length += length;
+}
+
+//act on a whole frame from the client
+static void mux_handle_frame(MuxConnection *mux, const MuxHeader *header, const uint8_t *payload){
+	MuxStream *stream = header->stream != 0 ? mux_find_stream(mux, header->stream) : NULL;
+	if (header->type == MUX_OPEN){
+		mux_open_stream(mux, header->stream);
+	} else if (header->type == MUX_DATA && stream != NULL){
+		mux_deliver(mux, stream, payload, header->length);
+	} else if (header->type == MUX_CLOSE && stream != NULL){
+		mux_close_stream(mux, stream, false);
+	} else if (header->type == MUX_PING){
+		mux_queue(mux, header->stream, MUX_PONG, payload, header->length);
+	}
+	//data for a stream that has just closed, and pongs, need nothing doing
+}
+
+//relay between a multiplexed connection and its streams' sessions until the
+//client goes away or stops answering keepalives
+void *mux_loop(void *data){
+	MuxConnection *mux = (MuxConnection*)data;
+	pthread_detach(pthread_self());
+	//the hello is echoed to say frames can follow
+	fcntl(mux->client_socket, F_SETFL, fcntl(mux->client_socket, F_GETFL) & ~O_NONBLOCK);
+	if (send(mux->client_socket, MUX_HELLO, MUX_HELLO_LENGTH, MSG_NOSIGNAL) != MUX_HELLO_LENGTH){
+		close(mux->client_socket);
+		free(mux);
+		return NULL;
+	}
+	fcntl(mux->client_socket, F_SETFL, fcntl(mux->client_socket, F_GETFL) | O_NONBLOCK);
+	mux->last_heard = monotonic_ns();
+
+	bool connected = true;
+	while (connected && !mux->out_of_memory){
+		struct pollfd fds[MUX_MAX_STREAMS + 1];
+		MuxStream *polled[MUX_MAX_STREAMS + 1];
+		int num_fds = 1;
+		//the client isn't read from either while it is slow to take what it's sent,
+		//since its pings and opens queue frames for it too
+		bool reading = mux->output_length < MUX_OUTPUT_BUFFER;
+		fds[0] = (struct pollfd){.fd = mux->client_socket, .events = (reading ? POLLIN : 0) | (mux->output_length > 0 ? POLLOUT : 0)};
+		for (int i = 0; i < MUX_MAX_STREAMS; i++){
+			MuxStream *stream = &mux->streams[i];
+			if (stream->id == 0){
+				continue;
+			}
+			//the sessions wait while the client is slow to take their output
+			short events = (reading ? POLLIN : 0) | (stream->pending_length > 0 ? POLLOUT : 0);
+			polled[num_fds] = stream;
+			fds[num_fds++] = (struct pollfd){.fd = stream->fd, .events = events};
+		}
+		if (poll(fds, num_fds, MUX_KEEPALIVE_MS / 4) < 0 && errno != EINTR){
+			perror("mux_loop");
+			break;
+		}
+
+		//ping a quiet client, and give up on one that doesn't answer
+		uint64_t quiet_ms = (monotonic_ns() - mux->last_heard) / 1000000;
+		if (quiet_ms > 3 * MUX_KEEPALIVE_MS){
+			break;
+		} else if (quiet_ms > MUX_KEEPALIVE_MS && !mux->ping_sent){
+			mux_queue(mux, 0, MUX_PING, NULL, 0);
+			mux->ping_sent = true;
+		}
+
+		if (reading && (fds[0].revents & (POLLIN | POLLHUP | POLLERR))){
+			ssize_t read_size = recv(mux->client_socket, &mux->input[mux->input_length], sizeof(mux->input) - mux->input_length, 0);
+			if (read_size == 0 || (read_size < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)){
+				break;
+			}
+			if (read_size > 0){
+				mux->input_length += read_size;
+				mux->last_heard = monotonic_ns();
+				mux->ping_sent = false;
+			}
+			//handle every whole frame received
+			size_t used = 0;
+			MuxHeader header;
+			while (mux->input_length - used >= sizeof(MuxHeader)){
+				memcpy(&header, &mux->input[used], sizeof(MuxHeader));
+				if (mux->input_length - used < sizeof(MuxHeader) + header.length){
+					break;
+				}
+				mux_handle_frame(mux, &header, &mux->input[used + sizeof(MuxHeader)]);
+				used += sizeof(MuxHeader) + header.length;
+			}
+			memmove(mux->input, &mux->input[used], mux->input_length - used);
+			mux->input_length -= used;
+		}
+
+		for (int i = 1; i < num_fds; i++){
+			MuxStream *stream = polled[i];
+			//the stream may have been closed by a frame handled above
+			if (stream->fd != fds[i].fd || fds[i].revents == 0){
+				continue;
+			}
+			if (stream->pending_length > 0 && (fds[i].revents & POLLOUT)){
+				ssize_t sent = send(stream->fd, stream->pending, stream->pending_length, MSG_DONTWAIT | MSG_NOSIGNAL);
+				if (sent > 0){
+					memmove(stream->pending, &stream->pending[sent], stream->pending_length - sent);
+					stream->pending_length -= sent;
+				}
+			}
+			if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)){
+				uint8_t buffer[16 * 1024];
+				ssize_t read_size = recv(stream->fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+				if (read_size > 0){
+					mux_queue(mux, stream->id, MUX_DATA, buffer, read_size);
+				} else if (read_size == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)){
+					//the session has finished
+					mux_close_stream(mux, stream, true);
+				}
+			}
+		}
+
+		while (mux->output_length > 0){
+			ssize_t sent = send(mux->client_socket, mux->output, mux->output_length, MSG_DONTWAIT | MSG_NOSIGNAL);
+			if (sent < 0){
+				connected = errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+				break;
+			}
+			memmove(mux->output, &mux->output[sent], mux->output_length - sent);
+			mux->output_length -= sent;
+		}
+	}
+
+	//the sessions see their connections close and finish up
+	for (int i = 0; i < MUX_MAX_STREAMS; i++){
+		if (mux->streams[i].id != 0){
+			mux_close_stream(mux, &mux->streams[i], false);
+		}
+	}
+	close(mux->client_socket);
+	free(mux->output);
+	free(mux);
+	return NULL;
+}
+
+//hand a connection that asked to be multiplexed to a relay thread
+void start_mux_connection(int client_socket){
+	MuxConnection *mux = (MuxConnection*)calloc(1, sizeof(MuxConnection));
+	pthread_t thread_id;
+	if (!mux){
+		fprintf(stderr, "start_mux_connection: out of memory\n");
+		close(client_socket);
+		return;
+	}
+	mux->client_socket = client_socket;
+	for (int i = 0; i < MUX_MAX_STREAMS; i++){
+		mux->streams[i].fd = -1;
+	}
+	atomic_fetch_add(&stats.mux_connections, 1);
+	if (pthread_create(&thread_id, NULL, mux_loop, mux) != 0){
+		perror("start_mux_connection");
+		close(client_socket);
+		free(mux);
+	}
+}
+
+
+//with -F, sessions run as fibers on a few worker threads instead of a thread
+//each. a worker switches to another of its fibers whenever the one running
+//would block, and waits for any of them to be ready with epoll. the session
+//code is the same straight-line code a handler thread runs - only the net_
+//functions and session_wait know the difference.
+typedef struct fiber_worker FiberWorker;
+
+typedef struct fiber {
+	ucontext_t context;
+	uint8_t *stack;             //FIBER_STACK_SIZE bytes above a guard page
+	FiberWorker *worker;
+	int client_socket;
+	bool finished;
+	ClientLimits limits;        //the session's rate limits and idle timer,
+	IdleTimer timer;            //which a handler thread keeps on its stack
+	struct fiber *next;         //in the worker's incoming or free list
+} Fiber;
+
+struct fiber_worker {
+	pthread_t thread;
+	int epoll_fd;
+	int wake_fd;                //eventfd written when a session is handed over
+	pthread_mutex_t mutex;
+	Fiber *incoming;            //sessions to start, guarded by mutex
+	Fiber *free_fibers;         //finished fibers kept with their stacks, guarded by mutex
+	ucontext_t scheduler;
+	atomic_int num_fibers;
+};
+
+FiberWorker *fiber_workers = NULL;
+__thread Fiber *current_fiber = NULL;
+
+//a fiber for a new session, reusing a finished one and its stack if there is one
+Fiber *fiber_alloc(FiberWorker *worker){
+	pthread_mutex_lock(&worker->mutex);
+	Fiber *fiber = worker->free_fibers;
+	if (fiber != NULL){
+		worker->free_fibers = fiber->next;
+	}
+	pthread_mutex_unlock(&worker->mutex);
+	if (fiber != NULL){
+		return fiber;
+	}
+
+	fiber = (Fiber*)calloc(1, sizeof(Fiber));
+	long page_size = sysconf(_SC_PAGESIZE);
+	uint8_t *mapping = (uint8_t*)mmap(NULL, page_size + FIBER_STACK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+	//an overflow hits the guard page instead of the fiber below it
+	if (!fiber || mapping == MAP_FAILED || mprotect(mapping, page_size, PROT_NONE) < 0){
+		perror("fiber_alloc");
+		exit(1);
+	}
+	fiber->stack = mapping + page_size;
+	fiber->worker = worker;
+	atomic_fetch_add(&stats.fiber_stacks, 1);
+	return fiber;
+}
+
+//yield until fd is ready for events. the fd stays registered with the worker's
+//epoll, disabled, until it is closed or waited on again.
+bool fiber_wait(int fd, uint32_t events){
+	Fiber *fiber = current_fiber;
+	struct epoll_event event = {.events = events | EPOLLONESHOT, .data.ptr = fiber};
+	if (epoll_ctl(fiber->worker->epoll_fd, EPOLL_CTL_MOD, fd, &event) < 0
+			&& (errno != ENOENT || epoll_ctl(fiber->worker->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0)){
+		perror("fiber_wait");
+		return false;
+	}
+	swapcontext(&fiber->context, &fiber->worker->scheduler);
+	return true;
+}
+
+//eventfd another thread writes to wake the calling fiber, or -1 on a handler thread
+int session_wake_fd(void){
+	return current_fiber != NULL ? eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC) : -1;
+}
+
+//wait for cond to be signalled, or for wake_fd if this is a fiber, so the
+//worker can run other sessions meanwhile. mutex is held on entry and return.
+void session_wait(pthread_cond_t *cond, int wake_fd, pthread_mutex_t *mutex){
+	if (wake_fd < 0){
+		pthread_cond_wait(cond, mutex);
+		return;
+	}
+	pthread_mutex_unlock(mutex);
+	uint64_t count;
+	fiber_wait(wake_fd, EPOLLIN);
+	if (read(wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN){
+		perror("session_wait");
+	}
+	pthread_mutex_lock(mutex);
+}
+
+void session_wake(pthread_cond_t *cond, int wake_fd){
+	if (wake_fd < 0){
+		pthread_cond_signal(cond);
+		return;
+	}
+	uint64_t one = 1;
+	if (write(wake_fd, &one, sizeof(one)) < 0){
+		perror("session_wake");
+	}
+}
+
+static void fiber_main(void){
+	serve_sessions(current_fiber->client_socket);
+	current_fiber->finished = true;
+	//returning switches to the worker's scheduler through uc_link
+}
+
+//run a fiber until it yields or finishes
+static void fiber_resume(FiberWorker *worker, Fiber *fiber){
+	current_fiber = fiber;
+	client_limits = &fiber->limits;
+	client_timer = &fiber->timer;
+	swapcontext(&worker->scheduler, &fiber->context);
+	current_fiber = NULL;
+	if (fiber->finished){
+		atomic_fetch_sub(&worker->num_fibers, 1);
+		pthread_mutex_lock(&worker->mutex);
+		fiber->next = worker->free_fibers;
+		worker->free_fibers = fiber;
+		pthread_mutex_unlock(&worker->mutex);
+	}
+}
+
+//run a newly handed over session on its fiber until it first yields. kept out
+//of fiber_worker_loop so none of the loop's locals are live across getcontext.
+static void fiber_start(FiberWorker *worker, Fiber *fiber){
+	getcontext(&fiber->context);
+	fiber->context.uc_stack.ss_sp = fiber->stack;
+	fiber->context.uc_stack.ss_size = FIBER_STACK_SIZE;
+	fiber->context.uc_link = &worker->scheduler;
+	makecontext(&fiber->context, fiber_main, 0);
+	fiber_resume(worker, fiber);
+}
+
+void *fiber_worker_loop(void *data){
+	FiberWorker *worker = (FiberWorker*)data;
+	struct epoll_event events[FIBER_EVENTS];
+	while (1){
+		int num_events = epoll_wait(worker->epoll_fd, events, FIBER_EVENTS, -1);
+		if (num_events < 0 && errno != EINTR){
+			perror("epoll_wait");
+			exit(1);
+		}
+		for (int i = 0; i < num_events; i++){
+			Fiber *fiber = (Fiber*)events[i].data.ptr;
+			if (fiber != NULL){
+				fiber_resume(worker, fiber);
+				continue;
+			}
+			//start the sessions handed to this worker
+			uint64_t count;
+			if (read(worker->wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN){
+				perror("fiber_worker_loop");
+			}
+			pthread_mutex_lock(&worker->mutex);
+			Fiber *incoming = worker->incoming;
+			worker->incoming = NULL;
+			pthread_mutex_unlock(&worker->mutex);
+			while (incoming != NULL){
+				fiber = incoming;
+				incoming = fiber->next;
+				fiber_start(worker, fiber);
+			}
+		}
+	}
+	return NULL;
+}
+
+//hand a client to the worker running the fewest sessions
+void start_session_fiber(int client_socket){
+	FiberWorker *worker = &fiber_workers[0];
+	for (int i = 1; i < num_fiber_workers; i++){
+		if (atomic_load(&fiber_workers[i].num_fibers) < atomic_load(&worker->num_fibers)){
+			worker = &fiber_workers[i];
+		}
+	}
+	Fiber *fiber = fiber_alloc(worker);
+	fiber->client_socket = client_socket;
+	fiber->finished = false;
+	atomic_fetch_add(&worker->num_fibers, 1);
+	pthread_mutex_lock(&worker->mutex);
+	fiber->next = worker->incoming;
+	worker->incoming = fiber;
+	pthread_mutex_unlock(&worker->mutex);
+	uint64_t one = 1;
+	if (write(worker->wake_fd, &one, sizeof(one)) < 0){
+		perror("start_session_fiber");
+	}
+}
+
+void fiber_workers_init(int num_workers){
+	fiber_workers = (FiberWorker*)calloc(num_workers, sizeof(FiberWorker));
+	if (!fiber_workers){
+		fprintf(stderr, "fiber_workers_init: out of memory\n");
+		exit(1);
+	}
+	num_fiber_workers = num_workers;
+	for (int i = 0; i < num_workers; i++){
+		FiberWorker *worker = &fiber_workers[i];
+		struct epoll_event event = {.events = EPOLLIN, .data.ptr = NULL};
+		worker->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		worker->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (worker->epoll_fd < 0 || worker->wake_fd < 0 || epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, worker->wake_fd, &event) < 0){
+			perror("fiber_workers_init");
+			exit(1);
+		}
+		pthread_mutex_init(&worker->mutex, NULL);
+		pthread_create(&worker->thread, NULL, fiber_worker_loop, worker);
+	}
+}
+
+//receive on a fiber's non-blocking socket, yielding until there is data
+static ssize_t fiber_recv(int client_socket, void *buffer, size_t length, int flags){
+	size_t received = 0;
+	while (1){
+		net_syscalls++;
+		ssize_t read_size = recv(client_socket, (uint8_t*)buffer + received, length - received, (flags & ~MSG_WAITALL) | MSG_DONTWAIT);
+		if (read_size > 0){
+			received += read_size;
+			if (!(flags & MSG_WAITALL) || received == length){
+				return received;
+			}
+		} else if (read_size == 0){
+			return received;
+		} else if (errno == EAGAIN || errno == EWOULDBLOCK){
+			if (!fiber_wait(client_socket, EPOLLIN)){
+				return -1;
+			}
+		} else if (errno != EINTR){
+			return received > 0 ? (ssize_t)received : -1;
+		}
+	}
+}
+
+//send all of iov on a fiber's non-blocking socket, yielding while it is full
+static ssize_t fiber_sendv(int client_socket, const struct iovec *iov, int iovcnt){
+	struct iovec pending[iovcnt];
+	memcpy(pending, iov, iovcnt * sizeof(struct iovec));
+	size_t total = 0;
+	int first = 0;
+	while (first < iovcnt){
+		struct msghdr msg = {.msg_iov = &pending[first], .msg_iovlen = iovcnt - first};
+		net_syscalls++;
+		ssize_t sent = sendmsg(client_socket, &msg, MSG_DONTWAIT);
+		if (sent < 0){
+			if (errno == EAGAIN || errno == EWOULDBLOCK){
+				if (!fiber_wait(client_socket, EPOLLOUT)){
+					return -1;
+				}
+				continue;
+			} else if (errno == EINTR){
+				continue;
+			}
+			return -1;
+		}
+		total += sent;
+		while (first < iovcnt && (size_t)sent >= pending[first].iov_len){
+			sent -= pending[first].iov_len;
+			first++;
+		}
+		if (first < iovcnt){
+			pending[first].iov_base = (uint8_t*)pending[first].iov_base + sent;
+			pending[first].iov_len -= sent;
+		}
+	}
+	return total;
+}
+
+//per thread io_uring used by the net_ functions when the server runs with -u.
+//sends are copied into a registered buffer and queued, then submitted
+//together with the next receive in one io_uring_enter, so a move's board,
+//confirmation and result go out with the receive that follows them instead
+//of a syscall each. the queued operations are linked so a failed send
+//cancels the receive after it rather than leaving it waiting.
+typedef struct {
+	int fd;
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ring, *cq_ring;
+	size_t sq_ring_size, cq_ring_size, sqes_size;
+	int num_queued;             //operations filled in but not yet submitted
+	uint8_t *buffer;            //registered buffer queued sends are copied into
+	size_t buffer_used;
+} IoRing;
+
+__thread IoRing *thread_ring = NULL;
+__thread bool thread_ring_failed = false;
+
+static int io_uring_setup_syscall(unsigned entries, struct io_uring_params *params){
+	return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter_syscall(int fd, unsigned to_submit, unsigned min_complete, unsigned flags){
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+//unmap and close this thread's ring
+void net_ring_exit(void){
+	IoRing *ring = thread_ring;
+	if (ring == NULL){
+		return;
+	}
+	munmap(ring->sqes, ring->sqes_size);
+	munmap(ring->cq_ring, ring->cq_ring_size);
+	munmap(ring->sq_ring, ring->sq_ring_size);
+	close(ring->fd);
+	free(ring->buffer);
+	free(ring);
+	thread_ring = NULL;
+}
+
+//this thread's ring, set up on first use. NULL if io_uring can't be used,
+//in which case the net_ functions fall back to plain syscalls.
+IoRing *net_ring(void){
+	if (thread_ring != NULL || thread_ring_failed){
+		return thread_ring;
+	}
+	IoRing *ring = (IoRing*)calloc(1, sizeof(IoRing));
+	//only this thread uses the ring, so completions can be run when it waits
+	//for them instead of interrupting it. older kernels don't have the flags.
+	struct io_uring_params params = {.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN};
+	if (ring && (ring->fd = io_uring_setup_syscall(NET_RING_ENTRIES, &params)) < 0 && errno == EINVAL){
+		memset(&params, 0, sizeof(params));
+		ring->fd = io_uring_setup_syscall(NET_RING_ENTRIES, &params);
+	}
+	if (!ring || ring->fd < 0){
+		perror("io_uring_setup");
+		free(ring);
+		thread_ring_failed = true;
+		return NULL;
+	}
+	ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+	ring->sqes = (struct io_uring_sqe*)mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	ring->buffer = (uint8_t*)aligned_alloc(4096, NET_RING_BUFFER);
+	struct iovec registered = {.iov_base = ring->buffer, .iov_len = NET_RING_BUFFER};
+	thread_ring = ring;
+	if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED || ring->sqes == MAP_FAILED || !ring->buffer
+			|| syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, &registered, 1) < 0){
+		perror("io_uring ring setup");
+		net_ring_exit();
+		thread_ring_failed = true;
+		return NULL;
+	}
+	uint8_t *sq = (uint8_t*)ring->sq_ring, *cq = (uint8_t*)ring->cq_ring;
+	ring->sq_head = (unsigned*)(sq + params.sq_off.head);
+	ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+	ring->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+	ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+	ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+	ring->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+	return ring;
+}
+
+//next free submission entry, linked to the one queued before it
+static struct io_uring_sqe *net_ring_queue(IoRing *ring){
+	unsigned tail = *ring->sq_tail + ring->num_queued;
+	unsigned index = tail & *ring->sq_mask;
+	if (ring->num_queued > 0){
+		ring->sqes[(tail - 1) & *ring->sq_mask].flags |= IOSQE_IO_LINK;
+	}
+	struct io_uring_sqe *sqe = &ring->sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->user_data = ring->num_queued;     //its place in the batch
+	ring->sq_array[index] = index;
+	ring->num_queued++;
+	return sqe;
+}
+
+//send all of a queued send's data that hasn't gone yet with plain send calls.
+//returns the whole length, or -errno if it failed.
+static int net_ring_send_rest(const struct io_uring_sqe *op, size_t sent){
+	while (sent < op->len){
+		net_syscalls++;
+		ssize_t result = send(op->fd, (uint8_t*)(uintptr_t)op->addr + sent, op->len - sent, 0);
+		if (result < 0 && errno != EINTR){
+			return -errno;
+		} else if (result > 0){
+			sent += result;
+		}
+	}
+	return op->len;
+}
+
+//submit everything queued and wait for all of it. returns the result of the
+//last operation, or -1 with errno set if any of them failed.
+static int net_ring_submit(IoRing *ring){
+	int num_queued = ring->num_queued;
+	//the operations are kept to finish by hand if a short send breaks the link
+	struct io_uring_sqe ops[NET_RING_ENTRIES];
+	int results[NET_RING_ENTRIES];
+	for (int i = 0; i < num_queued; i++){
+		ops[i] = ring->sqes[(*ring->sq_tail + i) & *ring->sq_mask];
+	}
+	atomic_store_explicit((atomic_uint*)ring->sq_tail, *ring->sq_tail + num_queued, memory_order_release);
+	ring->num_queued = 0;
+	ring->buffer_used = 0;
+
+	int submitted = 0, completed = 0;
+	while (completed < num_queued){
+		net_syscalls++;
+		int entered = io_uring_enter_syscall(ring->fd, num_queued - submitted, num_queued - completed, IORING_ENTER_GETEVENTS);
+		if (entered < 0 && errno != EINTR){
+			perror("io_uring_enter");
+			return -1;
+		} else if (entered > 0){
+			submitted += entered;
+		}
+		unsigned head = *ring->cq_head;
+		unsigned tail = atomic_load_explicit((atomic_uint*)ring->cq_tail, memory_order_acquire);
+		for (; head != tail; head++){
+			struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+			results[cqe->user_data] = cqe->res;
+			completed++;
+		}
+		atomic_store_explicit((atomic_uint*)ring->cq_head, head, memory_order_release);
+	}
+
+	//a send cut short by a full socket breaks the link, cancelling everything
+	//after it. the rest of it, and what was cancelled, are finished in order
+	//with plain syscalls on the blocking socket.
+	bool finishing = false;
+	int error = 0;
+	for (int i = 0; i < num_queued; i++){
+		bool cancelled = finishing && results[i] == -ECANCELED;
+		if (ops[i].opcode == IORING_OP_WRITE_FIXED && (cancelled || (results[i] >= 0 && (unsigned)results[i] < ops[i].len))){
+			results[i] = net_ring_send_rest(&ops[i], cancelled ? 0 : results[i]);
+			finishing = results[i] >= 0;
+		} else if (ops[i].opcode == IORING_OP_RECV && cancelled){
+			net_syscalls++;
+			ssize_t read_size = recv(ops[i].fd, (void*)(uintptr_t)ops[i].addr, ops[i].len, ops[i].msg_flags);
+			results[i] = read_size < 0 ? -errno : (int)read_size;
+		}
+		if (results[i] < 0 && error == 0){
+			error = -results[i];
+		}
+	}
+	if (error != 0){
+		errno = error;
+		return -1;
+	}
+	return num_queued > 0 ? results[num_queued - 1] : 0;
+}
+
+//send anything still queued for the client. false if any of it failed.
+bool net_flush(int client_socket){
+	(void)client_socket;
+	IoRing *ring = thread_ring;
+	if (ring != NULL && ring->num_queued > 0){
+		return net_ring_submit(ring) >= 0;
+	}
+	return true;
+}
+
+//queue data for the client. it goes out with the next net_recv or net_flush,
+//so a failure to send shows up there.
+ssize_t net_sendv(int client_socket, const struct iovec *iov, int iovcnt){
+	if (current_fiber != NULL){
+		return fiber_sendv(client_socket, iov, iovcnt);
+	}
+	IoRing *ring = use_io_uring ? net_ring() : NULL;
+	size_t size = 0;
+	for (int i = 0; i < iovcnt; i++){
+		size += iov[i].iov_len;
+	}
+	if (ring != NULL && size > NET_RING_BUFFER){
+		net_flush(client_socket);
+	}
+	if (ring == NULL || size > NET_RING_BUFFER){
+		net_syscalls++;
+		return writev(client_socket, iov, iovcnt);
+	}
+	//leave room for the receive the sends are submitted with
+	if (ring->buffer_used + size > NET_RING_BUFFER || ring->num_queued >= NET_RING_ENTRIES - 1){
+		net_flush(client_socket);
+	}
+	uint8_t *data = ring->buffer + ring->buffer_used;
+	for (int i = 0; i < iovcnt; i++){
+		memcpy(data, iov[i].iov_base, iov[i].iov_len);
+		data += iov[i].iov_len;
+	}
+	struct io_uring_sqe *sqe = net_ring_queue(ring);
+	sqe->opcode = IORING_OP_WRITE_FIXED;
+	sqe->fd = client_socket;
+	sqe->addr = (uintptr_t)(ring->buffer + ring->buffer_used);
+	sqe->len = size;
+	sqe->buf_index = 0;
+	ring->buffer_used += size;
+	return size;
+}
+
+ssize_t net_send(int client_socket, const void *buffer, size_t length, int flags){
+	if (current_fiber == NULL && (!use_io_uring || flags != 0)){
+		net_flush(client_socket);
+		net_syscalls++;
+		return send(client_socket, buffer, length, flags);
+	}
+	struct iovec iov = {.iov_base = (void*)buffer, .iov_len = length};
+	return net_sendv(client_socket, &iov, 1);
+}
+
+//receive from the client, first sending anything queued for it
+ssize_t net_recv(int client_socket, void *buffer, size_t length, int flags){
+	if (current_fiber != NULL){
+		return fiber_recv(client_socket, buffer, length, flags);
+	}
+	IoRing *ring = use_io_uring ? net_ring() : NULL;
+	if (ring == NULL){
+		net_syscalls++;
+		return recv(client_socket, buffer, length, flags);
+	}
+	struct io_uring_sqe *sqe = net_ring_queue(ring);
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = client_socket;
+	sqe->addr = (uintptr_t)buffer;
+	sqe->len = length;
+	sqe->msg_flags = flags;
+	return net_ring_submit(ring);
+}
+
+//send part of a file to the client, after anything queued for it
+ssize_t net_sendfile(int client_socket, int fd, off_t *offset, size_t length){
+	if (!net_flush(client_socket)){
+		return -1;
+	}
+	while (1){
+		net_syscalls++;
+		ssize_t sent = sendfile(client_socket, fd, offset, length);
+		if (sent >= 0 || current_fiber == NULL || (errno != EAGAIN && errno != EWOULDBLOCK)){
+			return sent;
+		}
+		if (!fiber_wait(client_socket, EPOLLOUT)){
+			return -1;
+		}
+	}
+}
+
+void *connection_handler(void *socket_desc){
+  // int rc;                         /* return code of pthreads functions.  */
+  // struct request* a_req;      /* pointer to a request.               */
+  int client_socket = *(int*)socket_desc;
+  free(socket_desc);
+  pthread_detach(pthread_self());
+
+  //the session's rate limits and idle timer live on this thread's stack
+  ClientLimits limits;
+  IdleTimer timer = {.armed = false};
+  client_limits = &limits;
+  client_timer = &timer;
+  serve_sessions(client_socket);
+  net_ring_exit();
+  return 0;
+}
+
+//serve clients until none are left waiting for a handler
+void serve_sessions(int client_socket){
+  while (client_socket >= 0){
+    if (current_fiber != NULL){
+      fcntl(client_socket, F_SETFL, fcntl(client_socket, F_GETFL) | O_NONBLOCK);
+    }
+    bool multiplexed = serve_client(client_socket);
+    net_flush(client_socket);
+    //the timer must not fire on the socket once it is closed
+    cancel_idle_timeout();
+    if (multiplexed){
+      //the connection now belongs to its relay thread
+      if (current_fiber != NULL){
+        epoll_ctl(current_fiber->worker->epoll_fd, EPOLL_CTL_DEL, client_socket, NULL);
+      }
+      start_mux_connection(client_socket);
+    } else{
+      close(client_socket);
+    }
+    client_socket = next_pending_session();
+  }
+}
+
+//take the hello a multiplexing client starts with, if it did. the hello can
+//arrive in pieces, so while what has come so far is the start of it the rest
+//is waited for - the socket only counts as readable once the whole hello
+//could be there, and the login timeout shuts it if that never happens.
+bool recv_mux_hello(int client_socket){
+	char hello[MUX_HELLO_LENGTH];
+	ssize_t read_size = net_recv(client_socket, hello, MUX_HELLO_LENGTH, MSG_PEEK);
+	if (read_size > 0 && read_size < MUX_HELLO_LENGTH && memcmp(hello, MUX_HELLO, read_size) == 0){
+		int low_water = MUX_HELLO_LENGTH, one = 1;
+		setsockopt(client_socket, SOL_SOCKET, SO_RCVLOWAT, &low_water, sizeof(low_water));
+		ssize_t previous;
+		do {
+			previous = read_size;
+			struct pollfd readable = {.fd = client_socket, .events = POLLIN};
+			if (current_fiber != NULL ? !fiber_wait(client_socket, EPOLLIN) : poll(&readable, 1, -1) < 0){
+				break;
+			}
+			read_size = net_recv(client_socket, hello, MUX_HELLO_LENGTH, MSG_PEEK);
+		} while (read_size > previous && read_size < MUX_HELLO_LENGTH && memcmp(hello, MUX_HELLO, read_size) == 0);
+		setsockopt(client_socket, SOL_SOCKET, SO_RCVLOWAT, &one, sizeof(one));
+	}
+	if (read_size == MUX_HELLO_LENGTH && memcmp(hello, MUX_HELLO, MUX_HELLO_LENGTH) == 0){
+		net_recv(client_socket, hello, MUX_HELLO_LENGTH, MSG_WAITALL);
+		return true;
+	}
+	return false;
+}
+
+//serve a client's session. returns true instead if the client wants to
+//multiplex sessions over the connection, leaving it open.
+bool serve_client(int client_socket){
+  int read_size;
+  reset_client_limits();
+  int menu_selection;
+
+	//a multiplexing client says so before anything else - a username can't
+	//hold the newline in the hello
+	arm_idle_timeout(client_socket, login_timeout);
+	if (recv_mux_hello(client_socket)){
+		return true;
+	}
+
+	//log in user, or pick up a game suspended when a previous connection dropped
+	int logged_in_user;
+	GameSession resumed_session;
+	bool resumed = false;
+	logged_in_user = handle_login(client_socket, &resumed_session, &resumed);
+	if (logged_in_user < 0){
+		return false;
+	}
+	User current_user = users[logged_in_user];
+	printf("Logged in user: %s\n", current_user.name);
+	if (resumed){
+		//wait for the client to be ready for the board before continuing the game
+		char ready[2000];
+		arm_idle_timeout(client_socket, game_timeout);
+		if (net_recv(client_socket, ready, sizeof(char)*2000, 0) <= 0){
+			suspend_session(&resumed_session);
+			return false;
+		}
+		move_log_start(&resumed_session.move_log, &resumed_session.game, true);
+		play_game(client_socket, &resumed_session);
+	}
+
+	bool withinGame = true;
+	while(withinGame){
+
+  // if (num_requests > 0) {
+    arm_idle_timeout(client_socket, menu_timeout);
+    read_size = net_recv(client_socket, &menu_selection, sizeof(int), 0);
+    if (read_size <= 0){
+      break;
+    }
+    // a_req = get_request(&req_mutex);
+    // if (a_req) { /* got a request - handle it and free it */
+    //     /* unlock mutex - so other threads would be able to handle */
+    //     /* other reqeusts waiting in the queue paralelly.          */
+    //     rc = pthread_mutex_unlock(&req_mutex);
+    //     // handle_request(a_req, thread_id);
+    //     free(a_req);
+    //     /* and lock the mutex again. */
+    //     rc = pthread_mutex_lock(&req_mutex);
+    // }
+		printf("Menu selection: %d\n\n", menu_selection);
+		if (menu_selection == 3){
+			withinGame = false;
+		}
+  // }
+    // else {
+    //
+    //     rc = pthread_cond_wait(&got_request, &req_mutex);
+        run_selected_function(menu_selection, client_socket, logged_in_user);
+    		menu_selection = 0;
+    // }
+
+	}
+	return false;
+}
+
+int get_num_users(void){
+	FILE *fp = fopen("Authentication.txt", "r");
+	char c;
+	int numLines = 0;
+
+	while(c != EOF){
+		if (c == '\n'){
+			numLines++;
+		}
+		c = fgetc(fp);
+	}
+
+	fclose(fp);
+	return numLines - 1;
+}
+
+int handle_login(int client_socket, GameSession *resumed_session, bool *resumed){
+	int read_size;
+	char buffer_username[2000], buffer_password[2000];
+	char *confirmation = "received";
+
+	//receive username and send confirmation
+	read_size = net_recv(client_socket, buffer_username, 2000 - 1, 0);
+	if (read_size <= 0){
+		return -1;
+	}
+	buffer_username[read_size] = '\0';
+
+	//a reconnecting client sends its resume token instead of a username
+	if (strncmp(buffer_username, "RESUME ", 7) == 0){
+		uint8_t token[SESSION_TOKEN_BYTES];
+		bool valid = strlen(&buffer_username[7]) == SESSION_TOKEN_LENGTH;
+		for (int i = 0; valid && i < SESSION_TOKEN_BYTES; i++){
+			unsigned int byte;
+			valid = sscanf(&buffer_username[7 + 2*i], "%2x", &byte) == 1;
+			token[i] = byte;
+		}
+		if (valid && resume_session(token, resumed_session)){
+			puts("session resumed");
+			confirmation = "resumed";
+			*resumed = true;
+		} else{
+			puts("unknown or expired session");
+			confirmation = "expired";
+		}
+		net_send(client_socket, confirmation, strlen(confirmation), 0);
+		return *resumed ? resumed_session->user : -1;
+	}
+
+	//a client holding a login token from an earlier login skips the password
+	if (strncmp(buffer_username, "TOKEN ", 6) == 0){
+		int authenticated = check_login_token(&buffer_username[6]);
+		if (authenticated > -1){
+			puts("login token accepted");
+			confirmation = "true";
+		} else{
+			puts("invalid or expired login token");
+		}
+		net_send(client_socket, confirmation, strlen(confirmation), 0);
+		return authenticated;
+	}
+
+	printf("Username: %s\n", buffer_username);
+	net_send(client_socket, confirmation, strlen(confirmation), 0);
+
+	//receive password
+	read_size = net_recv(client_socket, buffer_password, 2000 - 1, 0);
+	if (read_size <= 0){
+		return -1;
+	}
+	buffer_password[read_size] = '\0';
+
+	//authenticate user on the request-handling threads
+	int authenticated;
+	authenticated = authenticate_in_pool(buffer_username, buffer_password);
+	memset(buffer_password, 0, sizeof(buffer_password));
+
+	//tell client if user is authenticated, along with a token for logging back in
+	char reply[6 + LOGIN_TOKEN_LENGTH];
+	if (authenticated > -1){
+		strcpy(reply, "true ");
+		make_login_token(authenticated, &reply[5]);
+		confirmation = reply;
+	}
+	net_send(client_socket, confirmation, strlen(confirmation), 0);
+
+	return authenticated;
+}
+
+int authenticate_user(const char *username, const char *password){
+	FILE *fp;
+	char c = 0;
+	char file_username[2000];
+	char file_password[2000];
+	bool correct = false;
+	int lineNum = -1;
+
+	// Open one file for reading
+	fp = fopen("Authentication.txt", "r");
+	//Reading file and comparing username and password
+	while (correct == false && c != EOF){
+		 if (c == '\n'){
+  			lineNum++;
+  		}
+		fscanf(fp, "%1999s %1999s", file_username, file_password);
+		if(strcmp(file_username,username) == 0 && verify_password(password, file_password)){
+  			puts("login successful");
+  			correct = true;
+  			break;
+  		}
+		c = fgetc(fp);
+	}
+	fclose(fp);
+
+	if(!correct){
+		puts("incorrect login");
+		return -1;
+	}
+	return lineNum;
+}
+
+/* SHA-256 (FIPS 180-4), HMAC and PBKDF2, used for password hashes and login tokens */
+typedef struct {
+	uint32_t state[8];
+	uint64_t length;        //bytes hashed so far
+	uint8_t block[64];
+	int block_size;
+} Sha256;
+
+static const uint32_t sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROTR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_compress(uint32_t state[8], const uint8_t block[64]){
+	uint32_t w[64];
+	for (int i = 0; i < 16; i++){
+		w[i] = (uint32_t)block[4*i] << 24 | (uint32_t)block[4*i + 1] << 16 |
+		       (uint32_t)block[4*i + 2] << 8 | block[4*i + 3];
+	}
+	for (int i = 16; i < 64; i++){
+		uint32_t s0 = ROTR32(w[i-15], 7) ^ ROTR32(w[i-15], 18) ^ (w[i-15] >> 3);
+		uint32_t s1 = ROTR32(w[i-2], 17) ^ ROTR32(w[i-2], 19) ^ (w[i-2] >> 10);
+		w[i] = w[i-16] + s0 + w[i-7] + s1;
+	}
+
+	uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+	uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+	for (int i = 0; i < 64; i++){
+		uint32_t t1 = h + (ROTR32(e, 6) ^ ROTR32(e, 11) ^ ROTR32(e, 25)) +
+		              ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+		uint32_t t2 = (ROTR32(a, 2) ^ ROTR32(a, 13) ^ ROTR32(a, 22)) +
+		              ((a & b) ^ (a & c) ^ (b & c));
+		h = g; g = f; f = e; e = d + t1;
+		d = c; c = b; b = a; a = t1 + t2;
+	}
+	state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+	state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+static void sha256_init(Sha256 *sha){
+	static const uint32_t initial_state[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+	};
+	memcpy(sha->state, initial_state, sizeof(initial_state));
+	sha->length = 0;
+	sha->block_size = 0;
+}
+
+static void sha256_update(Sha256 *sha, const uint8_t *data, size_t size){
+	sha->length += size;
+	while (size > 0){
+		size_t n = 64 - sha->block_size;
+		if (n > size){
+			n = size;
+		}
+		memcpy(&sha->block[sha->block_size], data, n);
+		sha->block_size += n;
+		data += n;
+		size -= n;
+		if (sha->block_size == 64){
+			sha256_compress(sha->state, sha->block);
+			sha->block_size = 0;
+		}
+	}
+}
+
+static void sha256_final(Sha256 *sha, uint8_t digest[SHA256_BYTES]){
+	uint64_t bits = sha->length * 8;
+	uint8_t padding[72] = {0x80};
+	int padding_size = (sha->block_size < 56 ? 56 : 120) - sha->block_size;
+	for (int i = 0; i < 8; i++){
+		padding[padding_size + i] = bits >> (56 - 8*i);
+	}
+	sha256_update(sha, padding, padding_size + 8);
+	for (int i = 0; i < 8; i++){
+		digest[4*i] = sha->state[i] >> 24;
+		digest[4*i + 1] = sha->state[i] >> 16;
+		digest[4*i + 2] = sha->state[i] >> 8;
+		digest[4*i + 3] = sha->state[i];
+	}
+}
+
+//HMAC-SHA256 with the key already folded into its inner and outer pads
+typedef struct {
+	Sha256 inner, outer;
+} HmacKey;
+
+static void hmac_sha256_key(HmacKey *hmac, const uint8_t *key, size_t key_size){
+	uint8_t key_block[64] = {0}, pad[64];
+	if (key_size > 64){
+		Sha256 sha;
+		sha256_init(&sha);
+		sha256_update(&sha, key, key_size);
+		sha256_final(&sha, key_block);
+	} else{
+		memcpy(key_block, key, key_size);
+	}
+	for (int i = 0; i < 64; i++){
+		pad[i] = key_block[i] ^ 0x36;
+	}
+	sha256_init(&hmac->inner);
+	sha256_update(&hmac->inner, pad, 64);
+	for (int i = 0; i < 64; i++){
+		pad[i] = key_block[i] ^ 0x5c;
+	}
+	sha256_init(&hmac->outer);
+	sha256_update(&hmac->outer, pad, 64);
+}
+
+static void hmac_sha256(const HmacKey *hmac, const uint8_t *data, size_t size, uint8_t mac[SHA256_BYTES]){
+	Sha256 sha = hmac->inner;
+	sha256_update(&sha, data, size);
+	sha256_final(&sha, mac);
+	sha = hmac->outer;
+	sha256_update(&sha, mac, SHA256_BYTES);
+	sha256_final(&sha, mac);
+}
+
+//PBKDF2-HMAC-SHA256 with a single output block
+static void pbkdf2_sha256(const char *password, const uint8_t *salt, size_t salt_size, int iterations, uint8_t key[SHA256_BYTES]){
+	HmacKey hmac;
+	uint8_t block[PASSWORD_SALT_BYTES + 4], u[SHA256_BYTES];
+	hmac_sha256_key(&hmac, (const uint8_t*)password, strlen(password));
+	memcpy(block, salt, salt_size);
+	block[salt_size] = 0; block[salt_size + 1] = 0; block[salt_size + 2] = 0; block[salt_size + 3] = 1;
+	hmac_sha256(&hmac, block, salt_size + 4, u);
+	memcpy(key, u, SHA256_BYTES);
+	for (int i = 1; i < iterations; i++){
+		hmac_sha256(&hmac, u, SHA256_BYTES, u);
+		for (int j = 0; j < SHA256_BYTES; j++){
+			key[j] ^= u[j];
+		}
+	}
+}
+
+//compare without stopping at the first difference, so timing gives nothing away
+static bool equal_bytes(const uint8_t *a, const uint8_t *b, size_t size){
+	uint8_t difference = 0;
+	for (size_t i = 0; i < size; i++){
+		difference |= a[i] ^ b[i];
+	}
+	return difference == 0;
+}
+
+static void to_hex(const uint8_t *bytes, size_t size, char *hex){
+	for (size_t i = 0; i < size; i++){
+		sprintf(&hex[2*i], "%02x", bytes[i]);
+	}
+}
+
+static bool from_hex(const char *hex, uint8_t *bytes, size_t size){
+	for (size_t i = 0; i < size; i++){
+		unsigned int byte;
+		if (!isxdigit((unsigned char)hex[2*i]) || !isxdigit((unsigned char)hex[2*i + 1]) ||
+		    sscanf(&hex[2*i], "%2x", &byte) != 1){
+			return false;
+		}
+		bytes[i] = byte;
+	}
+	return true;
+}
+
+//hash a password with a fresh salt, in the form stored in Authentication.txt
+bool hash_password(const char *password, char *stored, size_t stored_size){
+	uint8_t salt[PASSWORD_SALT_BYTES], key[SHA256_BYTES];
+	char salt_hex[2*PASSWORD_SALT_BYTES + 1], key_hex[2*SHA256_BYTES + 1];
+	if (getrandom(salt, sizeof(salt), 0) != sizeof(salt)){
+		return false;
+	}
+	pbkdf2_sha256(password, salt, sizeof(salt), PASSWORD_HASH_ITERATIONS, key);
+	to_hex(salt, sizeof(salt), salt_hex);
+	to_hex(key, sizeof(key), key_hex);
+	return snprintf(stored, stored_size, "%s%d$%s$%s", PASSWORD_HASH_PREFIX,
+	                PASSWORD_HASH_ITERATIONS, salt_hex, key_hex) < (int)stored_size;
+}
+
+//check a password against a stored hash. entries without the hash prefix
+//are plaintext from before passwords were hashed.
+bool verify_password(const char *password, const char *stored){
+	size_t prefix_size = strlen(PASSWORD_HASH_PREFIX);
+	if (strncmp(stored, PASSWORD_HASH_PREFIX, prefix_size) != 0){
+		return strcmp(stored, password) == 0;
+	}
+
+	int iterations;
+	char salt_hex[2*PASSWORD_SALT_BYTES + 1], key_hex[2*SHA256_BYTES + 1];
+	uint8_t salt[PASSWORD_SALT_BYTES], stored_key[SHA256_BYTES], key[SHA256_BYTES];
+	if (sscanf(&stored[prefix_size], "%d$%32[0-9a-f]$%64[0-9a-f]", &iterations, salt_hex, key_hex) != 3 ||
+	    iterations < 1 || strlen(salt_hex) != sizeof(salt_hex) - 1 || strlen(key_hex) != sizeof(key_hex) - 1 ||
+	    !from_hex(salt_hex, salt, sizeof(salt)) || !from_hex(key_hex, stored_key, sizeof(stored_key))){
+		puts("malformed password hash in Authentication.txt");
+		return false;
+	}
+	pbkdf2_sha256(password, salt, sizeof(salt), iterations, key);
+	return equal_bytes(key, stored_key, sizeof(key));
+}
+
+HmacKey login_token_key;
+
+void login_token_init(const uint8_t *secret){
+	if (secret){
+		memcpy(login_token_secret, secret, SHA256_BYTES);
+	} else{
+		getrandom(login_token_secret, SHA256_BYTES, 0);
+	}
+	hmac_sha256_key(&login_token_key, login_token_secret, SHA256_BYTES);
+}
+
+//a login token is the user and an expiry time, signed with the server's key
+void make_login_token(int user, char token[LOGIN_TOKEN_LENGTH + 1]){
+	uint8_t bytes[LOGIN_TOKEN_BYTES];
+	uint32_t token_user = user;
+	uint64_t expiry = time(NULL) + LOGIN_TOKEN_LIFETIME;
+	memcpy(&bytes[0], &token_user, 4);
+	memcpy(&bytes[4], &expiry, 8);
+	hmac_sha256(&login_token_key, bytes, 12, &bytes[12]);
+	to_hex(bytes, sizeof(bytes), token);
+}
+
+//returns the user a login token was made for, or -1 if it is forged or expired
+int check_login_token(const char *token){
+	uint8_t bytes[LOGIN_TOKEN_BYTES], mac[SHA256_BYTES];
+	uint32_t token_user;
+	uint64_t expiry;
+	if (strlen(token) != LOGIN_TOKEN_LENGTH || !from_hex(token, bytes, sizeof(bytes))){
+		return -1;
+	}
+	hmac_sha256(&login_token_key, bytes, 12, mac);
+	if (!equal_bytes(mac, &bytes[12], SHA256_BYTES)){
+		return -1;
+	}
+	memcpy(&token_user, &bytes[0], 4);
+	memcpy(&expiry, &bytes[4], 8);
+	if (expiry < (uint64_t)time(NULL) || token_user >= (uint32_t)num_users){
+		return -1;
+	}
+	return token_user;
+}
+
+void run_selected_function(int menu_selection, int client_socket, int logged_in_user){
+
+  //run function based on selected menu option
+	if (menu_selection == 1){
+    //set up a new game and give the client its resume token
+		GameSession session = {.user = logged_in_user, .time_elapsed = 0};
+		char token[SESSION_TOKEN_LENGTH + 1];
+		getrandom(session.token, SESSION_TOKEN_BYTES, 0);
+		for (int i = 0; i < SESSION_TOKEN_BYTES; i++){
+			sprintf(&token[2*i], "%02x", session.token[i]);
+		}
+		net_send(client_socket, token, sizeof(token), 0);
+		session.game = new_game_board(game_board_pool);
+		print_mines(session.game);
+		move_log_start(&session.move_log, &session.game, false);
+		play_game(client_socket, &session);
+	} else if (menu_selection == 2){
+		if (take_token(&client_limits->leaderboard, LEADERBOARD_RATE, LEADERBOARD_BURST)){
+			run_leaderboard(client_socket);
+		} else{
+			//a negative entry count tells the client to try again later
+			int rate_limited = -1;
+			atomic_fetch_add(&stats.leaderboards_rate_limited, 1);
+			net_send(client_socket, &rate_limited, sizeof(int), 0);
+		}
+	} else if (menu_selection == 3){
+		//the connection is closed once the handler finishes with it
+	} else if (menu_selection == 4){
+		run_spectator(client_socket);
+	} else if (menu_selection == 5){
+		run_shared_board(client_socket);
+	} else if (menu_selection == 6){
+		run_leaderboard_query(client_socket, logged_in_user);
+	}
+}
+
+//play a new or resumed game and record the result
+void play_game(int client_socket, GameSession *session){
+	int logged_in_user = session->user;
+
+  //start timer for game
+	uint64_t begin, end, time_spent;
+	begin = monotonic_ns();
+  //run game, letting other clients watch
+	session->live_game = start_live_game(users[logged_in_user].name, &session->game);
+	GameResult result = run_minesweeper(client_socket, session);
+	end_live_game(session->live_game, result, &session->game);
+	session->live_game = NULL;
+	record_replay(session, result);
+	end = monotonic_ns();
+  //calculate time, including any time played before the game was suspended
+	time_spent = session->time_elapsed + (end - begin);
+  //if the connection dropped - keep the game for the client to resume
+	if (result == GAME_SUSPENDED){
+		session->time_elapsed = time_spent;
+		suspend_session(session);
+		return;
+	}
+	count_game_played(logged_in_user);
+  //if user won - insert entry to leaderboard
+	if (result == GAME_WON){
+		count_game_won(logged_in_user);
+		entry *p = (entry *)malloc(sizeof(entry));
+		p->user = &users[logged_in_user];
+		p->time_taken = time_spent;
+		p->won_at = time(NULL);
+		p->width = NUM_TILES_X;
+		p->height = NUM_TILES_Y;
+		p->num_mines = NUM_MINES;
+		pthread_mutex_lock(&lb_mutex);
+		insert_entry(p, false);
+		num_leaderboard_entries++;
+		pthread_mutex_unlock(&lb_mutex);
+		print_leaderboard(head);
+		net_send(client_socket, &time_spent, sizeof(uint64_t), 0);
+	}
+}
+
+//run minesweeper function
+GameResult run_minesweeper(int client_socket, GameSession *session){
+	GameState current_game = session->game;
+	//the board as the client last saw it. the first frame of a game, resumed or
+	//not, is a keyframe and the rest only carry the tiles that have changed.
+	GameState client_game = current_game;
+	bool client_has_board = false;
+
+	bool quit_game = false;
+	bool hit_mine = false;
+	bool won_game = false;
+
+  //play game until user quits, hits a mine or wins
+	while(!quit_game && !hit_mine && !won_game){
+    //time spent blocked on the client is counted separately from time spent on the move
+		uint64_t move_start = monotonic_ns(), network_ns = 0, wait_start;
+		arm_idle_timeout(client_socket, game_timeout);
+
+    //send the tiles that changed since the client's copy of the board, in the spectator frame format
+		SharedFrame *frame = client_has_board ? encode_delta(&client_game, &current_game)
+		                                      : encode_keyframe(&current_game, FRAME_KEYFRAME, 0);
+		if (!send_frame(client_socket, frame)){
+			puts("send of board failed");
+		}
+		frame_release(frame);
+		client_game = current_game;
+		client_has_board = true;
+
+    //receive menu selection
+		char selection;
+		wait_start = monotonic_ns();
+		if (net_recv(client_socket, &selection, sizeof(char), 0) <= 0){
+			break;
+		}
+		network_ns += monotonic_ns() - wait_start;
+		printf("%c\n", selection);
+
+		char *confirmation = "received";
+		if (selection == 'Q'){
+			quit_game = true;
+			move_log_add(&session->move_log, MOVE_QUIT, 0, 0);
+			//send(client_socket, confirmation, strlen(confirmation), 0);
+		} else if ((selection == 'R' || selection == 'P' || selection == 'B') &&
+		           !take_token(&client_limits->moves, MOVE_RATE, MOVE_BURST)){
+			//too many moves - the client skips sending coordinates for this one
+			confirmation = "limit";
+			selection = 0;
+			atomic_fetch_add(&stats.moves_rate_limited, 1);
+		}
+		if (net_send(client_socket, confirmation, strlen(confirmation), 0) < 0){
+			puts("failed confirmation");
+		}
+
+		char coordinates[2000];
+		int x, y;
+
+    //run function based on selection
+		if(selection == 'R'){
+			wait_start = monotonic_ns();
+			if (net_recv(client_socket, coordinates, sizeof(char)*2000, 0) <= 0){
+				break;
+			}
+			network_ns += monotonic_ns() - wait_start;
 			printf("%s\n", coordinates);
-			current_game = reveal_tile(current_game, coordinates, client_socket, mines);
+			if (parse_coordinates(coordinates, &x, &y)){
+				move_log_add(&session->move_log, MOVE_REVEAL, x, y);
+			}
+			current_game = reveal_tile(current_game, coordinates, client_socket);
 			hit_mine = current_game.hit_mine;
-		} else if(strstr(&selection, "P")!=NULL){
-			recv(client_socket, coordinates, sizeof(char)*2000, 0);
+		} else if(selection == 'P'){
+			wait_start = monotonic_ns();
+			if (net_recv(client_socket, coordinates, sizeof(char)*2000, 0) <= 0){
+				break;
+			}
+			network_ns += monotonic_ns() - wait_start;
 			printf("%s\n", coordinates);
+			if (parse_coordinates(coordinates, &x, &y)){
+				move_log_add(&session->move_log, MOVE_FLAG, x, y);
+			}
 			current_game = place_flag(current_game, coordinates, client_socket);
 			won_game = test_if_won(current_game);
+		} else if(selection == 'B'){
+			//several moves applied together, answered with one result
+			if (!run_batch(client_socket, session, &current_game, &network_ns)){
+				break;
+			}
+			//the client applies the batch's delta to its board
+			client_game = current_game;
+			hit_mine = current_game.hit_mine;
+			won_game = test_if_won(current_game);
 		}
+		publish_move(session->live_game, &session->game, &current_game);
+		session->game = current_game;
 		char ready[2000];
-		recv(client_socket, ready, sizeof(char)*2000, 0);
-		send(client_socket, &won_game, sizeof(bool), 0);
+		wait_start = monotonic_ns();
+		if (net_recv(client_socket, ready, sizeof(char)*2000, 0) <= 0){
+			break;
+		}
+		network_ns += monotonic_ns() - wait_start;
+		net_send(client_socket, &won_game, sizeof(bool), 0);
+		record_move_timing(monotonic_ns() - move_start - network_ns, network_ns);
+	}
+
+  //the loop only ends early if the client dropped mid-game
+	session->game = current_game;
+	if (won_game){
+		return GAME_WON;
+	} else if (quit_game || hit_mine){
+		return GAME_LOST;
 	}
-	return won_game;
+	return GAME_SUSPENDED;
 }
 
 //function to test if the user has found all mines
@@ -690,142 +4702,963 @@ bool test_if_won(GameState current_game){
 	}
 }
 
-GameState reveal_tile(GameState current_game, char coordinates[2000], int client_socket,  int mines[NUM_TILES_X][NUM_TILES_Y]){
-	int x, y;
-	char *x_char, y_char;
-
-  //convert entered coordinates to integars
-	x_char = &coordinates[1];
-	y_char = coordinates[0];
+//encode the mine positions into the wire format sent on game over
+void encode_mines(const GameState *current_game, int mines[NUM_TILES_X][NUM_TILES_Y]){
+	for (int i = 0; i < NUM_TILES_X; i++){
+		for (int j = 0; j < NUM_TILES_Y; j++){
+			mines[i][j] = tile_bit(current_game->mines, TILE_INDEX(i, j));
+		}
+	}
+}
+
+//convert entered coordinates such as "B3" to tile positions.
+//returns false if they are not on the board.
+bool parse_coordinates(char coordinates[2000], int *x, int *y){
+	char *x_char, y_char;
+
+	x_char = &coordinates[1];
+	y_char = coordinates[0];
+
+	*x = atoi(x_char);
+	*y = y_char - 0x41;
+	return *x >= 0 && *x < NUM_TILES_X && *y >= 0 && *y < NUM_TILES_Y;
+}
+
+//reveal a tile - shared by games and replays
+GameState reveal_tile_at(GameState current_game, int x, int y, char **confirmation){
+  //choose whether tile should be revelaed and reveal all other necessary tiles
+	if (x < 0 || x >= NUM_TILES_X || y < 0 || y >= NUM_TILES_Y){
+		*confirmation = "Those coordinates are not on the board, try again.";
+	} else if (tile_bit(current_game.mines, TILE_INDEX(x, y))){
+		*confirmation = "Game over! You have hit a mine";
+		current_game.hit_mine = true;
+	} else if (tile_bit(current_game.revealed, TILE_INDEX(x, y))){
+		*confirmation = "This tile has already been revealed, try again.";
+	} else{
+		current_game = test_tile(current_game, x, y);
+		*confirmation = "Tiles revealed";
+	}
+	return current_game;
+}
+
+GameState reveal_tile(GameState current_game, char coordinates[2000], int client_socket){
+	int x, y;
+
+  //convert entered coordinates to integars
+	parse_coordinates(coordinates, &x, &y);
+	printf("x: %d\n", x);
+	printf("y: %d\n", y);
+
+	char *confirmation;
+	current_game = reveal_tile_at(current_game, x, y, &confirmation);
+  //sent with its terminating NUL, so the client can tell where it ends when the
+  //mines that follow arrive in the same read
+	net_send(client_socket, confirmation, strlen(confirmation) + 1, 0);
+
+  if (strstr(confirmation, "over")!=NULL){
+    int mines[NUM_TILES_X][NUM_TILES_Y];
+    encode_mines(&current_game, mines);
+    net_send(client_socket, mines, sizeof(int)*NUM_TILES_Y*NUM_TILES_X, 0);
+  }
+
+	return current_game;
+}
+
+//test all border tiles if they need to be revealed
+GameState test_tile(GameState current_game, int x, int y){
+	int index = TILE_INDEX(x, y);
+	if (tile_bit(current_game.mines, index)){
+		return current_game;
+	}
+	if(tile_bit(current_game.revealed, index)){
+		return current_game;
+	} else if (tile_adjacent_mines(current_game.adjacent_mines, index) > 0){
+		set_tile_bit(current_game.revealed, index);
+		return current_game;
+	} else{
+		set_tile_bit(current_game.revealed, index);
+		if (x+1 < NUM_TILES_X){
+			current_game = test_tile(current_game, x+1, y);
+			if (y-1 >= 0){
+				current_game = test_tile(current_game, x+1, y-1);
+			}
+			if (y+1 < NUM_TILES_Y){
+				current_game = test_tile(current_game, x+1, y+1);
+			}
+		}
+		if (y+1 < NUM_TILES_Y){
+			current_game = test_tile(current_game, x, y+1);
+		}
+		if (y-1 >= 0){
+			current_game = test_tile(current_game, x, y-1);
+		}
+		if (x-1 >= 0){
+			current_game = test_tile(current_game, x-1, y);
+			if (y+1 < NUM_TILES_Y){
+				current_game = test_tile(current_game, x-1, y+1);
+			}
+			if (y-1 >= 0){
+				current_game = test_tile(current_game, x-1, y-1);
+			}
+		}
+		return current_game;
+	}
+}
+
+//place a flag - shared by games and replays
+GameState place_flag_at(GameState current_game, int x, int y, char **confirmation){
+	if (x >= 0 && x < NUM_TILES_X && y >= 0 && y < NUM_TILES_Y
+			&& tile_bit(current_game.mines, TILE_INDEX(x, y)) && tile_bit(current_game.flagged, TILE_INDEX(x, y)) == false){
+		set_tile_bit(current_game.flagged, TILE_INDEX(x, y));
+		current_game.num_mines_remaining--;
+		*confirmation = "You have found a mine";
+	} else{
+		*confirmation = "This is not a mine, try again.";
+	}
+	return current_game;
+}
+
+//function to place a flag
+GameState place_flag(GameState current_game, char coordinates[2000], int client_socket){
+
+	int x, y;
+
+	parse_coordinates(coordinates, &x, &y);
+	printf("x: %d\n", x);
+	printf("y: %d\n", y);
+
+	char *confirmation;
+	current_game = place_flag_at(current_game, x, y, &confirmation);
+	net_send(client_socket, confirmation, strlen(confirmation), 0);
+
+	return current_game;
+}
+
+//apply a batch of actions in order, stopping at a mine or once every mine is flagged
+GameState apply_batch(GameState current_game, const BatchAction *actions, int num_actions, MoveLog *move_log, BatchResult *result){
+	*result = (BatchResult){.num_applied = 0, .num_rejected = 0, .outcome = BATCH_CONTINUE};
+	for (int i = 0; i < num_actions && result->outcome == BATCH_CONTINUE; i++){
+		int x = actions[i].x, y = actions[i].y;
+		char *confirmation;
+		GameState previous_game = current_game;
+		bool on_board = x < NUM_TILES_X && y < NUM_TILES_Y;
+		if (actions[i].type == 'R'){
+			if (on_board){
+				move_log_add(move_log, MOVE_REVEAL, x, y);
+			}
+			current_game = reveal_tile_at(current_game, x, y, &confirmation);
+			if (current_game.hit_mine){
+				result->outcome = BATCH_HIT_MINE;
+			}
+		} else if (actions[i].type == 'P'){
+			if (on_board){
+				move_log_add(move_log, MOVE_FLAG, x, y);
+			}
+			current_game = place_flag_at(current_game, x, y, &confirmation);
+			if (test_if_won(current_game)){
+				result->outcome = BATCH_WON;
+			}
+		}
+		result->num_applied++;
+		if (result->outcome == BATCH_CONTINUE && memcmp(&previous_game, &current_game, sizeof(GameState)) == 0){
+			result->num_rejected++;
+		}
+	}
+	return current_game;
+}
+
+//receive a batch move, apply it and send back the combined result and the
+//tiles it changed as a delta frame. returns false if the client dropped.
+bool run_batch(int client_socket, GameSession *session, GameState *current_game, uint64_t *network_ns){
+	int num_actions;
+	uint64_t wait_start = monotonic_ns();
+	if (net_recv(client_socket, &num_actions, sizeof(int), MSG_WAITALL) != sizeof(int)){
+		return false;
+	}
+	//the actions can't be skipped without knowing how many there are, so a
+	//count out of range drops the client as if it had disconnected
+	if (num_actions < 0 || num_actions > MAX_BATCH_ACTIONS){
+		shutdown(client_socket, SHUT_RDWR);
+		return false;
+	}
+	BatchAction *actions = (BatchAction*)malloc((num_actions + 1) * sizeof(BatchAction));
+	if (!actions){
+		fprintf(stderr, "run_batch: out of memory\n");
+		return false;
+	}
+	if (num_actions > 0 && net_recv(client_socket, actions, num_actions * sizeof(BatchAction), MSG_WAITALL) != (ssize_t)(num_actions * sizeof(BatchAction))){
+		free(actions);
+		return false;
+	}
+	*network_ns += monotonic_ns() - wait_start;
+
+	BatchResult result;
+	GameState previous_game = *current_game;
+	*current_game = apply_batch(*current_game, actions, num_actions, &session->move_log, &result);
+	free(actions);
+	atomic_fetch_add(&stats.batches, 1);
+	atomic_fetch_add(&stats.batch_actions, result.num_applied);
+	printf("batch of %d actions: %d applied, %d rejected\n", num_actions, result.num_applied, result.num_rejected);
+
+	SharedFrame *delta = encode_delta(&previous_game, current_game);
+	bool sent = net_send(client_socket, &result, sizeof(result), 0) == sizeof(result) && send_frame(client_socket, delta);
+	frame_release(delta);
+	if (sent && result.outcome == BATCH_HIT_MINE){
+		int mines[NUM_TILES_X][NUM_TILES_Y];
+		encode_mines(current_game, mines);
+		sent = net_send(client_socket, mines, sizeof(int)*NUM_TILES_Y*NUM_TILES_X, 0) > 0;
+	}
+	return sent;
+}
+
+/* a board many players share at once. the revealed and flagged tiles are */
+/* atomic bitboards, so moves never wait on each other: a tile belongs to  */
+/* whichever move sets its bit first, and a flood reveal only spreads from */
+/* the tiles it claimed. the mines and adjacent mine counts never change   */
+/* once the board is made. the tiles each move changes are broadcast to    */
+/* every player as one refcounted frame, queued like a spectator's.        */
+typedef struct shared_player {
+    SharedFrame *queue[SHARED_QUEUE_MAX];
+    int queue_head;
+    int queue_count;
+    bool needs_view;        /* fell behind or moved its view - send the view whole */
+    struct shared_player *next;
+} SharedPlayer;
+
+typedef struct {
+    atomic_int refcount;
+    int width;
+    int height;
+    int num_mines;
+    atomic_int num_mines_remaining;
+    atomic_bool cleared;                /* every mine has been flagged */
+    uint8_t *mines;                     /* bitset, fixed once made     */
+    uint8_t *adjacent_mines;            /* nibbles, fixed once made    */
+    _Atomic uint64_t *revealed;
+    _Atomic uint64_t *flagged;
+    pthread_mutex_t players_mutex;      /* guards the players and their queues */
+    SharedPlayer *players;
+    int num_players;
+} SharedBoard;
+
+/* the board new players join. replaced by a fresh one once it is cleared. */
+SharedBoard *shared_board = NULL;
+pthread_mutex_t shared_board_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* set the bit for a tile, true if this call was the one that set it */
+static inline bool claim_tile_bit(_Atomic uint64_t *bits, int index){
+    uint64_t mask = 1ULL << (index & 63);
+    return (atomic_fetch_or_explicit(&bits[index >> 6], mask, memory_order_acq_rel) & mask) == 0;
+}
+
+static inline bool shared_tile_bit(_Atomic uint64_t *bits, int index){
+    return (atomic_load_explicit(&bits[index >> 6], memory_order_acquire) >> (index & 63)) & 1;
+}
+
+SharedBoard *shared_board_create(int width, int height, int num_mines){
+    int num_tiles = width * height;
+    int num_words = (num_tiles + 63) / 64;
+    SharedBoard *board = (SharedBoard*)calloc(1, sizeof(SharedBoard));
+    if (board) {
+        board->mines = (uint8_t*)calloc((num_tiles + 7) / 8, 1);
+        board->adjacent_mines = (uint8_t*)calloc((num_tiles + 1) / 2, 1);
+        board->revealed = (_Atomic uint64_t*)calloc(num_words, sizeof(uint64_t));
+        board->flagged = (_Atomic uint64_t*)calloc(num_words, sizeof(uint64_t));
+    }
+    if (!board || !board->mines || !board->adjacent_mines || !board->revealed || !board->flagged) {
+        fprintf(stderr, "shared_board_create: out of memory\n");
+        exit(1);
+    }
+    atomic_init(&board->refcount, 1);
+    board->width = width;
+    board->height = height;
+    board->num_mines = num_mines;
+    atomic_init(&board->num_mines_remaining, num_mines);
+    atomic_init(&board->cleared, false);
+    pthread_mutex_init(&board->players_mutex, NULL);
+
+    unsigned int seed;
+    getrandom(&seed, sizeof(seed), 0);
+    for (int placed = 0; placed < num_mines; ) {
+        int x = rand_r(&seed) % width, y = rand_r(&seed) % height;
+        if (tile_bit(board->mines, y * width + x)) {
+            continue;
+        }
+        set_tile_bit(board->mines, y * width + x);
+        placed++;
+        for (int j = y - 1; j <= y + 1; j++) {
+            for (int i = x - 1; i <= x + 1; i++) {
+                if (i >= 0 && i < width && j >= 0 && j < height && (i != x || j != y)) {
+                    increment_adjacent_mines(board->adjacent_mines, j * width + i);
+                }
+            }
+        }
+    }
+    return board;
+}
+
+void shared_board_release(SharedBoard *board){
+    if (atomic_fetch_sub_explicit(&board->refcount, 1, memory_order_acq_rel) == 1) {
+        pthread_mutex_destroy(&board->players_mutex);
+        free(board->mines);
+        free(board->adjacent_mines);
+        free((void*)board->revealed);
+        free((void*)board->flagged);
+        free(board);
+    }
+}
+
+/* add a player to the current board, starting a new one if it has been cleared */
+SharedBoard *shared_board_join(SharedPlayer *player){
+    pthread_mutex_lock(&shared_board_mutex);
+    if (shared_board == NULL || atomic_load(&shared_board->cleared)) {
+        if (shared_board != NULL) {
+            shared_board_release(shared_board);
+        }
+        shared_board = shared_board_create(shared_board_width, shared_board_height, shared_board_mines);
+    }
+    SharedBoard *board = shared_board;
+    atomic_fetch_add_explicit(&board->refcount, 1, memory_order_relaxed);
+    pthread_mutex_unlock(&shared_board_mutex);
+
+    pthread_mutex_lock(&board->players_mutex);
+    player->next = board->players;
+    board->players = player;
+    board->num_players++;
+    pthread_mutex_unlock(&board->players_mutex);
+    return board;
+}
+
+void shared_board_leave(SharedBoard *board, SharedPlayer *player){
+    pthread_mutex_lock(&board->players_mutex);
+    SharedPlayer **p = &board->players;
+    while (*p != player) {
+        p = &(*p)->next;
+    }
+    *p = player->next;
+    board->num_players--;
+    while (player->queue_count > 0) {
+        frame_release(player->queue[player->queue_head]);
+        player->queue_head = (player->queue_head + 1) % SHARED_QUEUE_MAX;
+        player->queue_count--;
+    }
+    pthread_mutex_unlock(&board->players_mutex);
+    shared_board_release(board);
+}
+
+/* code for a shared tile as players see it. a revealed mine is one a player hit. */
+int shared_tile_code(SharedBoard *board, int index){
+    if (shared_tile_bit(board->flagged, index)) {
+        return TILE_CODE_FLAG;
+    } else if (shared_tile_bit(board->revealed, index)) {
+        return tile_bit(board->mines, index) ? TILE_CODE_MINE : tile_adjacent_mines(board->adjacent_mines, index);
+    }
+    return TILE_CODE_HIDDEN;
+}
+
+/* growable list of the tiles a move changed */
+typedef struct {
+    SharedTileChange *changes;
+    int num_changes;
+    int capacity;
+} SharedChanges;
+
+static void add_shared_change(SharedChanges *changes, int index, int code){
+    if (changes->num_changes == changes->capacity) {
+        changes->capacity = changes->capacity ? 2 * changes->capacity : 64;
+        changes->changes = (SharedTileChange*)realloc(changes->changes, changes->capacity * sizeof(SharedTileChange));
+        if (!changes->changes) {
+            fprintf(stderr, "add_shared_change: out of memory\n");
+            exit(1);
+        }
+    }
+    changes->changes[changes->num_changes++] = (SharedTileChange){.index = index, .code = code};
+}
+
+/* make room for at least capacity changes */
+static void reserve_shared_changes(SharedChanges *changes, int capacity){
+    if (capacity > changes->capacity) {
+        changes->capacity = capacity;
+        changes->changes = (SharedTileChange*)realloc(changes->changes, capacity * sizeof(SharedTileChange));
+        if (!changes->changes) {
+            fprintf(stderr, "reserve_shared_changes: out of memory\n");
+            exit(1);
+        }
+    }
+}
+
+/* a large flood reveal can be spread over a pool of threads. the board is    */
+/* split into square blocks and the flood runs in rounds: each thread takes a */
+/* block with tiles to spread from and floods it on its own, keeping to the   */
+/* block. a zero tile it reveals in a neighbouring block is left as a seed    */
+/* for the next round. tiles are claimed in the shared bitboard as before, so */
+/* threads never reveal the same tile twice and the tiles revealed are just   */
+/* those a serial flood would reveal, only in a different order.             */
+typedef struct {
+    SharedChanges changes;      /* tiles this thread revealed in the reveal */
+    SharedChanges seeds;        /* zero tiles it revealed in other blocks   */
+    SharedChanges stack;
+} RevealWorker;
+
+typedef struct {
+    pthread_mutex_t mutex;      /* held by the session using the pool */
+    pthread_barrier_t barrier;  /* start and end of each round        */
+    int num_threads;            /* including the session's own thread */
+    pthread_t *threads;
+    RevealWorker *workers;
+    bool stopping;
+    /* the round being run */
+    SharedBoard *board;
+    int *seeds;                 /* grouped by block                   */
+    int *unit_starts;           /* where each block's seeds start     */
+    int num_units;
+    atomic_int next_unit;
+} RevealPool;
+
+RevealPool reveal_pool = {.mutex = PTHREAD_MUTEX_INITIALIZER, .num_threads = 0};
+
+static inline int reveal_block(int index, int width, int blocks_x){
+    return (index / width / REVEAL_BLOCK_SIZE) * blocks_x + index % width / REVEAL_BLOCK_SIZE;
+}
+
+/* flood the blocks of this round until none are left to take */
+void reveal_pool_work(RevealWorker *worker){
+    SharedBoard *board = reveal_pool.board;
+    int unit;
+    while ((unit = atomic_fetch_add_explicit(&reveal_pool.next_unit, 1, memory_order_relaxed)) < reveal_pool.num_units) {
+        int first = reveal_pool.seeds[reveal_pool.unit_starts[unit]];
+        int min_x = first % board->width / REVEAL_BLOCK_SIZE * REVEAL_BLOCK_SIZE;
+        int min_y = first / board->width / REVEAL_BLOCK_SIZE * REVEAL_BLOCK_SIZE;
+        worker->stack.num_changes = 0;
+        for (int i = reveal_pool.unit_starts[unit]; i < reveal_pool.unit_starts[unit + 1]; i++) {
+            add_shared_change(&worker->stack, reveal_pool.seeds[i], 0);
+        }
+        while (worker->stack.num_changes > 0) {
+            int from = worker->stack.changes[--worker->stack.num_changes].index;
+            int from_x = from % board->width, from_y = from / board->width;
+            for (int j = from_y - 1; j <= from_y + 1; j++) {
+                for (int i = from_x - 1; i <= from_x + 1; i++) {
+                    if (i < 0 || i >= board->width || j < 0 || j >= board->height) {
+                        continue;
+                    }
+                    int neighbour = j * board->width + i;
+                    if (tile_bit(board->mines, neighbour) || !claim_tile_bit(board->revealed, neighbour)) {
+                        continue;
+                    }
+                    int code = tile_adjacent_mines(board->adjacent_mines, neighbour);
+                    add_shared_change(&worker->changes, neighbour, code);
+                    if (code != 0) {
+                        continue;
+                    }
+                    bool in_block = i >= min_x && i < min_x + REVEAL_BLOCK_SIZE && j >= min_y && j < min_y + REVEAL_BLOCK_SIZE;
+                    add_shared_change(in_block ? &worker->stack : &worker->seeds, neighbour, 0);
+                }
+            }
+        }
+    }
+}
+
+void *reveal_pool_loop(void *data){
+    RevealWorker *worker = (RevealWorker*)data;
+    while (1) {
+        pthread_barrier_wait(&reveal_pool.barrier);
+        if (reveal_pool.stopping) {
+            return NULL;
+        }
+        reveal_pool_work(worker);
+        pthread_barrier_wait(&reveal_pool.barrier);
+    }
+}
+
+/* start a pool of num_threads threads for flood reveals, counting the thread that asks for one */
+void reveal_pool_start(int num_threads){
+    reveal_pool.num_threads = num_threads;
+    reveal_pool.stopping = false;
+    reveal_pool.threads = (pthread_t*)calloc(num_threads, sizeof(pthread_t));
+    reveal_pool.workers = (RevealWorker*)calloc(num_threads, sizeof(RevealWorker));
+    if (!reveal_pool.threads || !reveal_pool.workers) {
+        fprintf(stderr, "reveal_pool_start: out of memory\n");
+        exit(1);
+    }
+    pthread_barrier_init(&reveal_pool.barrier, NULL, num_threads);
+    for (int i = 1; i < num_threads; i++) {
+        pthread_create(&reveal_pool.threads[i], NULL, reveal_pool_loop, &reveal_pool.workers[i]);
+    }
+}
+
+void reveal_pool_stop(void){
+    pthread_mutex_lock(&reveal_pool.mutex);
+    reveal_pool.stopping = true;
+    pthread_barrier_wait(&reveal_pool.barrier);
+    for (int i = 1; i < reveal_pool.num_threads; i++) {
+        pthread_join(reveal_pool.threads[i], NULL);
+    }
+    for (int i = 0; i < reveal_pool.num_threads; i++) {
+        free(reveal_pool.workers[i].changes.changes);
+        free(reveal_pool.workers[i].seeds.changes);
+        free(reveal_pool.workers[i].stack.changes);
+    }
+    pthread_barrier_destroy(&reveal_pool.barrier);
+    free(reveal_pool.threads);
+    free(reveal_pool.workers);
+    reveal_pool.num_threads = 0;
+    pthread_mutex_unlock(&reveal_pool.mutex);
+}
+
+/* finish a flood on the pool, spreading from the zero tiles in changes from */
+/* first on. false if there is no pool or another session is using it.      */
+bool reveal_pool_flood(SharedBoard *board, SharedChanges *changes, int first){
+    if (reveal_pool.num_threads == 0 || pthread_mutex_trylock(&reveal_pool.mutex) != 0) {
+        return false;
+    }
+    int blocks_x = (board->width + REVEAL_BLOCK_SIZE - 1) / REVEAL_BLOCK_SIZE;
+    int num_blocks = blocks_x * ((board->height + REVEAL_BLOCK_SIZE - 1) / REVEAL_BLOCK_SIZE);
+    int *block_counts = (int*)calloc(num_blocks, sizeof(int));
+    SharedChanges seeds = {.changes = NULL, .num_changes = 0, .capacity = 0};
+    for (int i = first; i < changes->num_changes; i++) {
+        if (changes->changes[i].code == 0) {
+            add_shared_change(&seeds, changes->changes[i].index, 0);
+        }
+    }
+    reveal_pool.board = board;
+    for (int i = 0; i < reveal_pool.num_threads; i++) {
+        reveal_pool.workers[i].changes.num_changes = 0;
+    }
+
+    while (seeds.num_changes > 0) {
+        /* group the seeds by block, one unit of work per block */
+        reveal_pool.seeds = (int*)malloc(seeds.num_changes * sizeof(int));
+        reveal_pool.unit_starts = (int*)malloc((seeds.num_changes + 1) * sizeof(int));
+        if (!block_counts || !reveal_pool.seeds || !reveal_pool.unit_starts) {
+            fprintf(stderr, "reveal_pool_flood: out of memory\n");
+            exit(1);
+        }
+        for (int i = 0; i < seeds.num_changes; i++) {
+            block_counts[reveal_block(seeds.changes[i].index, board->width, blocks_x)]++;
+        }
+        int num_units = 0, offset = 0;
+        for (int block = 0; block < num_blocks; block++) {
+            if (block_counts[block] > 0) {
+                reveal_pool.unit_starts[num_units++] = offset;
+                int count = block_counts[block];
+                block_counts[block] = offset;
+                offset += count;
+            }
+        }
+        reveal_pool.unit_starts[num_units] = offset;
+        for (int i = 0; i < seeds.num_changes; i++) {
+            reveal_pool.seeds[block_counts[reveal_block(seeds.changes[i].index, board->width, blocks_x)]++] = seeds.changes[i].index;
+        }
+        memset(block_counts, 0, num_blocks * sizeof(int));
+        reveal_pool.num_units = num_units;
+        atomic_store(&reveal_pool.next_unit, 0);
+
+        /* run the round, then gather the seeds it left in other blocks */
+        pthread_barrier_wait(&reveal_pool.barrier);
+        reveal_pool_work(&reveal_pool.workers[0]);
+        pthread_barrier_wait(&reveal_pool.barrier);
+        free(reveal_pool.seeds);
+        free(reveal_pool.unit_starts);
+        seeds.num_changes = 0;
+        for (int i = 0; i < reveal_pool.num_threads; i++) {
+            SharedChanges *worker_seeds = &reveal_pool.workers[i].seeds;
+            reserve_shared_changes(&seeds, seeds.num_changes + worker_seeds->num_changes);
+            memcpy(seeds.changes + seeds.num_changes, worker_seeds->changes, worker_seeds->num_changes * sizeof(SharedTileChange));
+            seeds.num_changes += worker_seeds->num_changes;
+            worker_seeds->num_changes = 0;
+        }
+    }
+
+    for (int i = 0; i < reveal_pool.num_threads; i++) {
+        SharedChanges *worker_changes = &reveal_pool.workers[i].changes;
+        reserve_shared_changes(changes, changes->num_changes + worker_changes->num_changes);
+        memcpy(changes->changes + changes->num_changes, worker_changes->changes, worker_changes->num_changes * sizeof(SharedTileChange));
+        changes->num_changes += worker_changes->num_changes;
+    }
+    free(seeds.changes);
+    free(block_counts);
+    pthread_mutex_unlock(&reveal_pool.mutex);
+    return true;
+}
+
+/* reveal a tile and flood out from it over the tiles no other move has claimed */
+int shared_reveal(SharedBoard *board, int x, int y, SharedChanges *changes){
+    if (x < 0 || x >= board->width || y < 0 || y >= board->height) {
+        return SHARED_OFF_BOARD;
+    }
+    int index = y * board->width + x;
+    if (shared_tile_bit(board->flagged, index)) {
+        return SHARED_ALREADY;
+    }
+    if (tile_bit(board->mines, index)) {
+        if (claim_tile_bit(board->revealed, index)) {
+            add_shared_change(changes, index, shared_tile_code(board, index));
+        }
+        return SHARED_HIT_MINE;
+    }
+    if (!claim_tile_bit(board->revealed, index)) {
+        return SHARED_ALREADY;
+    }
+    add_shared_change(changes, index, tile_adjacent_mines(board->adjacent_mines, index));
+
+    /* the changes so far double as the list of tiles to spread from. once */
+    /* the flood is big enough, the pool takes over if there is one free.  */
+    int first = changes->num_changes - 1;
+    for (int next = first; next < changes->num_changes; next++) {
+        if (next - first == PARALLEL_REVEAL_MIN && reveal_pool_flood(board, changes, next)) {
+            break;
+        }
+        int from = changes->changes[next].index;
+        if (changes->changes[next].code != 0) {
+            continue;
+        }
+        int from_x = from % board->width, from_y = from / board->width;
+        for (int j = from_y - 1; j <= from_y + 1; j++) {
+            for (int i = from_x - 1; i <= from_x + 1; i++) {
+                if (i < 0 || i >= board->width || j < 0 || j >= board->height) {
+                    continue;
+                }
+                int neighbour = j * board->width + i;
+                if (!tile_bit(board->mines, neighbour) && claim_tile_bit(board->revealed, neighbour)) {
+                    add_shared_change(changes, neighbour, tile_adjacent_mines(board->adjacent_mines, neighbour));
+                }
+            }
+        }
+    }
+    return SHARED_OK;
+}
+
+int shared_flag(SharedBoard *board, int x, int y, SharedChanges *changes){
+    if (x < 0 || x >= board->width || y < 0 || y >= board->height) {
+        return SHARED_OFF_BOARD;
+    }
+    int index = y * board->width + x;
+    if (!tile_bit(board->mines, index)) {
+        return SHARED_NOT_MINE;
+    } else if (!claim_tile_bit(board->flagged, index)) {
+        return SHARED_ALREADY;
+    }
+    add_shared_change(changes, index, TILE_CODE_FLAG);
+    if (atomic_fetch_sub(&board->num_mines_remaining, 1) == 1) {
+        atomic_store(&board->cleared, true);
+        return SHARED_CLEARED;
+    }
+    return SHARED_OK;
+}
+
+/* queue the tiles a move changed for every player on the board */
+void shared_board_publish(SharedBoard *board, const SharedChanges *changes){
+    int size = changes->num_changes * sizeof(SharedTileChange);
+    SharedFrame *frame = (SharedFrame*)malloc(sizeof(SharedFrame) + size);
+    if (!frame) {
+        fprintf(stderr, "shared_board_publish: out of memory\n");
+        exit(1);
+    }
+    atomic_init(&frame->refcount, 1);
+    frame->size = size;
+    memcpy(frame->data, changes->changes, size);
+
+    pthread_mutex_lock(&board->players_mutex);
+    for (SharedPlayer *player = board->players; player; player = player->next) {
+        if (player->queue_count == SHARED_QUEUE_MAX) {
+            /* too far behind - the view it is sent next replaces the queue */
+            while (player->queue_count > 0) {
+                frame_release(player->queue[player->queue_head]);
+                player->queue_head = (player->queue_head + 1) % SHARED_QUEUE_MAX;
+                player->queue_count--;
+            }
+            player->needs_view = true;
+            continue;
+        }
+        atomic_fetch_add_explicit(&frame->refcount, 1, memory_order_relaxed);
+        player->queue[(player->queue_head + player->queue_count) % SHARED_QUEUE_MAX] = frame;
+        player->queue_count++;
+    }
+    pthread_mutex_unlock(&board->players_mutex);
+    frame_release(frame);
+}
+
+/* keep a view's corner where the whole view is on the board */
+static int clamp_view(int corner, int size){
+    return corner < 0 ? 0 : corner > size - SHARED_VIEW_SIZE ? size - SHARED_VIEW_SIZE : corner;
+}
 
-	x = atoi(x_char);
-	printf("x: %d\n", x);
-	y = y_char - 0x41;
-	printf("y: %d\n", y);
+/* reply to a player's command with every change made since its last one, */
+/* sent straight from the shared frames, and its view if it needs one     */
+bool send_shared_reply(int client_socket, SharedBoard *board, SharedPlayer *player, SharedMoveReply *reply, int view_x, int view_y, bool view_moved){
+    SharedFrame *frames[SHARED_QUEUE_MAX];
+    int num_frames = 0;
+    pthread_mutex_lock(&board->players_mutex);
+    while (player->queue_count > 0) {
+        frames[num_frames++] = player->queue[player->queue_head];
+        player->queue_head = (player->queue_head + 1) % SHARED_QUEUE_MAX;
+        player->queue_count--;
+    }
+    bool send_view = player->needs_view || view_moved;
+    player->needs_view = false;
+    reply->num_players = board->num_players;
+    pthread_mutex_unlock(&board->players_mutex);
 
-	char *confirmation;
+    struct iovec iov[SHARED_QUEUE_MAX + 2];
+    int num_iov = 1;
+    reply->mines_remaining = atomic_load(&board->num_mines_remaining);
+    reply->num_changes = 0;
+    reply->has_view = send_view;
+    for (int i = 0; i < num_frames; i++) {
+        reply->num_changes += frames[i]->size / sizeof(SharedTileChange);
+        iov[num_iov++] = (struct iovec){.iov_base = frames[i]->data, .iov_len = frames[i]->size};
+    }
+    iov[0] = (struct iovec){.iov_base = reply, .iov_len = sizeof(SharedMoveReply)};
+    /* read after taking the frames, so a change in both is just applied twice */
+    uint8_t view[SHARED_VIEW_SIZE * SHARED_VIEW_SIZE];
+    if (send_view) {
+        for (int j = 0; j < SHARED_VIEW_SIZE; j++) {
+            for (int i = 0; i < SHARED_VIEW_SIZE; i++) {
+                view[j * SHARED_VIEW_SIZE + i] = shared_tile_code(board, (view_y + j) * board->width + view_x + i);
+            }
+        }
+        iov[num_iov++] = (struct iovec){.iov_base = view, .iov_len = sizeof(view)};
+    }
+    bool sent = net_sendv(client_socket, iov, num_iov) >= 0;
+    for (int i = 0; i < num_frames; i++) {
+        frame_release(frames[i]);
+    }
+    return sent;
+}
 
-  //choose whether tile should be revelaed and reveal all other necessary tiles
-	if (current_game.tiles[x][y].is_mine){
-		confirmation = "Game over! You have hit a mine";
-		current_game.hit_mine = true;
-	} else if (current_game.tiles[x][y].revealed){
-		confirmation = "This tile has already been revealed, try again.";
-	} else{
-		current_game = test_tile(current_game, x, y);
-		confirmation = "Tiles revealed";
-	}
-	send(client_socket, confirmation, strlen(confirmation), 0);
+/* play on the shared board until the player quits, hits a mine or it is cleared */
+void run_shared_board(int client_socket){
+    printf("Running shared board\n");
+    SharedBoardInfo info = {.width = 0};
+    if (shared_board_width == 0) {
+        net_send(client_socket, &info, sizeof(info), 0);
+        return;
+    }
+    SharedPlayer player = {.queue_head = 0, .queue_count = 0, .needs_view = true};
+    SharedBoard *board = shared_board_join(&player);
+    info = (SharedBoardInfo){.width = board->width, .height = board->height, .num_mines = board->num_mines};
+    net_send(client_socket, &info, sizeof(info), 0);
 
-  if (strstr(confirmation, "over")!=NULL){
-    send(client_socket, mines, sizeof(int)*NUM_TILES_Y*NUM_TILES_X, 0);
-  }
+    SharedMoveReply reply = {.tiles_revealed = 0, .mines_flagged = 0};
+    SharedChanges changes = {.changes = NULL, .num_changes = 0, .capacity = 0};
+    int view_x = -1, view_y = -1;
+    while (1) {
+        SharedCommand command;
+        arm_idle_timeout(client_socket, game_timeout);
+        if (net_recv(client_socket, &command, sizeof(command), MSG_WAITALL) != sizeof(command) || command.type == 'Q') {
+            break;
+        }
+        reply.result = SHARED_OK;
+        changes.num_changes = 0;
+        if (atomic_load(&board->cleared)) {
+            reply.result = SHARED_CLEARED;
+        } else if (command.type == 'R' || command.type == 'P') {
+            if (!take_token(&client_limits->moves, MOVE_RATE, MOVE_BURST)) {
+                reply.result = SHARED_LIMIT;
+                atomic_fetch_add(&stats.moves_rate_limited, 1);
+            } else if (command.type == 'R') {
+                reply.result = shared_reveal(board, command.x, command.y, &changes);
+                reply.tiles_revealed += reply.result == SHARED_OK ? changes.num_changes : 0;
+            } else {
+                reply.result = shared_flag(board, command.x, command.y, &changes);
+                reply.mines_flagged += changes.num_changes;
+            }
+            if (changes.num_changes > 0) {
+                shared_board_publish(board, &changes);
+            }
+            atomic_fetch_add(&stats.shared_moves, 1);
+        }
+        int new_view_x = clamp_view(command.view_x, board->width);
+        int new_view_y = clamp_view(command.view_y, board->height);
+        bool view_moved = new_view_x != view_x || new_view_y != view_y;
+        view_x = new_view_x;
+        view_y = new_view_y;
+        if (!send_shared_reply(client_socket, board, &player, &reply, view_x, view_y, view_moved)
+                || reply.result == SHARED_HIT_MINE || reply.result == SHARED_CLEARED) {
+            break;
+        }
+    }
+    free(changes.changes);
+    shared_board_leave(board, &player);
+}
 
-	return current_game;
+//drop a reference to a leaderboard snapshot, closing it with the last one
+void leaderboard_snapshot_release(LeaderboardSnapshot *snapshot){
+	if (atomic_fetch_sub_explicit(&snapshot->refcount, 1, memory_order_acq_rel) == 1){
+		close(snapshot->fd);
+		free(snapshot->offsets);
+		free(snapshot);
+	}
 }
 
-//test all border tiles if they need to be revealed
-GameState test_tile(GameState current_game, int x, int y){
-	if (current_game.tiles[x][y].is_mine){
-		return current_game;
+//write every leaderboard line to a new memory backed file. call with lb_mutex held.
+LeaderboardSnapshot *build_leaderboard_snapshot(unsigned long generation){
+	LeaderboardSnapshot *snapshot = (LeaderboardSnapshot*)malloc(sizeof(LeaderboardSnapshot));
+	off_t *offsets = (off_t*)malloc((num_leaderboard_entries + 1) * sizeof(off_t));
+	int fd = memfd_create("leaderboard", MFD_CLOEXEC);
+	if (!snapshot || !offsets || fd < 0){
+		perror("build_leaderboard_snapshot");
+		free(snapshot);
+		free(offsets);
+		if (fd >= 0){
+			close(fd);
+		}
+		return NULL;
 	}
-	if(current_game.tiles[x][y].revealed){
-		return current_game;
-	} else if (current_game.tiles[x][y].adjacent_mines > 0){
-		current_game.tiles[x][y].revealed = true;
-		return current_game;
-	} else{
-		current_game.tiles[x][y].revealed = true;
-		if (x+1 < NUM_TILES_X){
-			current_game = test_tile(current_game, x+1, y);
-			if (y-1 >= 0){
-				current_game = test_tile(current_game, x+1, y-1);
-			}
-			if (y+1 < NUM_TILES_Y){
-				current_game = test_tile(current_game, x+1, y+1);
+
+	//format the lines into a buffer and write it out a page or so at a time
+	char buffer[8192];
+	int buffered = 0, num_lines = 0;
+	off_t size = 0;
+	for (entry *p = head; p != NULL && num_lines < num_leaderboard_entries; p = p->next){
+		if (buffered > (int)sizeof(buffer) - 2000){
+			if (write(fd, buffer, buffered) != buffered){
+				perror("build_leaderboard_snapshot");
 			}
+			buffered = 0;
 		}
-		if (y+1 < NUM_TILES_Y){
-			current_game = test_tile(current_game, x, y+1);
-		}
-		if (y-1 >= 0){
-			current_game = test_tile(current_game, x, y-1);
-		}
-		if (x-1 >= 0){
-			current_game = test_tile(current_game, x-1, y);
-			if (y+1 < NUM_TILES_Y){
-				current_game = test_tile(current_game, x-1, y+1);
-			}
-			if (y-1 >= 0){
-				current_game = test_tile(current_game, x-1, y-1);
-			}
+		offsets[num_lines++] = size;
+		int length = snprintf(&buffer[buffered], 2000, "%s \t\t %.3f seconds \t %d games won, %d games played\n", p->user->name, p->time_taken / 1e9, user_games_won(p->user), user_games_played(p->user));
+		if (length > 1999){
+			length = 1999;
 		}
-		return current_game;
+		buffered += length;
+		size += length;
 	}
-}
-
-//function to place a flag
-GameState place_flag(GameState current_game, char coordinates[2000], int client_socket){
-
-	int x, y;
-	char *x_char, y_char;
-
-	x_char = &coordinates[1];
-	y_char = coordinates[0];
-
-	x = atoi(x_char);
-	printf("x: %d\n", x);
-	y = y_char - 0x41;
-	printf("y: %d\n", y);
+	if (buffered > 0 && write(fd, buffer, buffered) != buffered){
+		perror("build_leaderboard_snapshot");
+	}
+	offsets[num_lines] = size;
 
-	char *confirmation;
+	atomic_init(&snapshot->refcount, 1);
+	snapshot->generation = generation;
+	snapshot->fd = fd;
+	snapshot->num_lines = num_lines;
+	snapshot->offsets = offsets;
+	atomic_fetch_add(&stats.leaderboard_snapshots, 1);
+	return snapshot;
+}
 
-	if (current_game.tiles[x][y].is_mine && current_game.tiles[x][y].is_flagged == false){
-		current_game.tiles[x][y].is_flagged = true;
-		current_game.num_mines_remaining--;
-		confirmation = "You have found a mine";
-	} else{
-		confirmation = "This is not a mine, try again.";
+//a reference to an up to date leaderboard snapshot, rebuilding it if the leaderboard has changed
+LeaderboardSnapshot *get_leaderboard_snapshot(void){
+	pthread_mutex_lock(&lb_mutex);
+	unsigned long generation = atomic_load_explicit(&leaderboard_generation, memory_order_acquire);
+	if (leaderboard_snapshot == NULL || leaderboard_snapshot->generation != generation){
+		LeaderboardSnapshot *snapshot = build_leaderboard_snapshot(generation);
+		if (snapshot != NULL){
+			if (leaderboard_snapshot != NULL){
+				leaderboard_snapshot_release(leaderboard_snapshot);
+			}
+			leaderboard_snapshot = snapshot;
+		}
 	}
-	send(client_socket, confirmation, strlen(confirmation), 0);
-
-	return current_game;
+	LeaderboardSnapshot *snapshot = leaderboard_snapshot;
+	if (snapshot != NULL){
+		atomic_fetch_add_explicit(&snapshot->refcount, 1, memory_order_relaxed);
+	}
+	pthread_mutex_unlock(&lb_mutex);
+	return snapshot;
 }
 
 //run the leaderboard function
 void run_leaderboard(int client_socket){
 	printf("Running leaderboard\n");
-	char leaderboard_string[2000];
-	char confirmation[80];
-	entry *p;
-	p = head;
+	char confirmation[2000];
+	LeaderboardSnapshot *snapshot = get_leaderboard_snapshot();
+	int num_lines = snapshot ? snapshot->num_lines : 0;
   //send number of entries in the leaderboard
-	send(client_socket, &num_leaderboard_entries, sizeof(int), 0);
-	pthread_mutex_lock(&mutex);
-	if (p == NULL){
+	net_send(client_socket, &num_lines, sizeof(int), 0);
+	if (num_lines == 0){
       printf("^\n");
-	     pthread_mutex_unlock(&mutex);
   } else {
-    //send all lines in leaderboard
-    while(p->next) {
-            snprintf(leaderboard_string, 2000*sizeof(char), "%s%s \t\t %ld seconds \t %d games won, %d games played\n", leaderboard_string, p->user->name, p->time_taken, p->user->num_games_won, p->user->num_games_played);
-            send(client_socket, leaderboard_string, strlen(leaderboard_string), 0);
-            recv(client_socket, confirmation, 2000*sizeof(char), 0);
-            memset(leaderboard_string, 0, strlen(leaderboard_string));
-            p = p->next ;
+    //send all lines in leaderboard straight from the snapshot
+    for (int i = 0; i < num_lines; i++){
+        off_t offset = snapshot->offsets[i];
+        size_t length = snapshot->offsets[i + 1] - offset;
+        if (net_sendfile(client_socket, snapshot->fd, &offset, length) < 0
+                || net_recv(client_socket, confirmation, 2000*sizeof(char), 0) <= 0){
+            break;
         }
-        snprintf(leaderboard_string, 2000*sizeof(char), "%s%s \t\t %ld seconds \t %d games won, %d games played\n", leaderboard_string, p->user->name, p->time_taken, p->user->num_games_won, p->user->num_games_played);
-        send(client_socket, leaderboard_string, strlen(leaderboard_string), 0);
-        recv(client_socket, confirmation, 2000*sizeof(char), 0);
-        memset(leaderboard_string, 0, strlen(leaderboard_string));
-   	}
+    }
+  }
+	if (snapshot != NULL){
+		leaderboard_snapshot_release(snapshot);
+	}
+}
 
-	pthread_mutex_unlock(&mutex);
+//fill in a row of a query reply from a leaderboard entry
+static void fill_leaderboard_row(LeaderboardRow *row, entry *p, int rank){
+	memset(row, 0, sizeof(LeaderboardRow));
+	row->rank = rank;
+	snprintf(row->name, sizeof(row->name), "%s", p->user->name);
+	row->time_taken = p->time_taken;
+	row->games_won = user_games_won(p->user);
+	row->games_played = user_games_played(p->user);
+	row->width = p->width;
+	row->height = p->height;
+	row->num_mines = p->num_mines;
+}
+
+//answer a query for a page of the leaderboard or the user's own best entry,
+//on every board or just one, of all time, today or this week. ranks come from
+//the index so only the rows sent are visited.
+void run_leaderboard_query(int client_socket, int logged_in_user){
+	LeaderboardQuery query;
+	if (net_recv(client_socket, &query, sizeof(LeaderboardQuery), MSG_WAITALL) != sizeof(LeaderboardQuery)){
+		return;
+	}
+	printf("Running leaderboard query\n");
+	LeaderboardReply reply = {.total = 0, .num_rows = 0};
+	if (!take_token(&client_limits->leaderboard, LEADERBOARD_RATE, LEADERBOARD_BURST)){
+		reply.total = -1;
+		atomic_fetch_add(&stats.leaderboards_rate_limited, 1);
+		net_send(client_socket, &reply, sizeof(LeaderboardReply), 0);
+		return;
+	}
+	if (query.limit > LEADERBOARD_PAGE_MAX){
+		query.limit = LEADERBOARD_PAGE_MAX;
+	}
+	if (query.window < 0 || query.window >= NUM_LEADERBOARD_WINDOWS){
+		query.window = LEADERBOARD_ALL_TIME;
+	}
+
+	//the reply and its rows go out in one send, built off the session's stack
+	uint8_t *buffer = (uint8_t*)malloc(sizeof(LeaderboardReply) + LEADERBOARD_PAGE_MAX * sizeof(LeaderboardRow));
+	if (!buffer){
+		perror("run_leaderboard_query");
+		net_send(client_socket, &reply, sizeof(LeaderboardReply), 0);
+		return;
+	}
+	LeaderboardRow *rows = (LeaderboardRow*)(buffer + sizeof(LeaderboardReply));
+	pthread_mutex_lock(&lb_mutex);
+	LeaderboardBoard *board = leaderboard_board(query.width, query.height, query.num_mines, false);
+	LeaderboardIndex *index = board ? leaderboard_window(board, query.window, time(NULL)) : NULL;
+	if (index != NULL && index->root != NULL){
+		int slot = index->slot;
+		reply.total = subtree_size(index->root, slot);
+		if (query.type == LEADERBOARD_QUERY_MINE){
+			entry *best = leaderboard_best(index, logged_in_user);
+			if (best != NULL){
+				fill_leaderboard_row(&rows[reply.num_rows++], best, leaderboard_rank(index, best));
+			}
+		} else if (query.offset >= 0){
+			entry *p = leaderboard_select(index, query.offset);
+			for (; p != NULL && reply.num_rows < query.limit; p = leaderboard_successor(index, p)){
+				fill_leaderboard_row(&rows[reply.num_rows], p, query.offset + reply.num_rows + 1);
+				reply.num_rows++;
+			}
+		}
+	}
+	pthread_mutex_unlock(&lb_mutex);
+
+	memcpy(buffer, &reply, sizeof(LeaderboardReply));
+	net_send(client_socket, buffer, sizeof(LeaderboardReply) + reply.num_rows * sizeof(LeaderboardRow), 0);
+	free(buffer);
 }
 
 //check if a tile contains a mine
 bool tile_contains_mine(int x, int y, GameState current_game){
-    if (current_game.tiles[x][y].is_mine == true){
+    if (tile_bit(current_game.mines, TILE_INDEX(x, y))){
         return true;
     } else{
         return false;
@@ -835,74 +5668,671 @@ bool tile_contains_mine(int x, int y, GameState current_game){
 //set up adjacent mines based on position of mines
 GameState set_adjacent_mines(int x, int y, GameState current_game){
     if ((x+1) < NUM_TILES_X){
-            current_game.tiles[x+1][y].adjacent_mines++;
+            increment_adjacent_mines(current_game.adjacent_mines, TILE_INDEX(x+1, y));
             if ((y-1) >= 0){
-                current_game.tiles[x+1][y-1].adjacent_mines++;
+                increment_adjacent_mines(current_game.adjacent_mines, TILE_INDEX(x+1, y-1));
             }
             if ((y+1) < NUM_TILES_Y){
-                current_game.tiles[x+1][y+1].adjacent_mines++;
+                increment_adjacent_mines(current_game.adjacent_mines, TILE_INDEX(x+1, y+1));
             }
         }
         if ((y+1) < NUM_TILES_Y){
-            current_game.tiles[x][y+1].adjacent_mines++;
+            increment_adjacent_mines(current_game.adjacent_mines, TILE_INDEX(x, y+1));
         }
         if ((y-1) >= 0){
-            current_game.tiles[x][y-1].adjacent_mines++;
+            increment_adjacent_mines(current_game.adjacent_mines, TILE_INDEX(x, y-1));
         }
         if ((x-1) >= 0){
-            current_game.tiles[x-1][y].adjacent_mines++;
+            increment_adjacent_mines(current_game.adjacent_mines, TILE_INDEX(x-1, y));
             if ((y-1) >= 0){
-                current_game.tiles[x-1][y-1].adjacent_mines++;
+                increment_adjacent_mines(current_game.adjacent_mines, TILE_INDEX(x-1, y-1));
             }
             if ((y+1) < NUM_TILES_Y){
-                current_game.tiles[x-1][y+1].adjacent_mines++;
+                increment_adjacent_mines(current_game.adjacent_mines, TILE_INDEX(x-1, y+1));
             }
         }
         return current_game;
 }
 
 //randomly place mines
-GameState place_mines(GameState current_game){
+GameState place_mines(GameState current_game, unsigned int *seed){
     for (int i = 0; i< NUM_MINES; i++){
         int x, y;
         do {
-			//pthreads_mutex_lock(&mutex);
-            x = rand() % NUM_TILES_X;
-            y = rand() % NUM_TILES_Y;
-			//pthreads_mutex_unlock(&mutex);
+            x = rand_r(seed) % NUM_TILES_X;
+            y = rand_r(seed) % NUM_TILES_Y;
         } while (tile_contains_mine(x, y, current_game));
-        current_game.tiles[x][y].is_mine = true;
+        set_tile_bit(current_game.mines, TILE_INDEX(x, y));
         current_game = set_adjacent_mines(x, y, current_game);
-        printf("Mine at: (x, y) = (%d, %d)\n", x, y);
     }
     return current_game;
 }
 
-GameState setup_minesweeper(void){
-    //initialise Game
-    GameState current_game = {.num_fields_revealed = 0, .num_flags = 0, .num_mines_remaining = NUM_MINES, .hit_mine = false};
-    for (int i = 0; i<NUM_TILES_X; i++){
-        for (int j = 0; j<NUM_TILES_Y; j++){
-            current_game.tiles[i][j].is_mine = false;
-            current_game.tiles[i][j].revealed = false;
+//print where the mines are on a board
+void print_mines(GameState current_game){
+    for (int x = 0; x < NUM_TILES_X; x++){
+        for (int y = 0; y < NUM_TILES_Y; y++){
+            if (tile_contains_mine(x, y, current_game)){
+                printf("Mine at: (x, y) = (%d, %d)\n", x, y);
+            }
         }
     }
+}
+
+GameState setup_minesweeper(unsigned int *seed){
+    //initialise Game
+    //all packed tile arrays start zeroed - no mines, nothing revealed or flagged
+    GameState current_game = {.num_fields_revealed = 0, .num_flags = 0, .num_mines_remaining = NUM_MINES, .hit_mine = false,
+                              .seed = *seed, .start_tile = -1};
     //place 10 mines randomly
-   	puts("placing mines");
-    current_game = place_mines(current_game);
+    current_game = place_mines(current_game, seed);
 
     return current_game;
 }
 
-void sig_handler(int num){
-	printf("\n Ctrl + c detectected, initialising client termination \n");
-	int socket_desc;
-	terminate_client(socket_desc);
-	exit(1);
+//get the tiles bordering a tile. returns the number of neighbours.
+int tile_neighbours(int index, int neighbours[8]){
+    int x = index / NUM_TILES_Y;
+    int y = index % NUM_TILES_Y;
+    int num_neighbours = 0;
+    for (int i = x-1; i <= x+1; i++){
+        for (int j = y-1; j <= y+1; j++){
+            if ((i != x || j != y) && i >= 0 && i < NUM_TILES_X && j >= 0 && j < NUM_TILES_Y){
+                neighbours[num_neighbours++] = TILE_INDEX(i, j);
+            }
+        }
+    }
+    return num_neighbours;
 }
 
-void terminate_client(int client_socket){
-	printf("\nDisconnecting client\n");
-	close(client_socket);
-	memset(&client_socket,0,sizeof(client_socket));
+//what the no-guess solver knows about each tile
+#define SOLVER_UNKNOWN 0
+#define SOLVER_SAFE 1
+#define SOLVER_MINE 2
+
+//state of the no-guess solver. revealed tiles whose neighbourhood changed
+//are queued so each deduction only rechecks the constraints it affected.
+typedef struct {
+    const GameState *game;
+    uint8_t known[NUM_TILES];
+    bool queued[NUM_TILES];
+    int queue[NUM_TILES];
+    int queue_head;
+    int queue_count;
+    int num_safe;
+    int num_mines;
+} Solver;
+
+//number of boards tried and accepted by the no-guess generator
+atomic_long no_guess_candidates = 0;
+atomic_long no_guess_boards = 0;
+
+//queue a revealed tile for its constraint to be rechecked
+void solver_enqueue(Solver *solver, int index){
+    if (solver->known[index] == SOLVER_SAFE && !solver->queued[index]){
+        solver->queued[index] = true;
+        solver->queue[(solver->queue_head + solver->queue_count) % NUM_TILES] = index;
+        solver->queue_count++;
+    }
+}
+
+//queue a tile and all revealed tiles around it
+void solver_enqueue_around(Solver *solver, int index){
+    int neighbours[8];
+    int num_neighbours = tile_neighbours(index, neighbours);
+    solver_enqueue(solver, index);
+    for (int i = 0; i < num_neighbours; i++){
+        solver_enqueue(solver, neighbours[i]);
+    }
+}
+
+//reveal a tile deduced to be safe, opening up zero regions like test_tile
+void solver_mark_safe(Solver *solver, int index){
+    //tiles are marked as they are pushed so each is on the stack at most once
+    int stack[NUM_TILES];
+    int stack_size = 0;
+    if (solver->known[index] != SOLVER_UNKNOWN){
+        return;
+    }
+    solver->known[index] = SOLVER_SAFE;
+    stack[stack_size++] = index;
+    while (stack_size > 0){
+        int tile = stack[--stack_size];
+        solver->num_safe++;
+        solver_enqueue_around(solver, tile);
+        if (tile_adjacent_mines(solver->game->adjacent_mines, tile) == 0){
+            int neighbours[8];
+            int num_neighbours = tile_neighbours(tile, neighbours);
+            for (int i = 0; i < num_neighbours; i++){
+                if (solver->known[neighbours[i]] == SOLVER_UNKNOWN){
+                    solver->known[neighbours[i]] = SOLVER_SAFE;
+                    stack[stack_size++] = neighbours[i];
+                }
+            }
+        }
+    }
+}
+
+//record a tile deduced to be a mine
+void solver_mark_mine(Solver *solver, int index){
+    if (solver->known[index] == SOLVER_UNKNOWN){
+        solver->known[index] = SOLVER_MINE;
+        solver->num_mines++;
+        solver_enqueue_around(solver, index);
+    }
+}
+
+//collect the unknown tiles around a revealed tile and how many of them are mines
+int solver_unknown_neighbours(Solver *solver, int index, int unknown[8], int *mines_needed){
+    int neighbours[8];
+    int num_neighbours = tile_neighbours(index, neighbours);
+    int num_unknown = 0;
+    *mines_needed = tile_adjacent_mines(solver->game->adjacent_mines, index);
+    for (int i = 0; i < num_neighbours; i++){
+        if (solver->known[neighbours[i]] == SOLVER_UNKNOWN){
+            unknown[num_unknown++] = neighbours[i];
+        } else if (solver->known[neighbours[i]] == SOLVER_MINE){
+            (*mines_needed)--;
+        }
+    }
+    return num_unknown;
+}
+
+//apply a single tile's constraint - all remaining neighbours are safe or all are mines
+void solver_apply_constraint(Solver *solver, int index){
+    int unknown[8], mines_needed;
+    int num_unknown = solver_unknown_neighbours(solver, index, unknown, &mines_needed);
+    if (num_unknown == 0){
+        return;
+    }
+    for (int i = 0; i < num_unknown; i++){
+        if (mines_needed == 0){
+            solver_mark_safe(solver, unknown[i]);
+        } else if (mines_needed == num_unknown){
+            solver_mark_mine(solver, unknown[i]);
+        }
+    }
+}
+
+//compare overlapping constraints - if one tile's unknown neighbours are a
+//subset of another's, the difference holds the difference in mines.
+//returns true if anything new was deduced.
+bool solver_apply_subsets(Solver *solver){
+    for (int a = 0; a < NUM_TILES; a++){
+        int unknown_a[8], needed_a;
+        if (solver->known[a] != SOLVER_SAFE){
+            continue;
+        }
+        int num_unknown_a = solver_unknown_neighbours(solver, a, unknown_a, &needed_a);
+        if (num_unknown_a == 0){
+            continue;
+        }
+        int ax = a / NUM_TILES_Y, ay = a % NUM_TILES_Y;
+        for (int bx = ax-2; bx <= ax+2; bx++){
+            for (int by = ay-2; by <= ay+2; by++){
+                if (bx < 0 || bx >= NUM_TILES_X || by < 0 || by >= NUM_TILES_Y || (bx == ax && by == ay)){
+                    continue;
+                }
+                int b = TILE_INDEX(bx, by);
+                int unknown_b[8], needed_b;
+                if (solver->known[b] != SOLVER_SAFE){
+                    continue;
+                }
+                int num_unknown_b = solver_unknown_neighbours(solver, b, unknown_b, &needed_b);
+                if (num_unknown_b <= num_unknown_a){
+                    continue;
+                }
+
+                //check a's unknown tiles are all around b and collect the rest of b's
+                int difference[8], num_difference = 0, num_shared = 0;
+                for (int i = 0; i < num_unknown_b; i++){
+                    bool shared = false;
+                    for (int j = 0; j < num_unknown_a; j++){
+                        if (unknown_b[i] == unknown_a[j]){
+                            shared = true;
+                        }
+                    }
+                    if (shared){
+                        num_shared++;
+                    } else{
+                        difference[num_difference++] = unknown_b[i];
+                    }
+                }
+                if (num_shared != num_unknown_a){
+                    continue;
+                }
+
+                int mines_in_difference = needed_b - needed_a;
+                if (mines_in_difference == 0){
+                    for (int i = 0; i < num_difference; i++){
+                        solver_mark_safe(solver, difference[i]);
+                    }
+                    return true;
+                } else if (mines_in_difference == num_difference){
+                    for (int i = 0; i < num_difference; i++){
+                        solver_mark_mine(solver, difference[i]);
+                    }
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+//use the total mine count once the frontier is exhausted.
+//returns true if anything new was deduced.
+bool solver_apply_mine_count(Solver *solver){
+    int mines_left = NUM_MINES - solver->num_mines;
+    int num_unknown = NUM_TILES - solver->num_safe - solver->num_mines;
+    if (num_unknown == 0 || (mines_left != 0 && mines_left != num_unknown)){
+        return false;
+    }
+    for (int i = 0; i < NUM_TILES; i++){
+        if (solver->known[i] == SOLVER_UNKNOWN){
+            if (mines_left == 0){
+                solver_mark_safe(solver, i);
+            } else{
+                solver_mark_mine(solver, i);
+            }
+        }
+    }
+    return true;
+}
+
+//check a board can be cleared by deduction alone after revealing the start tile
+bool solve_board(const GameState *current_game, int start_x, int start_y){
+    Solver solver;
+    memset(&solver, 0, sizeof(solver));
+    solver.game = current_game;
+    solver_mark_safe(&solver, TILE_INDEX(start_x, start_y));
+
+    while (solver.num_safe < NUM_TILES - NUM_MINES){
+        if (solver.queue_count > 0){
+            int index = solver.queue[solver.queue_head];
+            solver.queue_head = (solver.queue_head + 1) % NUM_TILES;
+            solver.queue_count--;
+            solver.queued[index] = false;
+            solver_apply_constraint(&solver, index);
+        } else if (!solver_apply_subsets(&solver) && !solver_apply_mine_count(&solver)){
+            //stuck - the player would have to guess
+            return false;
+        }
+    }
+    return true;
+}
+
+//generate a board that can be solved without guessing. the board is handed
+//out with its starting zero region already revealed.
+GameState setup_no_guess_minesweeper(unsigned int *seed){
+    while (1){
+        GameState current_game = setup_minesweeper(seed);
+        atomic_fetch_add_explicit(&no_guess_candidates, 1, memory_order_relaxed);
+
+        //start from a random tile with no adjacent mines
+        int openings[NUM_TILES], num_openings = 0;
+        for (int i = 0; i < NUM_TILES; i++){
+            if (!tile_bit(current_game.mines, i) && tile_adjacent_mines(current_game.adjacent_mines, i) == 0){
+                openings[num_openings++] = i;
+            }
+        }
+        if (num_openings == 0){
+            continue;
+        }
+        int start = openings[rand_r(seed) % num_openings];
+        int start_x = start / NUM_TILES_Y, start_y = start % NUM_TILES_Y;
+
+        if (solve_board(&current_game, start_x, start_y)){
+            atomic_fetch_add_explicit(&no_guess_boards, 1, memory_order_relaxed);
+            current_game.start_tile = start;
+            return test_tile(current_game, start_x, start_y);
+        }
+    }
+}
+
+//number of boards left to generate in the solver benchmark
+atomic_int solver_benchmark_remaining;
+
+void *solver_benchmark_loop(void *data){
+    unsigned int seed = (unsigned int)(uintptr_t)data;
+    while (atomic_fetch_sub(&solver_benchmark_remaining, 1) > 0){
+        setup_no_guess_minesweeper(&seed);
+    }
+    return NULL;
+}
+
+//measure how many no-guess boards per second the generator threads produce
+void run_solver_benchmark(int num_boards){
+    pthread_t threads[NUM_NO_GUESS_GENERATOR_THREADS];
+    struct timespec begin, end;
+
+    atomic_store(&solver_benchmark_remaining, num_boards);
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    for (int i = 0; i < NUM_NO_GUESS_GENERATOR_THREADS; i++){
+        pthread_create(&threads[i], NULL, solver_benchmark_loop, (void*)(uintptr_t)(RANDOM_NUMBER_SEED + i));
+    }
+    for (int i = 0; i < NUM_NO_GUESS_GENERATOR_THREADS; i++){
+        pthread_join(threads[i], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double seconds = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+    long candidates = atomic_load(&no_guess_candidates);
+    long boards = atomic_load(&no_guess_boards);
+    printf("Generated %ld no-guess boards with %d threads in %.3f seconds\n", boards, NUM_NO_GUESS_GENERATOR_THREADS, seconds);
+    printf("%.1f boards per second, %.1f candidate boards solved per second, %.1f%% solvable\n",
+        boards / seconds, candidates / seconds, 100.0 * boards / candidates);
+}
+
+
+
+//receiving end of the send benchmark, reading and dropping everything sent to it
+void *send_benchmark_sink(void *data){
+    int sock = *(int*)data;
+    static __thread char buffer[SEND_BENCHMARK_CHUNK];
+    while (recv(sock, buffer, sizeof(buffer), 0) > 0){
+    }
+    return NULL;
+}
+
+//open a loopback tcp connection for a benchmark, with a thread running the far end
+int send_benchmark_connect(pthread_t *sink_thread, int *sink_socket, void *(*sink)(void *)){
+    struct sockaddr_in address = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK), .sin_port = 0};
+    socklen_t address_size = sizeof(address);
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener < 0 || sock < 0 || bind(listener, (struct sockaddr*)&address, sizeof(address)) < 0
+            || listen(listener, 1) < 0 || getsockname(listener, (struct sockaddr*)&address, &address_size) < 0
+            || connect(sock, (struct sockaddr*)&address, sizeof(address)) < 0
+            || (*sink_socket = accept(listener, NULL, NULL)) < 0){
+        perror("send benchmark connection");
+        exit(1);
+    }
+    close(listener);
+    /* both ends are set up like a real client's connection and the */
+    /* socket admit_client gives its session                          */
+    set_nodelay(sock);
+    set_nodelay(*sink_socket);
+    pthread_create(sink_thread, NULL, sink, sink_socket);
+    return sock;
+}
+
+//read zerocopy completions off a socket's error queue. returns how many sends they
+//cover and adds the ones the kernel had to copy anyway to copied.
+long reap_zerocopy_completions(int sock, bool wait, long *copied){
+    long completed = 0;
+    while (1) {
+        if (wait) {
+            struct pollfd pfd = {.fd = sock, .events = 0};
+            if (poll(&pfd, 1, 1000) <= 0) {
+                return completed;
+            }
+        }
+        char control[128];
+        struct msghdr msg = {.msg_control = control, .msg_controllen = sizeof(control)};
+        if (recvmsg(sock, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            return completed;
+        }
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            struct sock_extended_err *err = (struct sock_extended_err*)CMSG_DATA(cmsg);
+            if (err->ee_errno != 0 || err->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+            long range = err->ee_data - err->ee_info + 1;
+            completed += range;
+            if (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                *copied += range;
+            }
+        }
+        wait = false;
+    }
+}
+
+#define SEND_COPY 0
+#define SEND_FILE 1
+#define SEND_ZEROCOPY 2
+
+//send a whole payload one way and report the sending thread's cpu time per byte
+void send_benchmark_run(int method, const char *name, int fd, const uint8_t *payload, size_t size){
+    pthread_t sink_thread;
+    int sink_socket;
+    int sock = send_benchmark_connect(&sink_thread, &sink_socket, send_benchmark_sink);
+    if (method == SEND_ZEROCOPY) {
+        int one = 1;
+        if (setsockopt(sock, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) < 0) {
+            printf("%-9s not supported here (%s)\n", name, strerror(errno));
+            close(sock);
+            pthread_join(sink_thread, NULL);
+            close(sink_socket);
+            return;
+        }
+    }
+
+    struct timespec cpu_begin, cpu_end, begin, end;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_begin);
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    long zerocopy_sends = 0, completed = 0, copied = 0;
+    off_t offset = 0;
+    while ((size_t)offset < size) {
+        size_t length = size - offset < SEND_BENCHMARK_CHUNK ? size - offset : SEND_BENCHMARK_CHUNK;
+        ssize_t sent;
+        if (method == SEND_FILE) {
+            sent = sendfile(sock, fd, &offset, length);
+        } else {
+            int flags = method == SEND_ZEROCOPY && length >= ZEROCOPY_MIN_BYTES ? MSG_ZEROCOPY : 0;
+            sent = send(sock, payload + offset, length, flags);
+            if (sent > 0) {
+                offset += sent;
+                zerocopy_sends += flags != 0;
+            } else if (sent < 0 && errno == ENOBUFS) {
+                /* too many pinned sends in flight - wait for some to complete */
+                completed += reap_zerocopy_completions(sock, true, &copied);
+                continue;
+            }
+            if (method == SEND_ZEROCOPY) {
+                completed += reap_zerocopy_completions(sock, false, &copied);
+            }
+        }
+        if (sent < 0) {
+            perror(name);
+            break;
+        }
+    }
+    /* the payload can't be reused until the kernel is done with every pinned page */
+    while (completed < zerocopy_sends) {
+        long reaped = reap_zerocopy_completions(sock, true, &copied);
+        if (reaped == 0) {
+            break;
+        }
+        completed += reaped;
+    }
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+    close(sock);
+    pthread_join(sink_thread, NULL);
+    close(sink_socket);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double cpu_ns = (cpu_end.tv_sec - cpu_begin.tv_sec) * 1e9 + (cpu_end.tv_nsec - cpu_begin.tv_nsec);
+    double seconds = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+    printf("%-9s %8.1f MB/s, %.3f ns of sender cpu per byte", name, offset / seconds / 1e6, cpu_ns / offset);
+    if (method == SEND_ZEROCOPY) {
+        printf(" (%ld of %ld zerocopy sends were copied by the kernel)", copied, zerocopy_sends);
+    }
+    printf("\n");
+}
+
+//compare the cpu cost per byte of copying a large leaderboard snapshot into the
+//kernel with send, with sendfile from its file, and with MSG_ZEROCOPY from a mapping of it
+void run_send_benchmark(int megabytes){
+    size_t size = (size_t)megabytes * 1024 * 1024;
+    int fd = memfd_create("send benchmark", MFD_CLOEXEC);
+    if (fd < 0 || ftruncate(fd, size) < 0) {
+        perror("run_send_benchmark");
+        exit(1);
+    }
+    uint8_t *payload = (uint8_t*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (payload == MAP_FAILED) {
+        perror("run_send_benchmark");
+        exit(1);
+    }
+    /* fill it with leaderboard lines so it looks like a real snapshot */
+    size_t filled = 0;
+    for (int i = 0; filled < size; i++) {
+        char line[100];
+        int length = snprintf(line, sizeof(line), "player%d \t\t %.3f seconds \t %d games won, %d games played\n", i, i / 1000.0, i % 50, i % 50 + 7);
+        if ((size_t)length > size - filled) {
+            length = size - filled;
+        }
+        memcpy(payload + filled, line, length);
+        filled += length;
+    }
+
+    printf("Sending a %d MB leaderboard snapshot over loopback in %d KB pieces\n", megabytes, SEND_BENCHMARK_CHUNK / 1024);
+    send_benchmark_run(SEND_COPY, "send", fd, payload, size);
+    send_benchmark_run(SEND_FILE, "sendfile", fd, payload, size);
+    send_benchmark_run(SEND_ZEROCOPY, "zerocopy", fd, payload, size);
+    munmap(payload, size);
+    close(fd);
+}
+
+//client end of a benchmark session - reads each board and confirmation and answers with a move
+void *net_benchmark_client(void *data){
+    int sock = *(int*)data;
+    char board[NUM_TILES * sizeof(int) + sizeof(int) + NUM_TILES * sizeof(bool) + sizeof("received") - 1];
+    char selection = 'R';
+    while (recv(sock, board, sizeof(board), MSG_WAITALL) == sizeof(board)) {
+        send(sock, &selection, sizeof(selection), 0);
+    }
+    return NULL;
+}
+
+//server end of a benchmark session - the send and receive pattern of a move, through the net_ functions
+void *net_benchmark_server(void *data){
+    int sock = *(int*)data;
+    int tiles[NUM_TILES_X][NUM_TILES_Y] = {{0}};
+    bool flagged_tiles[NUM_TILES_X][NUM_TILES_Y] = {{false}};
+    int remaining_mines = NUM_MINES;
+    char selection;
+    struct timespec cpu_begin, cpu_end;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_begin);
+    for (int i = 0; i < NET_BENCHMARK_MOVES; i++) {
+        struct iovec board[3] = {
+            {.iov_base = tiles, .iov_len = sizeof(tiles)},
+            {.iov_base = &remaining_mines, .iov_len = sizeof(int)},
+            {.iov_base = flagged_tiles, .iov_len = sizeof(flagged_tiles)},
+        };
+        net_sendv(sock, board, 3);
+        net_send(sock, "received", strlen("received"), 0);
+        if (net_recv(sock, &selection, sizeof(selection), 0) <= 0) {
+            perror("net benchmark");
+            break;
+        }
+    }
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+    net_ring_exit();
+    shutdown(sock, SHUT_WR);
+    /* hand back cpu time and syscalls through the socket slot */
+    long *results = (long*)malloc(2 * sizeof(long));
+    results[0] = (cpu_end.tv_sec - cpu_begin.tv_sec) * 1000000000L + (cpu_end.tv_nsec - cpu_begin.tv_nsec);
+    results[1] = net_syscalls;
+    return results;
+}
+
+//run every session through one backend and report moves per second, cpu and syscalls per move
+void net_benchmark_run(int num_sessions, bool io_uring){
+    use_io_uring = io_uring;
+    pthread_t *servers = (pthread_t*)malloc(num_sessions * sizeof(pthread_t));
+    pthread_t *clients = (pthread_t*)malloc(num_sessions * sizeof(pthread_t));
+    int *sockets = (int*)malloc(2 * num_sessions * sizeof(int));
+    struct timespec begin, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    for (int i = 0; i < num_sessions; i++) {
+        sockets[2*i] = send_benchmark_connect(&clients[i], &sockets[2*i + 1], net_benchmark_client);
+        pthread_create(&servers[i], NULL, net_benchmark_server, &sockets[2*i]);
+    }
+    long cpu_ns = 0, syscalls = 0;
+    for (int i = 0; i < num_sessions; i++) {
+        long *results;
+        pthread_join(servers[i], (void**)&results);
+        cpu_ns += results[0];
+        syscalls += results[1];
+        free(results);
+        pthread_join(clients[i], NULL);
+        close(sockets[2*i]);
+        close(sockets[2*i + 1]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double seconds = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+    long moves = (long)num_sessions * NET_BENCHMARK_MOVES;
+    printf("%-9s %9.0f moves per second, %.2f us of server cpu and %.2f syscalls per move\n",
+        io_uring ? "io_uring" : "blocking", moves / seconds, cpu_ns / 1e3 / moves, (double)syscalls / moves);
+    free(servers);
+    free(clients);
+    free(sockets);
+}
+
+//compare the blocking socket path with the batched io_uring one on loopback sessions
+void run_net_benchmark(int num_sessions){
+    printf("%d sessions making %d moves each over loopback\n", num_sessions, NET_BENCHMARK_MOVES);
+    net_benchmark_run(num_sessions, false);
+    net_benchmark_run(num_sessions, true);
+}
+
+static int compare_tile_changes(const void *a, const void *b){
+    uint32_t first = ((const SharedTileChange*)a)->index, second = ((const SharedTileChange*)b)->index;
+    return (first > second) - (first < second);
+}
+
+//time one flood reveal from the given tile, with a fresh revealed bitboard.
+//the changes are sorted so runs can be compared whatever order they revealed in.
+double reveal_benchmark_run(SharedBoard *board, int start, SharedChanges *changes){
+    for (int i = 0; i < (board->width * board->height + 63) / 64; i++){
+        atomic_store_explicit(&board->revealed[i], 0, memory_order_relaxed);
+    }
+    changes->num_changes = 0;
+    struct timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    shared_reveal(board, start % board->width, start / board->width, changes);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    qsort(changes->changes, changes->num_changes, sizeof(SharedTileChange), compare_tile_changes);
+    return (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+}
+
+//compare a serial flood reveal on a large sparse board with the parallel one
+//on more and more threads, checking each reveals exactly the same tiles
+void run_reveal_benchmark(int size){
+    if (size < SHARED_VIEW_SIZE || (long)size * size > (1 << 28)){
+        fprintf(stderr, "the reveal benchmark board must be from %d to 16384 tiles wide\n", SHARED_VIEW_SIZE);
+        return;
+    }
+    SharedBoard *board = shared_board_create(size, size, (long)size * size / 500 + 1);
+    int start = size / 2 * size + size / 2;
+    while (tile_bit(board->mines, start) || tile_adjacent_mines(board->adjacent_mines, start) != 0){
+        start = (start + 1) % (size * size);
+    }
+
+    SharedChanges serial = {.changes = NULL, .num_changes = 0, .capacity = 0};
+    SharedChanges parallel = {.changes = NULL, .num_changes = 0, .capacity = 0};
+    double serial_seconds = reveal_benchmark_run(board, start, &serial);
+    printf("%dx%d board with %d mines, %d cpus online\n", size, size, board->num_mines, (int)sysconf(_SC_NPROCESSORS_ONLN));
+    printf("serial:     %d tiles revealed in %.3f seconds\n", serial.num_changes, serial_seconds);
+
+    int max_threads = 2 * (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (max_threads < 4){
+        max_threads = 4;
+    }
+    for (int threads = 1; threads <= max_threads; threads *= 2){
+        reveal_pool_start(threads);
+        double seconds = reveal_benchmark_run(board, start, &parallel);
+        reveal_pool_stop();
+        bool matches = parallel.num_changes == serial.num_changes
+            && memcmp(parallel.changes, serial.changes, serial.num_changes * sizeof(SharedTileChange)) == 0;
+        printf("%2d threads: %d tiles revealed in %.3f seconds, %.2fx serial, %s\n", threads, parallel.num_changes,
+            seconds, serial_seconds / seconds, matches ? "same tiles as serial" : "DIFFERENT TILES FROM SERIAL");
+    }
+    free(serial.changes);
+    free(parallel.changes);
+    shared_board_release(board);
 }